@@ -0,0 +1,79 @@
+// Runtime of the programs lispyc makes, see "Ahead-of-time compilation"
+// in lispy.h
+#include "lispy.h"
+
+#ifdef LISPY_AOT
+
+// Run the forms of the program, printing their values like the REPL does
+int laot_run(void){
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+    laot_init(e);
+
+    for(int i = 0; laot_forms[i] && e->run; i++) {
+        lval *v = laot_forms[i](e);
+        lval_println(e, v);
+        lval_del(v);
+    }
+
+    lenv_del(e);
+    return 0;
+}
+
+// An S-Expression, or a Q-Expression if "open" is '{', of the "n" values
+// passed after "n"
+lval *laot_expr(int open, int n, ...){
+    lval *x = open == '(' ? lval_sexpr() : lval_qexpr();
+    va_list va;
+    va_start(va, n);
+    for(int i = 0; i < n; i++) lval_add(x, va_arg(va, lval*));
+    va_end(va);
+    return x;
+}
+
+// Function of the builtin named "name" in "e", NULL if there is none
+lbuiltin laot_builtin(lenv *e, char *name){
+    int i = lenv_find(e, lsym_intern(name));
+    if(i < 0 || LVAL_TYPE(e->vals[i]) != LVAL_FUN) return NULL;
+    return e->vals[i]->builtin;
+}
+
+// Whether the "n" evaluated values at "args" are a call to the builtin "f"
+// with no errors in the arguments, so "f" can be called with laot_args
+int laot_direct(lval **args, int n, lbuiltin f){
+    if(!f || n < 2 || LVAL_TYPE(args[0]) != LVAL_FUN || args[0]->builtin != f) return 0;
+    for(int i = 1; i < n; i++) {
+        if(LVAL_TYPE(args[i]) == LVAL_ERR) return 0;
+    }
+    return 1;
+}
+
+// The arguments of the call at "args" in an S-Expression, the function is
+// released
+lval *laot_args(lval **args, int n){
+    lval_del(args[0]);
+    lval *v = lval_sexpr();
+    v->cell = lcell_resize(NULL, 0, n - 1);
+    memcpy(v->cell, args + 1, sizeof(lval*) * (n - 1));
+    v->count = n - 1;
+    v->cap = n - 1;
+    return v;
+}
+
+// Whether "v" is an error, which is the value of the whole form
+int laot_err(lval *v){
+    return LVAL_TYPE(v) == LVAL_ERR;
+}
+
+// Release the "n" values at "args"
+void laot_drop(lval **args, int n){
+    for(int i = 0; i < n; i++) lval_del(args[i]);
+}
+
+// Evaluate an S-Expression of the "n" values at "args", which are all
+// consumed
+lval *laot_call(lenv *e, lval **args, int n){
+    return lvm_apply(e, args, n);
+}
+
+#endif
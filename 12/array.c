@@ -0,0 +1,732 @@
+// Numeric arrays and their kernels, see "Numeric arrays" in lispy.h
+#include "lispy.h"
+
+lsimd_kernels *lsimd;
+
+lval *lval_arr(int elem, int len){
+    lval *v = lval_alloc(LVAL_ARR, LVAL_SIZEOF(len) + sizeof(int64_t) * len);
+    v->elem = elem;
+    v->len = len;
+    return v;
+}
+
+// Array with the numbers of a list
+lval *builtin_array(lenv *e, lval *v){
+    LASSERT_NUM("array", v, 1);
+    LASSERT(v, lval_is_list(v->cell[0]), LERR_TYPE, "Function 'array' passed incorrect type. Got %s, expected %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+    lval *x = lval_take(v, 0);
+    if(x->type == LVAL_VEC) x = lval_vec_to_expr(x, LVAL_QEXPR);
+
+    int i = larr_non_number(x);
+    if(i >= 0) {
+        lval *err = lval_err(LERR_TYPE, "Function 'array' passed a list with a %s, expected %s or %s", ltype_name(LVAL_TYPE(x->cell[i])),
+                ltype_name(LVAL_NUM), ltype_name(LVAL_DBL));
+        lval_del(x);
+        return err;
+    }
+    return larr_from(x, LARR_INT);
+}
+
+// Index of the first value of the Q-Expression "x" that isn't an integer
+// or a float, or -1
+int larr_non_number(lval *x){
+    for(int i = 0; i < x->count; i++) {
+        int t = LVAL_TYPE(x->cell[i]);
+        if(t != LVAL_NUM && t != LVAL_DBL) return i;
+    }
+    return -1;
+}
+
+// Array of the numbers of the Q-Expression "x", which is deleted. It has
+// "elem" numbers unless there is a float.
+lval *larr_from(lval *x, int elem){
+    for(int i = 0; i < x->count; i++) {
+        if(LVAL_TYPE(x->cell[i]) == LVAL_DBL) elem = LARR_DBL;
+    }
+
+    lval *a = lval_arr(elem, x->count);
+    for(int i = 0; i < x->count; i++) {
+        if(elem == LARR_INT) LVAL_I64(a)[i] = lval_num_value(x->cell[i]);
+        else LVAL_F64(a)[i] = lval_to_double(x->cell[i]);
+    }
+    lval_del(x);
+    return a;
+}
+
+// (range end), (range start end) or (range start end step), "end" excluded
+lval *builtin_range(lenv *e, lval *v){
+    LASSERT(v, (v->count >= 1 && v->count <= 3), LERR_ARITY, "Function 'range' passed incorrect number of arguments. Got %i, expected 1 to 3", v->count);
+    int elem = LARR_INT;
+    for(int i = 0; i < v->count; i++) {
+        int t = LVAL_TYPE(v->cell[i]);
+        LASSERT(v, (t == LVAL_NUM || t == LVAL_DBL), LERR_TYPE, "Function 'range' passed incorrect type for argument %i. Got %s, expected %s",
+                i, ltype_name(t), ltype_name(LVAL_NUM));
+        if(t == LVAL_DBL) elem = LARR_DBL;
+    }
+
+    double start = v->count > 1 ? lval_to_double(v->cell[0]) : 0;
+    double end = lval_to_double(v->cell[v->count > 1]);
+    double step = v->count > 2 ? lval_to_double(v->cell[2]) : 1;
+    LASSERT(v, (step != 0), LERR_VALUE, "Function 'range' passed a step of 0");
+
+    double n = ceil((end - start) / step);
+    if(n < 0) n = 0;
+    LASSERT(v, (n <= INT_MAX / 8), LERR_LIMIT, "Function 'range' would make %.0f numbers", n);
+
+    lval *a = lval_arr(elem, n);
+    if(elem == LARR_INT) {
+        long s = lval_num_value(v->cell[0]);
+        long d = v->count > 2 ? lval_num_value(v->cell[2]) : 1;
+        if(v->count == 1) s = 0;
+        for(int i = 0; i < a->len; i++) LVAL_I64(a)[i] = s + i * d;
+    } else {
+        for(int i = 0; i < a->len; i++) LVAL_F64(a)[i] = start + i * step;
+    }
+    lval_del(v);
+    return a;
+}
+
+// Reduction of one array
+lval *larr_reduce(lval *v, char *func, int op){
+    LASSERT_NUM(func, v, 1);
+    LASSERT_TYPE(func, v, 0, LVAL_ARR);
+    lval *x = v->cell[0];
+    LASSERT(v, (op == LARR_ADD || x->len > 0), LERR_VALUE, "Function '%s' passed an empty array", func);
+
+    lval *r;
+    if(x->elem == LARR_INT) r = lval_num(lsimd->reduce_i64(LVAL_I64(x), x->len, op));
+    else r = lval_dbl(lsimd->reduce_f64(LVAL_F64(x), x->len, op));
+    lval_del(v);
+    return r;
+}
+
+lval *builtin_sum(lenv *e, lval *v) { return larr_reduce(v, "sum", LARR_ADD); }
+lval *builtin_amin(lenv *e, lval *v) { return larr_reduce(v, "amin", LARR_MIN); }
+lval *builtin_amax(lenv *e, lval *v) { return larr_reduce(v, "amax", LARR_MAX); }
+
+lval *builtin_dot(lenv *e, lval *v){
+    LASSERT_NUM("dot", v, 2);
+    LASSERT_TYPE("dot", v, 0, LVAL_ARR);
+    LASSERT_TYPE("dot", v, 1, LVAL_ARR);
+    lval *x = v->cell[0];
+    lval *y = v->cell[1];
+    LASSERT(v, (x->len == y->len), LERR_VALUE, "Function 'dot' passed arrays of %i and %i numbers", x->len, y->len);
+
+    lval *r;
+    if(x->elem == LARR_INT && y->elem == LARR_INT) {
+        r = lval_num(lsimd->dot_i64(LVAL_I64(x), LVAL_I64(y), x->len));
+    } else {
+        double one;
+        double *a = larr_to_f64(x, &one);
+        double *b = larr_to_f64(y, &one);
+        r = lval_dbl(lsimd->dot_f64(a, b, x->len));
+        if(a != LVAL_F64(x)) free(a);
+        if(b != LVAL_F64(y)) free(b);
+    }
+    lval_del(v);
+    return r;
+}
+
+// Doubles of an array or a number. Integer arrays are converted to a new
+// block the caller frees, a number is stored in "one".
+double *larr_to_f64(lval *v, double *one){
+    if(LVAL_TYPE(v) != LVAL_ARR) {
+        *one = lval_to_double(v);
+        return one;
+    }
+    if(v->elem == LARR_DBL) return LVAL_F64(v);
+
+    double *d = malloc(sizeof(double) * ((unsigned)v->len + 1));
+    for(int i = 0; i < v->len; i++) d[i] = LVAL_I64(v)[i];
+    return d;
+}
+
+// Array of the result of an element by element operation, "x" or "y"
+// itself when one of them can be reused
+lval *larr_result(lval *x, lval *y, int elem, int len){
+    if(LVAL_TYPE(x) == LVAL_ARR && x->elem == elem && lval_unique(x)) return lval_copy(x);
+    if(LVAL_TYPE(y) == LVAL_ARR && y->elem == elem && lval_unique(y)) return lval_copy(y);
+    return lval_arr(elem, len);
+}
+
+// "x op y" where one or both are arrays, both are deleted
+lval *lval_arr_arith(lval *x, lval *y, char *op){
+    int kop;
+    switch(op[0] == 'm' ? op[1] : op[0]) {
+        case '+': kop = LARR_ADD; break;
+        case '-': kop = LARR_SUB; break;
+        case '*': kop = LARR_MUL; break;
+        case '/': kop = LARR_DIV; break;
+        case '%': kop = LARR_MOD; break;
+        case 'i': kop = LARR_MIN; break;
+        case 'a': kop = LARR_MAX; break;
+        default:
+            lval_del(x);
+            lval_del(y);
+            return lval_err(LERR_TYPE, "Function '%s' doesn't work on arrays", op);
+    }
+
+    lval *err = larr_check(x, y, op);
+    if(!err && (kop == LARR_DIV || kop == LARR_MOD) && larr_has_zero(y)) err = lval_err(LERR_DIV_ZERO, "Divide by zero");
+    if(err) {
+        lval_del(x);
+        lval_del(y);
+        return err;
+    }
+
+    int as = LVAL_TYPE(x) != LVAL_ARR;
+    int bs = LVAL_TYPE(y) != LVAL_ARR;
+    int len = as ? y->len : x->len;
+    int ints = larr_is_int(x) && larr_is_int(y);
+    lval *r;
+
+    if(ints) {
+        int64_t sa, sb;
+        int64_t *a = as ? &sa : LVAL_I64(x);
+        int64_t *b = bs ? &sb : LVAL_I64(y);
+        if(as) sa = lval_num_value(x);
+        if(bs) sb = lval_num_value(y);
+        r = larr_result(x, y, LARR_INT, len);
+        lsimd->map_i64(LVAL_I64(r), a, b, len, kop, as, bs);
+    } else {
+        double sa, sb;
+        double *a = larr_to_f64(x, &sa);
+        double *b = larr_to_f64(y, &sb);
+        r = larr_result(x, y, LARR_DBL, len);
+        lsimd->map_f64(LVAL_F64(r), a, b, len, kop, as, bs);
+        if(!as && a != LVAL_F64(x)) free(a);
+        if(!bs && b != LVAL_F64(y)) free(b);
+    }
+
+    lval_del(x);
+    lval_del(y);
+    return r;
+}
+
+// Error for operands that can't be used together, or NULL
+lval *larr_check(lval *x, lval *y, char *op){
+    int tx = LVAL_TYPE(x);
+    int ty = LVAL_TYPE(y);
+    if(tx != LVAL_ARR && tx != LVAL_NUM && tx != LVAL_DBL) {
+        return lval_err(LERR_TYPE, "Function '%s' can't use a %s with an array", op, ltype_name(tx));
+    }
+    if(ty != LVAL_ARR && ty != LVAL_NUM && ty != LVAL_DBL) {
+        return lval_err(LERR_TYPE, "Function '%s' can't use a %s with an array", op, ltype_name(ty));
+    }
+    if(tx == LVAL_ARR && ty == LVAL_ARR && x->len != y->len) {
+        return lval_err(LERR_VALUE, "Function '%s' passed arrays of %i and %i numbers", op, x->len, y->len);
+    }
+    return NULL;
+}
+
+// A number that is zero, or an array with a zero
+int larr_has_zero(lval *v){
+    if(LVAL_TYPE(v) != LVAL_ARR) return lval_to_double(v) == 0;
+    for(int i = 0; i < v->len; i++) {
+        if(v->elem == LARR_INT ? LVAL_I64(v)[i] == 0 : LVAL_F64(v)[i] == 0) return 1;
+    }
+    return 0;
+}
+
+int larr_is_int(lval *v){
+    if(LVAL_TYPE(v) == LVAL_ARR) return v->elem == LARR_INT;
+    return LVAL_TYPE(v) == LVAL_NUM;
+}
+
+// Comparison of two numbers as 1 or 0, or of arrays element by element as
+// a mask of 0 and 1
+lval *builtin_ord(lenv *e, lval *v, char *op){
+    LASSERT_NUM(op, v, 2);
+    lval *x = v->cell[0];
+    lval *y = v->cell[1];
+
+    int kop = LARR_NE;
+    if(strcmp(op, "<") == 0) kop = LARR_LT;
+    if(strcmp(op, ">") == 0) kop = LARR_GT;
+    if(strcmp(op, "<=") == 0) kop = LARR_LE;
+    if(strcmp(op, ">=") == 0) kop = LARR_GE;
+    if(strcmp(op, "==") == 0) kop = LARR_EQ;
+
+    if(lval_is_number(x) && lval_is_number(y)) {
+        int r;
+        if(LVAL_TYPE(x) == LVAL_DBL || LVAL_TYPE(y) == LVAL_DBL) {
+            r = lsimd_cmp_f64(lval_to_double(x), lval_to_double(y), kop);
+        } else {
+            lint a, b;
+            lint_of(&a, x);
+            lint_of(&b, y);
+            r = lsimd_cmp_i64(lint_cmp(&a, &b), 0, kop);
+        }
+        lval_del(v);
+        return lval_num(r);
+    }
+
+    LASSERT(v, (LVAL_TYPE(x) == LVAL_ARR || LVAL_TYPE(y) == LVAL_ARR), LERR_TYPE, "Function '%s' passed %s and %s, expected numbers or an %s",
+            op, ltype_name(LVAL_TYPE(x)), ltype_name(LVAL_TYPE(y)), ltype_name(LVAL_ARR));
+    lval *err = larr_check(x, y, op);
+    if(err) {
+        lval_del(v);
+        return err;
+    }
+
+    int as = LVAL_TYPE(x) != LVAL_ARR;
+    int bs = LVAL_TYPE(y) != LVAL_ARR;
+    lval *r = lval_arr(LARR_INT, as ? y->len : x->len);
+
+    if(larr_is_int(x) && larr_is_int(y)) {
+        int64_t sa = as ? lval_num_value(x) : 0;
+        int64_t sb = bs ? lval_num_value(y) : 0;
+        lsimd->cmp_i64(LVAL_I64(r), as ? &sa : LVAL_I64(x), bs ? &sb : LVAL_I64(y), r->len, kop, as, bs);
+    } else {
+        double sa, sb;
+        double *a = larr_to_f64(x, &sa);
+        double *b = larr_to_f64(y, &sb);
+        lsimd->cmp_f64(LVAL_I64(r), a, b, r->len, kop, as, bs);
+        if(!as && a != LVAL_F64(x)) free(a);
+        if(!bs && b != LVAL_F64(y)) free(b);
+    }
+
+    lval_del(v);
+    return r;
+}
+
+lval *builtin_lt(lenv *e, lval *v) { return builtin_ord(e, v, "<"); }
+lval *builtin_gt(lenv *e, lval *v) { return builtin_ord(e, v, ">"); }
+lval *builtin_le(lenv *e, lval *v) { return builtin_ord(e, v, "<="); }
+lval *builtin_ge(lenv *e, lval *v) { return builtin_ord(e, v, ">="); }
+lval *builtin_eq(lenv *e, lval *v) { return builtin_ord(e, v, "=="); }
+lval *builtin_ne(lenv *e, lval *v) { return builtin_ord(e, v, "!="); }
+
+void lval_arr_print(lval *v){
+    printf("#{");
+    for(int i = 0; i < v->len; i++) {
+        if(i) putchar(' ');
+        if(v->elem == LARR_INT) printf("%li", (long)LVAL_I64(v)[i]);
+        else lval_dbl_print(LVAL_F64(v)[i]);
+    }
+    putchar('}');
+}
+
+// Scalar kernels, also used for what the SIMD loops leave over
+double lsimd_op_f64(double a, double b, int op){
+    switch(op) {
+        case LARR_ADD: return a + b;
+        case LARR_SUB: return a - b;
+        case LARR_MUL: return a * b;
+        case LARR_DIV: return a / b;
+        case LARR_MOD: return fmod(a, b);
+        case LARR_MIN: return a < b ? a : b;
+        default: return a > b ? a : b;
+    }
+}
+
+// Wraps around on overflow. Division by zero is checked before.
+int64_t lsimd_op_i64(int64_t a, int64_t b, int op){
+    switch(op) {
+        case LARR_ADD: return (int64_t)((uint64_t)a + (uint64_t)b);
+        case LARR_SUB: return (int64_t)((uint64_t)a - (uint64_t)b);
+        case LARR_MUL: return (int64_t)((uint64_t)a * (uint64_t)b);
+        case LARR_DIV: return b == -1 ? (int64_t)(0 - (uint64_t)a) : a / b;
+        case LARR_MOD: return b == -1 ? 0 : a % b;
+        case LARR_MIN: return a < b ? a : b;
+        default: return a > b ? a : b;
+    }
+}
+
+int lsimd_cmp_f64(double a, double b, int op){
+    switch(op) {
+        case LARR_LT: return a < b;
+        case LARR_GT: return a > b;
+        case LARR_LE: return a <= b;
+        case LARR_GE: return a >= b;
+        case LARR_EQ: return a == b;
+        default: return a != b;
+    }
+}
+
+int lsimd_cmp_i64(int64_t a, int64_t b, int op){
+    switch(op) {
+        case LARR_LT: return a < b;
+        case LARR_GT: return a > b;
+        case LARR_LE: return a <= b;
+        case LARR_GE: return a >= b;
+        case LARR_EQ: return a == b;
+        default: return a != b;
+    }
+}
+
+double lsimd_reduce_f64_scalar(double *x, long n, int op){
+    double acc = op == LARR_ADD ? 0 : x[0];
+    for(long i = 0; i < n; i++) acc = lsimd_op_f64(acc, x[i], op);
+    return acc;
+}
+
+int64_t lsimd_reduce_i64_scalar(int64_t *x, long n, int op){
+    int64_t acc = op == LARR_ADD ? 0 : x[0];
+    for(long i = 0; i < n; i++) acc = lsimd_op_i64(acc, x[i], op);
+    return acc;
+}
+
+double lsimd_dot_f64_scalar(double *a, double *b, long n){
+    double acc = 0;
+    for(long i = 0; i < n; i++) acc += a[i] * b[i];
+    return acc;
+}
+
+int64_t lsimd_dot_i64_scalar(int64_t *a, int64_t *b, long n){
+    uint64_t acc = 0;
+    for(long i = 0; i < n; i++) acc += (uint64_t)a[i] * (uint64_t)b[i];
+    return (int64_t)acc;
+}
+
+void lsimd_map_f64_scalar(double *r, double *a, double *b, long n, int op, int as, int bs){
+    for(long i = 0; i < n; i++) r[i] = lsimd_op_f64(a[as ? 0 : i], b[bs ? 0 : i], op);
+}
+
+void lsimd_map_i64_scalar(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs){
+    for(long i = 0; i < n; i++) r[i] = lsimd_op_i64(a[as ? 0 : i], b[bs ? 0 : i], op);
+}
+
+void lsimd_cmp_f64_scalar(int64_t *r, double *a, double *b, long n, int op, int as, int bs){
+    for(long i = 0; i < n; i++) r[i] = lsimd_cmp_f64(a[as ? 0 : i], b[bs ? 0 : i], op);
+}
+
+void lsimd_cmp_i64_scalar(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs){
+    for(long i = 0; i < n; i++) r[i] = lsimd_cmp_i64(a[as ? 0 : i], b[bs ? 0 : i], op);
+}
+
+// Finish a map kernel from element "i" with the scalar one
+#define LSIMD_TAIL(kernel, r, a, b, i, n, op, as, bs) \
+    kernel((r) + (i), (as) ? (a) : (a) + (i), (bs) ? (b) : (b) + (i), (n) - (i), op, as, bs)
+
+// Double arithmetic on SSE2 (prefix _mm_) or AVX (prefix _mm256_) vectors
+#define LSIMD_F64_OP(p, op, a, b) \
+    ((op) == LARR_ADD ? p##add_pd(a, b) : \
+     (op) == LARR_SUB ? p##sub_pd(a, b) : \
+     (op) == LARR_MUL ? p##mul_pd(a, b) : \
+     (op) == LARR_DIV ? p##div_pd(a, b) : \
+     (op) == LARR_MIN ? p##min_pd(a, b) : p##max_pd(a, b))
+
+#ifdef __SSE2__
+
+double lsimd_reduce_f64_sse2(double *x, long n, int op){
+    if(n < 4) return lsimd_reduce_f64_scalar(x, n, op);
+
+    __m128d acc = op == LARR_ADD ? _mm_setzero_pd() : _mm_loadu_pd(x);
+    long i = 0;
+    for(; i + 2 <= n; i += 2) acc = LSIMD_F64_OP(_mm_, op, acc, _mm_loadu_pd(x + i));
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double r = lsimd_op_f64(lanes[0], lanes[1], op);
+    for(; i < n; i++) r = lsimd_op_f64(r, x[i], op);
+    return r;
+}
+
+// Only sums are vectorized, SSE2 has no 64 bit comparisons
+int64_t lsimd_reduce_i64_sse2(int64_t *x, long n, int op){
+    if(op != LARR_ADD) return lsimd_reduce_i64_scalar(x, n, op);
+
+    __m128i acc = _mm_setzero_si128();
+    long i = 0;
+    for(; i + 2 <= n; i += 2) acc = _mm_add_epi64(acc, _mm_loadu_si128((__m128i*)(x + i)));
+
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i*)lanes, acc);
+    int64_t r = lsimd_op_i64(lanes[0], lanes[1], LARR_ADD);
+    for(; i < n; i++) r = lsimd_op_i64(r, x[i], LARR_ADD);
+    return r;
+}
+
+double lsimd_dot_f64_sse2(double *a, double *b, long n){
+    __m128d acc = _mm_setzero_pd();
+    long i = 0;
+    for(; i + 2 <= n; i += 2) acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + lsimd_dot_f64_scalar(a + i, b + i, n - i);
+}
+
+// fmod has no SIMD instruction
+void lsimd_map_f64_sse2(double *r, double *a, double *b, long n, int op, int as, int bs){
+    if(op == LARR_MOD) {
+        lsimd_map_f64_scalar(r, a, b, n, op, as, bs);
+        return;
+    }
+
+    __m128d sa = _mm_set1_pd(a[0]);
+    __m128d sb = _mm_set1_pd(b[0]);
+    long i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128d va = as ? sa : _mm_loadu_pd(a + i);
+        __m128d vb = bs ? sb : _mm_loadu_pd(b + i);
+        _mm_storeu_pd(r + i, LSIMD_F64_OP(_mm_, op, va, vb));
+    }
+    LSIMD_TAIL(lsimd_map_f64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+// Only additions and subtractions are vectorized
+void lsimd_map_i64_sse2(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs){
+    if(op != LARR_ADD && op != LARR_SUB) {
+        lsimd_map_i64_scalar(r, a, b, n, op, as, bs);
+        return;
+    }
+
+    __m128i sa = _mm_set1_epi64x(a[0]);
+    __m128i sb = _mm_set1_epi64x(b[0]);
+    long i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128i va = as ? sa : _mm_loadu_si128((__m128i*)(a + i));
+        __m128i vb = bs ? sb : _mm_loadu_si128((__m128i*)(b + i));
+        __m128i vr = op == LARR_ADD ? _mm_add_epi64(va, vb) : _mm_sub_epi64(va, vb);
+        _mm_storeu_si128((__m128i*)(r + i), vr);
+    }
+    LSIMD_TAIL(lsimd_map_i64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+void lsimd_cmp_f64_sse2(int64_t *r, double *a, double *b, long n, int op, int as, int bs){
+    __m128d sa = _mm_set1_pd(a[0]);
+    __m128d sb = _mm_set1_pd(b[0]);
+    __m128i one = _mm_set1_epi64x(1);
+    long i = 0;
+    for(; i + 2 <= n; i += 2) {
+        __m128d va = as ? sa : _mm_loadu_pd(a + i);
+        __m128d vb = bs ? sb : _mm_loadu_pd(b + i);
+        __m128d m;
+        switch(op) {
+            case LARR_LT: m = _mm_cmplt_pd(va, vb); break;
+            case LARR_GT: m = _mm_cmpgt_pd(va, vb); break;
+            case LARR_LE: m = _mm_cmple_pd(va, vb); break;
+            case LARR_GE: m = _mm_cmpge_pd(va, vb); break;
+            case LARR_EQ: m = _mm_cmpeq_pd(va, vb); break;
+            default: m = _mm_cmpneq_pd(va, vb); break;
+        }
+        _mm_storeu_si128((__m128i*)(r + i), _mm_and_si128(_mm_castpd_si128(m), one));
+    }
+    LSIMD_TAIL(lsimd_cmp_f64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+#endif
+
+#ifdef LSIMD_AVX2
+
+// 64 bit multiplication from 32 bit ones, AVX2 has no vpmullq
+#define LSIMD_AVX2_MUL_I64(a, b) _mm256_add_epi64(_mm256_mul_epu32(a, b), \
+    _mm256_slli_epi64(_mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b), \
+                                       _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32))), 32))
+
+#define LSIMD_AVX2_I64_OP(op, a, b) \
+    ((op) == LARR_ADD ? _mm256_add_epi64(a, b) : \
+     (op) == LARR_SUB ? _mm256_sub_epi64(a, b) : \
+     (op) == LARR_MUL ? LSIMD_AVX2_MUL_I64(a, b) : \
+     (op) == LARR_MIN ? _mm256_blendv_epi8(a, b, _mm256_cmpgt_epi64(a, b)) : \
+                        _mm256_blendv_epi8(b, a, _mm256_cmpgt_epi64(a, b)))
+
+// Two accumulators to hide the latency of the additions
+__attribute__((target("avx2")))
+double lsimd_reduce_f64_avx2(double *x, long n, int op){
+    if(n < 8) return lsimd_reduce_f64_scalar(x, n, op);
+
+    __m256d acc0 = op == LARR_ADD ? _mm256_setzero_pd() : _mm256_loadu_pd(x);
+    __m256d acc1 = acc0;
+    long i = 0;
+    for(; i + 8 <= n; i += 8) {
+        acc0 = LSIMD_F64_OP(_mm256_, op, acc0, _mm256_loadu_pd(x + i));
+        acc1 = LSIMD_F64_OP(_mm256_, op, acc1, _mm256_loadu_pd(x + i + 4));
+    }
+    acc0 = LSIMD_F64_OP(_mm256_, op, acc0, acc1);
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc0);
+    double r = lanes[0];
+    for(int j = 1; j < 4; j++) r = lsimd_op_f64(r, lanes[j], op);
+    for(; i < n; i++) r = lsimd_op_f64(r, x[i], op);
+    return r;
+}
+
+__attribute__((target("avx2")))
+int64_t lsimd_reduce_i64_avx2(int64_t *x, long n, int op){
+    if(n < 8 || op == LARR_DIV) return lsimd_reduce_i64_scalar(x, n, op);
+
+    __m256i acc0 = op == LARR_ADD ? _mm256_setzero_si256() : _mm256_loadu_si256((__m256i*)x);
+    __m256i acc1 = acc0;
+    long i = 0;
+    for(; i + 8 <= n; i += 8) {
+        acc0 = LSIMD_AVX2_I64_OP(op, acc0, _mm256_loadu_si256((__m256i*)(x + i)));
+        acc1 = LSIMD_AVX2_I64_OP(op, acc1, _mm256_loadu_si256((__m256i*)(x + i + 4)));
+    }
+    acc0 = LSIMD_AVX2_I64_OP(op, acc0, acc1);
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc0);
+    int64_t r = lanes[0];
+    for(int j = 1; j < 4; j++) r = lsimd_op_i64(r, lanes[j], op);
+    for(; i < n; i++) r = lsimd_op_i64(r, x[i], op);
+    return r;
+}
+
+__attribute__((target("avx2,fma")))
+double lsimd_dot_f64_avx2(double *a, double *b, long n){
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    long i = 0;
+    for(; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc0);
+        acc1 = _mm256_fmadd_pd(_mm256_loadu_pd(a + i + 4), _mm256_loadu_pd(b + i + 4), acc1);
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lsimd_dot_f64_scalar(a + i, b + i, n - i);
+}
+
+__attribute__((target("avx2")))
+int64_t lsimd_dot_i64_avx2(int64_t *a, int64_t *b, long n){
+    __m256i acc = _mm256_setzero_si256();
+    long i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i va = _mm256_loadu_si256((__m256i*)(a + i));
+        __m256i vb = _mm256_loadu_si256((__m256i*)(b + i));
+        acc = _mm256_add_epi64(acc, LSIMD_AVX2_MUL_I64(va, vb));
+    }
+
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i*)lanes, acc);
+    uint64_t r = (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    return (int64_t)(r + (uint64_t)lsimd_dot_i64_scalar(a + i, b + i, n - i));
+}
+
+__attribute__((target("avx2")))
+void lsimd_map_f64_avx2(double *r, double *a, double *b, long n, int op, int as, int bs){
+    if(op == LARR_MOD) {
+        lsimd_map_f64_scalar(r, a, b, n, op, as, bs);
+        return;
+    }
+
+    __m256d sa = _mm256_set1_pd(a[0]);
+    __m256d sb = _mm256_set1_pd(b[0]);
+    long i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d va = as ? sa : _mm256_loadu_pd(a + i);
+        __m256d vb = bs ? sb : _mm256_loadu_pd(b + i);
+        _mm256_storeu_pd(r + i, LSIMD_F64_OP(_mm256_, op, va, vb));
+    }
+    LSIMD_TAIL(lsimd_map_f64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+// Integer division has no SIMD instruction
+__attribute__((target("avx2")))
+void lsimd_map_i64_avx2(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs){
+    if(op == LARR_DIV || op == LARR_MOD) {
+        lsimd_map_i64_scalar(r, a, b, n, op, as, bs);
+        return;
+    }
+
+    __m256i sa = _mm256_set1_epi64x(a[0]);
+    __m256i sb = _mm256_set1_epi64x(b[0]);
+    long i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i va = as ? sa : _mm256_loadu_si256((__m256i*)(a + i));
+        __m256i vb = bs ? sb : _mm256_loadu_si256((__m256i*)(b + i));
+        _mm256_storeu_si256((__m256i*)(r + i), LSIMD_AVX2_I64_OP(op, va, vb));
+    }
+    LSIMD_TAIL(lsimd_map_i64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+__attribute__((target("avx2")))
+void lsimd_cmp_f64_avx2(int64_t *r, double *a, double *b, long n, int op, int as, int bs){
+    __m256d sa = _mm256_set1_pd(a[0]);
+    __m256d sb = _mm256_set1_pd(b[0]);
+    __m256i one = _mm256_set1_epi64x(1);
+    long i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256d va = as ? sa : _mm256_loadu_pd(a + i);
+        __m256d vb = bs ? sb : _mm256_loadu_pd(b + i);
+        __m256d m;
+        switch(op) {
+            case LARR_LT: m = _mm256_cmp_pd(va, vb, _CMP_LT_OQ); break;
+            case LARR_GT: m = _mm256_cmp_pd(va, vb, _CMP_GT_OQ); break;
+            case LARR_LE: m = _mm256_cmp_pd(va, vb, _CMP_LE_OQ); break;
+            case LARR_GE: m = _mm256_cmp_pd(va, vb, _CMP_GE_OQ); break;
+            case LARR_EQ: m = _mm256_cmp_pd(va, vb, _CMP_EQ_OQ); break;
+            default: m = _mm256_cmp_pd(va, vb, _CMP_NEQ_UQ); break;
+        }
+        _mm256_storeu_si256((__m256i*)(r + i), _mm256_and_si256(_mm256_castpd_si256(m), one));
+    }
+    LSIMD_TAIL(lsimd_cmp_f64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+// Only "greater than" and "equal" exist, the others are derived from them
+__attribute__((target("avx2")))
+void lsimd_cmp_i64_avx2(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs){
+    __m256i sa = _mm256_set1_epi64x(a[0]);
+    __m256i sb = _mm256_set1_epi64x(b[0]);
+    __m256i one = _mm256_set1_epi64x(1);
+    long i = 0;
+    for(; i + 4 <= n; i += 4) {
+        __m256i va = as ? sa : _mm256_loadu_si256((__m256i*)(a + i));
+        __m256i vb = bs ? sb : _mm256_loadu_si256((__m256i*)(b + i));
+        __m256i m;
+        switch(op) {
+            case LARR_LT: m = _mm256_cmpgt_epi64(vb, va); break;
+            case LARR_GT: m = _mm256_cmpgt_epi64(va, vb); break;
+            case LARR_LE: m = _mm256_andnot_si256(_mm256_cmpgt_epi64(va, vb), one); break;
+            case LARR_GE: m = _mm256_andnot_si256(_mm256_cmpgt_epi64(vb, va), one); break;
+            case LARR_EQ: m = _mm256_cmpeq_epi64(va, vb); break;
+            default: m = _mm256_andnot_si256(_mm256_cmpeq_epi64(va, vb), one); break;
+        }
+        _mm256_storeu_si256((__m256i*)(r + i), _mm256_and_si256(m, one));
+    }
+    LSIMD_TAIL(lsimd_cmp_i64_scalar, r, a, b, i, n, op, as, bs);
+}
+
+#endif
+
+lsimd_kernels lsimd_scalar = {
+    "scalar",
+    lsimd_reduce_f64_scalar, lsimd_reduce_i64_scalar,
+    lsimd_dot_f64_scalar, lsimd_dot_i64_scalar,
+    lsimd_map_f64_scalar, lsimd_map_i64_scalar,
+    lsimd_cmp_f64_scalar, lsimd_cmp_i64_scalar,
+    lmath_f64_scalar
+};
+
+#ifdef __SSE2__
+lsimd_kernels lsimd_sse2 = {
+    "sse2",
+    lsimd_reduce_f64_sse2, lsimd_reduce_i64_sse2,
+    lsimd_dot_f64_sse2, lsimd_dot_i64_scalar,
+    lsimd_map_f64_sse2, lsimd_map_i64_sse2,
+    lsimd_cmp_f64_sse2, lsimd_cmp_i64_scalar,
+    lmath_f64_sse2
+};
+#endif
+
+#ifdef LSIMD_AVX2
+lsimd_kernels lsimd_avx2 = {
+    "avx2",
+    lsimd_reduce_f64_avx2, lsimd_reduce_i64_avx2,
+    lsimd_dot_f64_avx2, lsimd_dot_i64_avx2,
+    lsimd_map_f64_avx2, lsimd_map_i64_avx2,
+    lsimd_cmp_f64_avx2, lsimd_cmp_i64_avx2,
+    lmath_f64_avx2
+};
+#endif
+
+// Pick the kernels for this CPU, or the ones named by LISPY_SIMD
+void lsimd_init(void){
+    char *want = getenv("LISPY_SIMD");
+    lsimd = &lsimd_scalar;
+#ifdef __SSE2__
+    if(!want || strcmp(want, "sse2") == 0 || strcmp(want, "avx2") == 0) lsimd = &lsimd_sse2;
+#endif
+#ifdef LSIMD_AVX2
+    __builtin_cpu_init();
+    if((!want || strcmp(want, "avx2") == 0) && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        lsimd = &lsimd_avx2;
+    }
+#endif
+}
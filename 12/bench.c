@@ -0,0 +1,712 @@
+// Benchmarks, built with "make bench". Run "./bench name..." to only run
+// some of them.
+#include "lispy.h"
+
+#ifdef LISPY_BENCH
+
+double bench_ns(clock_t start, long ops){
+    return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC / ops;
+}
+
+// Global lookup cost as the number of globals grows
+void bench_lookup(void){
+    const long lookups = 4000000;
+    char name[32];
+
+    printf("%10s %14s %14s %14s\n", "globals", "ns/lookup", "ns/builtin", "ns/cached");
+    for(int n = 10; n <= 100000; n *= 10) {
+        lenv *e = lenv_new();
+        lenv_add_builtins(e);
+
+        lval **keys = malloc(sizeof(lval*) * n);
+        for(int i = 0; i < n; i++) {
+            snprintf(name, sizeof(name), "g%i", i);
+            keys[i] = lval_sym(name);
+            lval *x = lval_num(i);
+            lenv_put(e, keys[i], x);
+            lval_del(x);
+        }
+
+        // Look up the globals in a scattered order
+        clock_t start = clock();
+        unsigned long r = 1;
+        for(long i = 0; i < lookups; i++) {
+            r = r * 6364136223846793005UL + 1442695040888963407UL;
+            lval_del(lenv_get(e, keys[(r >> 33) % n]));
+        }
+        double global = bench_ns(start, lookups);
+
+        // And a builtin, added before all of them
+        lval *plus = lval_sym("+");
+        start = clock();
+        for(long i = 0; i < lookups; i++) lval_del(lenv_get(e, plus));
+        double builtin = bench_ns(start, lookups);
+
+        // The same scattered lookups through the cache in the symbols
+        start = clock();
+        r = 1;
+        for(long i = 0; i < lookups; i++) {
+            r = r * 6364136223846793005UL + 1442695040888963407UL;
+            lval_del(lval_lookup(e, keys[(r >> 33) % n]));
+        }
+        double cached = bench_ns(start, lookups);
+
+        printf("%10i %14.1f %14.1f %14.1f\n", n, global, builtin, cached);
+
+        lval_del(plus);
+        for(int i = 0; i < n; i++) lval_del(keys[i]);
+        free(keys);
+        lenv_del(e);
+    }
+}
+
+// Evaluate "(func ...)" with n arguments built by "arg" and return the
+// time per argument
+double bench_variadic(lenv *e, char *func, int n, lval *(*arg)(int)){
+    lval *v = lval_sexpr();
+    lval_add(v, lval_sym(func));
+    for(int i = 0; i < n; i++) lval_add(v, arg(i));
+
+    clock_t start = clock();
+    lval_del(lval_eval(e, v));
+    return bench_ns(start, n);
+}
+
+lval *bench_one(int i){
+    return lval_num(1);
+}
+
+// A quoted single element list "{i}"
+lval *bench_list(int i){
+    return lval_add(lval_qexpr(), lval_num(i));
+}
+
+// Variadic builtins over long argument lists, the time per element should
+// stay flat as n grows
+void bench_variadic_all(void){
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    printf("%10s %14s %14s\n", "elements", "ns/+ arg", "ns/join arg");
+    for(int n = 1000; n <= 1000000; n *= 10) {
+        double add = bench_variadic(e, "+", n, bench_one);
+        double join = bench_variadic(e, "join", n, bench_list);
+        printf("%10i %14.1f %14.1f\n", n, add, join);
+    }
+
+    lenv_del(e);
+}
+
+// Time of "builtin" on a list that stays alive, so every call makes a new
+// version of it
+double bench_version(lenv *e, lbuiltin builtin, lval *list, lval *arg, long ops){
+    clock_t start = clock();
+    for(long i = 0; i < ops; i++) {
+        lval *v = lval_sexpr();
+        if(arg) lval_add(v, lval_copy(arg));
+        lval_del(builtin(e, lval_add(v, lval_copy(list))));
+    }
+    return bench_ns(start, ops);
+}
+
+// tail and cons on shared Q-Expressions and vectors
+void bench_vector(void){
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+    lval *one = lval_num(1);
+
+    printf("%10s %14s %14s %14s %14s\n", "elements", "ns/qexpr tail", "ns/vec tail", "ns/qexpr cons", "ns/vec cons");
+    for(int n = 1000; n <= 1000000; n *= 10) {
+        lval *q = lval_qexpr();
+        for(int i = 0; i < n; i++) lval_add(q, lval_num(i));
+        lval *v = lval_vec_from(lval_copy(q));
+
+        // Q-Expressions copy the whole list every time
+        long ops = 20000000 / n;
+        double qtail = bench_version(e, builtin_tail, q, NULL, ops);
+        double vtail = bench_version(e, builtin_tail, v, NULL, 1000000);
+        double qcons = bench_version(e, builtin_cons, q, one, ops);
+        double vcons = bench_version(e, builtin_cons, v, one, 1000000);
+        printf("%10i %14.1f %14.1f %14.1f %14.1f\n", n, qtail, vtail, qcons, vcons);
+
+        lval_del(q);
+        lval_del(v);
+    }
+
+    lenv_del(e);
+}
+
+// Big number multiplication, factorials and printing
+void bench_bignum(void){
+    printf("%10s %14s %14s\n", "limbs", "us/schoolbook", "us/karatsuba");
+    for(int n = 16; n <= 4096; n *= 4) {
+        uint64_t *a = malloc(sizeof(uint64_t) * n);
+        uint64_t *b = malloc(sizeof(uint64_t) * n);
+        uint64_t *r = malloc(sizeof(uint64_t) * 2 * n);
+        unsigned long x = 1;
+        for(int i = 0; i < n; i++) {
+            a[i] = x = x * 6364136223846793005UL + 1442695040888963407UL;
+            b[i] = x = x * 6364136223846793005UL + 1442695040888963407UL;
+        }
+
+        long ops = 100000000L / ((long)n * n) + 1;
+        clock_t start = clock();
+        for(long i = 0; i < ops; i++) lnat_mul_school(r, a, n, b, n);
+        double school = bench_ns(start, ops) / 1000;
+        start = clock();
+        for(long i = 0; i < ops; i++) lnat_mul(r, a, n, b, n);
+        double karatsuba = bench_ns(start, ops) / 1000;
+        printf("%10i %14.1f %14.1f\n", n, school, karatsuba);
+
+        free(a);
+        free(b);
+        free(r);
+    }
+
+    printf("%10s %14s %14s\n", "n!", "ms/multiply", "ms/print");
+    for(int n = 1000; n <= 100000; n *= 10) {
+        clock_t start = clock();
+        lval *f = lval_num(1);
+        for(int i = 2; i <= n; i++) f = lval_arith(f, lval_num(i), "*");
+        double mul = bench_ns(start, 1000000);
+
+        start = clock();
+        free(lval_big_string(f));
+        double print = bench_ns(start, 1000000);
+
+        printf("%10i %14.1f %14.1f\n", n, mul, print);
+        lval_del(f);
+    }
+}
+
+// Math kernels over a million doubles, and the builtins on a Q-Expression
+void bench_math(void){
+    const int n = 1000000;
+    double *x = malloc(sizeof(double) * n);
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    char *names[] = { "sqrt", "exp", "log", "sin" };
+    void (*kernels[])(double*, int) = { lmath_sqrt, lmath_exp, lmath_log, lmath_sin };
+
+    printf("%10s %14s %14s\n", "function", "ns/kernel", "ns/builtin");
+    for(int k = 0; k < 4; k++) {
+        for(int i = 0; i < n; i++) x[i] = 1 + i * 1e-6;
+        clock_t start = clock();
+        kernels[k](x, n);
+        double kernel = bench_ns(start, n);
+
+        lval *q = lval_qexpr();
+        for(int i = 0; i < n; i++) lval_add(q, lval_dbl(1 + i * 1e-6));
+        lval *v = lval_add(lval_add(lval_sexpr(), lval_sym(names[k])), q);
+        start = clock();
+        lval_del(lval_eval(e, v));
+        double builtin = bench_ns(start, n);
+
+        printf("%10s %14.2f %14.2f\n", names[k], kernel, builtin);
+    }
+
+    // One libm call per value, for comparison
+    double (*libm[])(double) = { sqrt, exp, log, sin };
+    for(int k = 0; k < 4; k++) {
+        for(int i = 0; i < n; i++) x[i] = 1 + i * 1e-6;
+        clock_t start = clock();
+        for(int i = 0; i < n; i++) x[i] = libm[k](x[i]);
+        char name[16];
+        snprintf(name, sizeof(name), "%s libm", names[k]);
+        printf("%10s %14.2f\n", name, bench_ns(start, n));
+    }
+
+    free(x);
+    lenv_del(e);
+}
+
+// Array kernels of every table this CPU can run, over a million numbers
+void bench_array(void){
+    const int n = 1000000;
+    const int reps = 20;
+    double *a = malloc(sizeof(double) * n);
+    double *b = malloc(sizeof(double) * n);
+    int64_t *ia = malloc(sizeof(int64_t) * n);
+    int64_t *r = malloc(sizeof(int64_t) * n);
+    for(int i = 0; i < n; i++) {
+        a[i] = i * 1e-3;
+        b[i] = 1 - i * 1e-6;
+        ia[i] = i;
+    }
+
+    lsimd_kernels *tables[3];
+    int count = 0;
+    tables[count++] = &lsimd_scalar;
+#ifdef __SSE2__
+    tables[count++] = &lsimd_sse2;
+#endif
+#ifdef LSIMD_AVX2
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) tables[count++] = &lsimd_avx2;
+#endif
+
+    // Results are summed so the loops can't be dropped
+    volatile double sink = 0;
+    printf("%8s %10s %10s %10s %10s %10s %10s  (ns/number)\n", "kernels", "sum", "sum int", "min", "dot", "add", "<");
+    for(int k = 0; k < count; k++) {
+        lsimd_kernels *t = tables[k];
+        double ns[6];
+        clock_t start = clock();
+        for(int j = 0; j < reps; j++) sink += t->reduce_f64(a, n, LARR_ADD);
+        ns[0] = bench_ns(start, (long)n * reps);
+        start = clock();
+        for(int j = 0; j < reps; j++) sink += t->reduce_i64(ia, n, LARR_ADD);
+        ns[1] = bench_ns(start, (long)n * reps);
+        start = clock();
+        for(int j = 0; j < reps; j++) sink += t->reduce_f64(b, n, LARR_MIN);
+        ns[2] = bench_ns(start, (long)n * reps);
+        start = clock();
+        for(int j = 0; j < reps; j++) sink += t->dot_f64(a, b, n);
+        ns[3] = bench_ns(start, (long)n * reps);
+        start = clock();
+        for(int j = 0; j < reps; j++) t->map_f64((double*)r, a, b, n, LARR_ADD, 0, 0);
+        ns[4] = bench_ns(start, (long)n * reps);
+        start = clock();
+        for(int j = 0; j < reps; j++) t->cmp_f64(r, a, b, n, LARR_LT, 0, 0);
+        ns[5] = bench_ns(start, (long)n * reps);
+        printf("%8s %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n", t->name, ns[0], ns[1], ns[2], ns[3], ns[4], ns[5]);
+    }
+
+    free(a);
+    free(b);
+    free(ia);
+    free(r);
+}
+
+// Read the Lispy source "src". The parsers are made on the first call.
+lval *bench_read(char *src){
+    static mpc_parser_t *p[7];
+    if(!p[0]) {
+        char *names[] = { "number", "symbol", "sexpr", "qexpr", "vector", "expr", "lispy" };
+        for(int i = 0; i < 7; i++) p[i] = mpc_new(names[i]);
+        mpca_lang(MPC_LANG_DEFAULT, LISPY_GRAMMAR, p[0], p[1], p[2], p[3], p[4], p[5], p[6]);
+    }
+
+    mpc_result_t r;
+    if(!mpc_parse("<bench>", src, p[6], &r)) {
+        mpc_err_print(r.error);
+        mpc_err_delete(r.error);
+        return lval_err(LERR_VALUE, "Benchmark source doesn't parse");
+    }
+    lval *v = lval_read(r.output);
+    mpc_ast_delete(r.output);
+    return v;
+}
+
+// Source of a balanced arithmetic expression "depth" levels deep
+void bench_arith_source(char *s, int depth){
+    if(depth == 0) {
+        strcat(s, "7");
+        return;
+    }
+    strcat(s, depth % 2 ? "(+ " : "(- ");
+    bench_arith_source(s, depth - 1);
+    strcat(s, depth % 3 ? " (* 2 " : " (* 3 ");
+    bench_arith_source(s, depth - 1);
+    strcat(s, "))");
+}
+
+// Nanoseconds per evaluation of "src" after running "setup", with the
+// tree walker or with lvm. "compiled" runs lvm on code compiled once.
+double bench_eval(char *setup, char *src, int vm, int compiled, long reps){
+    lvm_enabled = vm;
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+    lval *(*eval)(lenv*, lval*) = vm ? lvm_eval : lval_eval;
+    lval_del(eval(e, bench_read(setup)));
+
+    lval *v = bench_read(src);
+    lcode *c = compiled ? lcode_compile(v) : NULL;
+    clock_t start = clock();
+    for(long i = 0; i < reps; i++) {
+        if(c) lval_del(lvm_run(e, c));
+        else lval_del(eval(e, lval_copy(v)));
+    }
+    double ns = bench_ns(start, reps);
+
+    if(c) lcode_del(c);
+    lval_del(v);
+    lenv_del(e);
+    lvm_enabled = 1;
+    return ns;
+}
+
+// Source of a sum of "n" times "call"
+char *bench_sum_source(char *call, int n){
+    char *s = calloc(1, 4 + n * (strlen(call) + 1));
+    strcat(s, "(+");
+    for(int i = 0; i < n; i++) {
+        strcat(s, " ");
+        strcat(s, call);
+    }
+    strcat(s, ")");
+    return s;
+}
+
+void bench_bytecode(void){
+    char *arith = calloc(1, 1 << 20);
+    bench_arith_source(arith, 10);
+    char *calls = bench_sum_source("(f 3 4)", 200);
+    char *evals = bench_sum_source("(g 5)", 200);
+
+    struct {
+        char *name;
+        char *setup;
+        char *src;
+    } programs[] = {
+        { "arith", "()", arith },
+        { "calls", "(def {sq} (\\ {x} {* x x})) (def {f} (\\ {x y} {+ (sq x) (sq y) 1}))", calls },
+        { "eval", "(def {g} (\\ {x} {eval {+ (* x 2) (- x 1)}}))", evals },
+    };
+
+    printf("%8s %14s %14s %14s %9s\n", "program", "ns/tree", "ns/bytecode", "ns/compiled", "speedup");
+    for(int i = 0; i < 3; i++) {
+        double tree = bench_eval(programs[i].setup, programs[i].src, 0, 0, 2000);
+        double vm = bench_eval(programs[i].setup, programs[i].src, 1, 0, 2000);
+        double compiled = bench_eval(programs[i].setup, programs[i].src, 1, 1, 2000);
+        printf("%8s %14.0f %14.0f %14.0f %8.2fx\n", programs[i].name, tree, vm, compiled, tree / vm);
+    }
+
+    free(arith);
+    free(calls);
+    free(evals);
+}
+
+// (+ 1 (+ 1 ... 0)) "depth" levels deep, built without the reader
+lval *bench_nested(int depth){
+    lval *v = lval_num(0);
+    for(int i = 0; i < depth; i++) {
+        v = lval_add(lval_add(lval_add(lval_sexpr(), lval_sym("+")), lval_num(1)), v);
+    }
+    return v;
+}
+
+// Nanoseconds per step of the tree walker on "depth" nested expressions,
+// run to the end or "slice" steps at a time
+double bench_nesting_run(lenv *e, int depth, long slice, long *steps){
+    long reps = 2000000 / depth;
+    long total = 0;
+    clock_t start = clock();
+    for(long i = 0; i < reps; i++) {
+        leval ev;
+        leval_init(&ev, e, bench_nested(depth));
+        while(!leval_run(&ev, slice));
+        leval_free(&ev);
+        total += ev.steps;
+        if(LVAL_TYPE(ev.result) != LVAL_NUM || lval_num_value(ev.result) != depth) puts("wrong result");
+        lval_del(ev.result);
+    }
+    *steps = total / reps;
+    return bench_ns(start, total);
+}
+
+void bench_nesting(void){
+    lenv *e = lenv_new();
+    lenv_add_builtins(e);
+
+    printf("%9s %9s %12s %12s\n", "depth", "steps", "ns/step", "ns/sliced");
+    int depths[] = { 10, 1000, 100000, 1000000 };
+    for(int i = 0; i < 4; i++) {
+        long steps;
+        double all = bench_nesting_run(e, depths[i], -1, &steps);
+        double sliced = bench_nesting_run(e, depths[i], 64, &steps);
+        printf("%9i %9li %12.1f %12.1f\n", depths[i], steps, all, sliced);
+    }
+    lenv_del(e);
+}
+
+// Calls that pass functions around: to a higher-order function, partially
+// applied, and made by another function
+void bench_closures(void){
+    char *setup = "(def {twice} (\\ {f x} {f (f x)})) (def {inc} (\\ {x} {+ x 1}))"
+        " (def {add} (\\ {x y} {+ x y})) (def {adder} (\\ {x} {\\ {y} {+ x y}}))";
+    char *twice = bench_sum_source("(twice inc 1)", 200);
+    char *partial = bench_sum_source("(twice (add 2) 1)", 200);
+    char *closure = bench_sum_source("(twice (adder 2) 1)", 200);
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "twice", twice },
+        { "partial", partial },
+        { "closure", closure },
+    };
+
+    printf("%8s %14s %14s\n", "program", "ns/tree", "ns/bytecode");
+    for(int i = 0; i < 3; i++) {
+        double tree = bench_eval(setup, programs[i].src, 0, 0, 2000);
+        double vm = bench_eval(setup, programs[i].src, 1, 0, 2000);
+        printf("%8s %14.0f %14.0f\n", programs[i].name, tree, vm);
+    }
+
+    free(twice);
+    free(partial);
+    free(closure);
+}
+
+// A lambda with constant subexpressions in its body, made with and
+// without constant folding
+void bench_fold(void){
+    char *setup = "(def {f} (\\ {d} {+ d (* 60 60 24) (len (tail {1 2 3 4})) (/ 1000 (max 3 4 5))}))";
+    char *calls = bench_sum_source("(f 3)", 200);
+
+    printf("%8s %14s %14s\n", "folding", "ns/tree", "ns/bytecode");
+    for(int fold = 0; fold < 2; fold++) {
+        lfold_enabled = fold;
+        double tree = bench_eval(setup, calls, 0, 0, 2000);
+        double vm = bench_eval(setup, calls, 1, 0, 2000);
+        printf("%8s %14.0f %14.0f\n", fold ? "on" : "off", tree, vm);
+    }
+    lfold_enabled = 1;
+    free(calls);
+}
+
+// Recursion through "if" and "cond" as special forms, and through the
+// same builtins called eagerly on Q-Expressions passed to "eval"
+void bench_forms(void){
+    char *setup = "(def {eif} if) (def {econd} cond)"
+        " (def {fib} (\\ {n} {if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))}))"
+        " (def {efib} (\\ {n} {eval (eif (< n 2) {n} {+ (efib (- n 1)) (efib (- n 2))})}))"
+        " (def {sgn} (\\ {n} {cond (< n 0) -1 (== n 0) 0 1}))"
+        " (def {esgn} (\\ {n} {eval (econd (< n 0) {-1} (== n 0) {0} {1})}))";
+    char *sgn = bench_sum_source("(sgn 3)", 200);
+    char *esgn = bench_sum_source("(esgn 3)", 200);
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "fib", "(fib 15)" },
+        { "efib", "(efib 15)" },
+        { "sgn", sgn },
+        { "esgn", esgn },
+    };
+
+    printf("%8s %14s %14s\n", "program", "ns/tree", "ns/bytecode");
+    for(int i = 0; i < 4; i++) {
+        double tree = bench_eval(setup, programs[i].src, 0, 0, 200);
+        double vm = bench_eval(setup, programs[i].src, 1, 0, 200);
+        printf("%8s %14.0f %14.0f\n", programs[i].name, tree, vm);
+    }
+
+    free(sgn);
+    free(esgn);
+}
+
+// Expressions whose value is an error, which is never printed
+void bench_errors(void){
+    char *setup = "(def {fib} (\\ {n} {if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))}))"
+        " (def {check} (\\ {x} {+ (nth x 5) (fib 12)}))";
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "unbound", "(+ 1 nope)" },
+        { "nth", "(nth {1 2 3} 7)" },
+        { "first", "(+ (head {}) (fib 15))" },
+        { "check", "(check {1 2})" },
+    };
+
+    printf("%8s %14s %14s\n", "program", "ns/tree", "ns/bytecode");
+    for(int i = 0; i < 4; i++) {
+        double tree = bench_eval(setup, programs[i].src, 0, 0, 2000);
+        double vm = bench_eval(setup, programs[i].src, 1, 0, 2000);
+        printf("%8s %14.0f %14.0f\n", programs[i].name, tree, vm);
+    }
+}
+
+// Summing 0 ... n-1 by recursion and with the loop builtins, per iteration
+void bench_loops(void){
+    char *setup = "(def {s} 0) (def {xs} (range 0 10000))"
+        " (def {sum} (\\ {i n acc} {if (== i n) acc (sum (+ i 1) n (+ acc i))}))";
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "recurse", "(sum 0 10000 0)" },
+        { "dotimes", "(dotimes {i} 10000 {def {s} (+ s i)})" },
+        { "foreach", "(foreach {x} xs {def {s} (+ s x)})" },
+    };
+
+    printf("%8s %14s %14s\n", "program", "ns/tree", "ns/bytecode");
+    for(int i = 0; i < 3; i++) {
+        double tree = bench_eval(setup, programs[i].src, 0, 0, 20) / 10000;
+        double vm = bench_eval(setup, programs[i].src, 1, 0, 20) / 10000;
+        printf("%8s %14.0f %14.0f\n", programs[i].name, tree, vm);
+    }
+}
+
+// Higher-order builtins against the same functions written in Lispy, per
+// value of a list of 1000 numbers
+void bench_hof(void){
+    char *setup = "(def {xs} {}) (dotimes {i} 1000 {def {xs} (cons i xs)})"
+        " (def {sq} (\\ {x} {* x x})) (def {add} (\\ {a b} {+ a b}))"
+        " (def {lmap} (\\ {f l} {if (== (len l) 0) {} (join (list (f (eval (head l)))) (lmap f (tail l)))}))"
+        " (def {lfoldl} (\\ {f z l} {if (== (len l) 0) z (lfoldl f (f z (eval (head l))) (tail l))}))";
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "lmap", "(lmap sq xs)" },
+        { "map", "(map sq xs)" },
+        { "lfoldl", "(lfoldl add 0 xs)" },
+        { "foldl", "(foldl add 0 xs)" },
+        { "filter", "(filter (\\ {x} {> x 500}) xs)" },
+    };
+
+    printf("%8s %14s %14s\n", "program", "ns/tree", "ns/bytecode");
+    for(int i = 0; i < 5; i++) {
+        double tree = bench_eval(setup, programs[i].src, 0, 0, 50) / 1000;
+        double vm = bench_eval(setup, programs[i].src, 1, 0, 50) / 1000;
+        printf("%8s %14.0f %14.0f\n", programs[i].name, tree, vm);
+    }
+}
+
+// Parallel map and reduce against map and reduce, per value of a list of
+// 1000 numbers with some work for each
+void bench_pmap(void){
+    char *setup = "(def {xs} {}) (dotimes {i} 1000 {def {xs} (cons (% i 16) xs)})"
+        " (def {fib} (\\ {n} {if (< n 2) n (+ (fib (- n 1)) (fib (- n 2)))}))"
+        " (def {work} (\\ {x} {fib (+ x 4)})) (def {add} (\\ {a b} {+ a b}))";
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "map", "(map work xs)" },
+        { "pmap", "(pmap work xs)" },
+        { "reduce", "(reduce add (map work xs))" },
+        { "preduce", "(preduce add (pmap work xs))" },
+    };
+
+    printf("threads: %d\n", lpar_start());
+    printf("%8s %14s %14s\n", "program", "ns/tree", "ns/bytecode");
+    for(int i = 0; i < 4; i++) {
+        double tree = bench_eval(setup, programs[i].src, 0, 0, 5) / 1000;
+        double vm = bench_eval(setup, programs[i].src, 1, 0, 5) / 1000;
+        printf("%8s %14.0f %14.0f\n", programs[i].name, tree, vm);
+    }
+}
+
+#ifdef LISPY_JIT
+// Arithmetic lambdas run by lvm and as native code
+void bench_jit(void){
+    char *setup = "(def {sq} (\\ {x} {* x x})) (def {f} (\\ {x y} {+ (sq x) (sq y) 1}))"
+        " (def {poly} (\\ {x} {- (+ (* x (* x x)) (* 3 x)) 7}))"
+        " (def {twice} (\\ {f x} {f (f x)})) (def {inc} (\\ {x} {+ x 1}))";
+    char *calls = bench_sum_source("(f 3 4)", 200);
+    char *poly = bench_sum_source("(poly 12)", 200);
+    char *twice = bench_sum_source("(twice inc 1)", 200);
+
+    struct {
+        char *name;
+        char *src;
+    } programs[] = {
+        { "calls", calls },
+        { "poly", poly },
+        { "twice", twice },
+    };
+
+    printf("%8s %14s %14s %9s\n", "program", "ns/bytecode", "ns/native", "speedup");
+    for(int i = 0; i < 3; i++) {
+        ljit_enabled = 0;
+        double vm = bench_eval(setup, programs[i].src, 1, 1, 2000);
+        ljit_enabled = 1;
+        double native = bench_eval(setup, programs[i].src, 1, 1, 2000);
+        printf("%8s %14.0f %14.0f %8.2fx\n", programs[i].name, vm, native, vm / native);
+    }
+
+    free(calls);
+    free(poly);
+    free(twice);
+}
+#endif
+
+int bench_selected(int argc, char **argv, char *name){
+    if(argc < 2) return 1;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+int bench_run(int argc, char **argv){
+    if(bench_selected(argc, argv, "lookup")) {
+        puts("lookup: lenv_get on the global environment");
+        bench_lookup();
+    }
+    if(bench_selected(argc, argv, "variadic")) {
+        puts("variadic: (+ 1 1 ...) and (join {0} {1} ...)");
+        bench_variadic_all();
+    }
+    if(bench_selected(argc, argv, "vector")) {
+        puts("vector: new versions of a shared list");
+        bench_vector();
+    }
+    if(bench_selected(argc, argv, "bignum")) {
+        puts("bignum: multiplication, factorials and printing");
+        bench_bignum();
+    }
+    if(bench_selected(argc, argv, "math")) {
+        puts("math: math builtins over a million floats");
+        bench_math();
+    }
+    if(bench_selected(argc, argv, "bytecode")) {
+        puts("bytecode: tree walker against lvm, per evaluation");
+        bench_bytecode();
+    }
+    if(bench_selected(argc, argv, "array")) {
+        puts("array: array kernels over a million numbers");
+        bench_array();
+    }
+    if(bench_selected(argc, argv, "nesting")) {
+        puts("nesting: tree walker on deeply nested expressions, to the end and 64 steps at a time");
+        bench_nesting();
+    }
+    if(bench_selected(argc, argv, "closures")) {
+        puts("closures: higher-order calls, partial application and closures, per evaluation");
+        bench_closures();
+    }
+    if(bench_selected(argc, argv, "fold")) {
+        puts("fold: lambda body with constant calls, per evaluation");
+        bench_fold();
+    }
+    if(bench_selected(argc, argv, "forms")) {
+        puts("forms: special forms against eager builtins and eval, per evaluation");
+        bench_forms();
+    }
+    if(bench_selected(argc, argv, "errors")) {
+        puts("errors: expressions that are errors, per evaluation");
+        bench_errors();
+    }
+    if(bench_selected(argc, argv, "loops")) {
+        puts("loops: summing 10000 numbers, per iteration");
+        bench_loops();
+    }
+    if(bench_selected(argc, argv, "hof")) {
+        puts("hof: map and fold as builtins and in Lispy, per value");
+        bench_hof();
+    }
+    if(bench_selected(argc, argv, "pmap")) {
+        puts("pmap: parallel map and reduce against map and reduce, per value");
+        bench_pmap();
+    }
+#ifdef LISPY_JIT
+    if(bench_selected(argc, argv, "jit")) {
+        puts("jit: lambdas run by lvm and as native code, per evaluation");
+        bench_jit();
+    }
+#endif
+    return 0;
+}
+
+#endif
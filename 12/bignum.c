@@ -0,0 +1,470 @@
+// Big numbers, see "Big numbers" in lispy.h
+#include "lispy.h"
+
+// "x op y" for integers that are big or whose result is
+lval *lval_big_arith(lval *x, lval *y, char *op){
+    lint a, b;
+    lint_of(&a, x);
+    lint_of(&b, y);
+
+    lval *r = NULL;
+    switch(op[0] == 'm' ? op[1] : op[0]) {
+        case '+': r = lint_add(&a, &b, b.sign); break;
+        case '-': r = lint_add(&a, &b, -b.sign); break;
+        case '*': r = lint_mul(&a, &b); break;
+
+        case '/':
+        case '%':
+            r = b.sign ? lint_divmod(&a, &b, op[0] == '%') : lval_err(LERR_DIV_ZERO, "Divide by zero");
+            break;
+
+        case '^':
+            if(LVAL_TYPE(y) == LVAL_BIG) r = lval_err(LERR_LIMIT, "Exponent too large");
+            else if(b.sign < 0) r = lval_err(LERR_VALUE, "Negative exponent %li", lval_num_value(y));
+            else r = lint_pow(&a, lval_num_value(y));
+            break;
+
+        case 'i': r = lval_copy(lint_cmp(&a, &b) <= 0 ? x : y); break;
+        case 'a': r = lval_copy(lint_cmp(&a, &b) >= 0 ? x : y); break;
+    }
+
+    lval_del(x);
+    lval_del(y);
+    return r;
+}
+
+// Normalized integer with the magnitude "limb", copied. Fits in a long if
+// it can.
+lval *lval_int(int sign, uint64_t *limb, int limbs){
+    limbs = lnat_trim(limb, limbs);
+    if(limbs == 0) return lval_num(0);
+    if(limbs == 1 && sign > 0 && limb[0] <= (uint64_t)LONG_MAX) return lval_num((long)limb[0]);
+    if(limbs == 1 && sign < 0 && limb[0] <= (uint64_t)LONG_MAX + 1) return lval_num(-(long)(limb[0] - 1) - 1);
+
+    lval *v = lval_alloc(LVAL_BIG, LVAL_SIZEOF(limbs) + sizeof(uint64_t) * limbs);
+    v->sign = sign;
+    v->limbs = limbs;
+    memcpy(LVAL_LIMB(v), limb, sizeof(uint64_t) * limbs);
+    return v;
+}
+
+// View of the integer "v", which must outlive "x"
+void lint_of(lint *x, lval *v){
+    if(LVAL_TYPE(v) == LVAL_BIG) {
+        x->sign = v->sign;
+        x->limbs = v->limbs;
+        x->limb = LVAL_LIMB(v);
+        return;
+    }
+
+    long n = lval_num_value(v);
+    x->sign = n < 0 ? -1 : n > 0;
+    x->small = n < 0 ? -(uint64_t)n : (uint64_t)n;
+    x->limbs = n != 0;
+    x->limb = &x->small;
+}
+
+int lint_cmp(lint *x, lint *y){
+    if(x->sign != y->sign) return x->sign < y->sign ? -1 : 1;
+    return lnat_cmp(x->limb, x->limbs, y->limb, y->limbs) * x->sign;
+}
+
+// x + y, with "ysign" as the sign of y so this also subtracts
+lval *lint_add(lint *x, lint *y, int ysign){
+    if(!y->limbs) return lval_int(x->sign, x->limb, x->limbs);
+    if(!x->limbs) return lval_int(ysign, y->limb, y->limbs);
+
+    // Order the operands by magnitude
+    int c = lnat_cmp(x->limb, x->limbs, y->limb, y->limbs);
+    lint *big = c >= 0 ? x : y;
+    lint *small = c >= 0 ? y : x;
+    int sign = c >= 0 ? x->sign : ysign;
+
+    uint64_t *r = malloc(sizeof(uint64_t) * (big->limbs + 1));
+    int n;
+    if(x->sign == ysign) n = lnat_add(r, big->limb, big->limbs, small->limb, small->limbs);
+    else n = lnat_sub(r, big->limb, big->limbs, small->limb, small->limbs);
+
+    lval *v = lval_int(sign, r, n);
+    free(r);
+    return v;
+}
+
+lval *lint_mul(lint *x, lint *y){
+    if(!x->limbs || !y->limbs) return lval_num(0);
+
+    uint64_t *r = malloc(sizeof(uint64_t) * (x->limbs + y->limbs));
+    lnat_mul(r, x->limb, x->limbs, y->limb, y->limbs);
+    lval *v = lval_int(x->sign * y->sign, r, x->limbs + y->limbs);
+    free(r);
+    return v;
+}
+
+// x / y or x % y, rounded towards zero like the long operators
+lval *lint_divmod(lint *x, lint *y, int mod){
+    if(lnat_cmp(x->limb, x->limbs, y->limb, y->limbs) < 0) {
+        return mod ? lval_int(x->sign, x->limb, x->limbs) : lval_num(0);
+    }
+
+    uint64_t *q = malloc(sizeof(uint64_t) * (x->limbs - y->limbs + 1));
+    uint64_t *r = malloc(sizeof(uint64_t) * y->limbs);
+    lnat_divmod(q, r, x->limb, x->limbs, y->limb, y->limbs);
+
+    lval *v = mod ? lval_int(x->sign, r, y->limbs) : lval_int(x->sign * y->sign, q, x->limbs - y->limbs + 1);
+    free(q);
+    free(r);
+    return v;
+}
+
+// x ^ e by squaring and multiplying
+lval *lint_pow(lint *x, long e){
+    if((double)x->limbs * 64 * e > LNAT_MAX_BITS) return lval_err(LERR_LIMIT, "Number too large");
+
+    int rn = 1;
+    uint64_t *r = malloc(sizeof(uint64_t));
+    r[0] = 1;
+    int bn = x->limbs;
+    uint64_t *base = malloc(sizeof(uint64_t) * bn);
+    memcpy(base, x->limb, sizeof(uint64_t) * bn);
+
+    int sign = x->sign < 0 && (e & 1) ? -1 : 1;
+    for(; e; e >>= 1) {
+        if(e & 1) {
+            uint64_t *t = malloc(sizeof(uint64_t) * (rn + bn));
+            lnat_mul(t, r, rn, base, bn);
+            rn = lnat_trim(t, rn + bn);
+            free(r);
+            r = t;
+        }
+        if(e > 1) {
+            uint64_t *t = malloc(sizeof(uint64_t) * 2 * bn);
+            lnat_mul(t, base, bn, base, bn);
+            bn = lnat_trim(t, 2 * bn);
+            free(base);
+            base = t;
+        }
+    }
+
+    lval *v = lval_int(sign, r, rn);
+    free(r);
+    free(base);
+    return v;
+}
+
+int lnat_cmp(uint64_t *a, int an, uint64_t *b, int bn){
+    if(an != bn) return an < bn ? -1 : 1;
+    for(int i = an - 1; i >= 0; i--) {
+        if(a[i] != b[i]) return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+// r = a + b for an >= bn, r has room for an + 1 limbs. Returns the size.
+int lnat_add(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn){
+    uint64_t carry = 0;
+    for(int i = 0; i < an; i++) {
+        uint64_t s = a[i] + carry;
+        carry = s < carry;
+        if(i < bn) {
+            s += b[i];
+            carry += s < b[i];
+        }
+        r[i] = s;
+    }
+    r[an] = carry;
+    return an + 1;
+}
+
+// r += b for rn >= bn, the result must fit in rn limbs
+void lnat_add_in(uint64_t *r, int rn, uint64_t *b, int bn){
+    uint64_t carry = 0;
+    int i = 0;
+    for(; i < bn; i++) {
+        uint64_t s = r[i] + carry;
+        carry = s < carry;
+        s += b[i];
+        carry += s < b[i];
+        r[i] = s;
+    }
+    for(; carry && i < rn; i++) carry = ++r[i] == 0;
+}
+
+// r = a - b for a >= b, r has room for an limbs and can be a. Returns the
+// size.
+int lnat_sub(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn){
+    uint64_t borrow = 0;
+    for(int i = 0; i < an; i++) {
+        uint64_t d = i < bn ? b[i] : 0;
+        uint64_t t = a[i] - d;
+        uint64_t under = a[i] < d;
+        r[i] = t - borrow;
+        borrow = under | (t < borrow);
+    }
+    return an;
+}
+
+// Size of "a" without its leading zero limbs
+int lnat_trim(uint64_t *a, int an){
+    while(an && !a[an - 1]) an--;
+    return an;
+}
+
+// r = a * b, r has room for an + bn limbs and doesn't overlap a or b
+void lnat_mul_school(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn){
+    memset(r, 0, sizeof(uint64_t) * (an + bn));
+    for(int j = 0; j < bn; j++) {
+        uint64_t carry = 0;
+        for(int i = 0; i < an; i++) {
+            lnat_wide t = (lnat_wide)a[i] * b[j] + r[i + j] + carry;
+            r[i + j] = (uint64_t)t;
+            carry = t >> 64;
+        }
+        r[an + j] = carry;
+    }
+}
+
+// r = a * b for two n limb numbers, with three half size products:
+// a0 b0, a1 b1 and (a0 + a1)(b0 + b1), which gives a0 b1 + a1 b0
+void lnat_karatsuba(uint64_t *r, uint64_t *a, uint64_t *b, int n){
+    int h = n / 2;
+    int hn = n - h;
+
+    // a0 b0 in the low half of r, a1 b1 in the high one
+    lnat_mul(r, a, h, b, h);
+    lnat_mul(r + 2 * h, a + h, hn, b + h, hn);
+
+    uint64_t *t = malloc(sizeof(uint64_t) * 4 * (hn + 1));
+    uint64_t *sa = t;
+    uint64_t *sb = t + hn + 1;
+    uint64_t *mid = t + 2 * (hn + 1);
+
+    int sn = lnat_add(sa, a + h, hn, a, h);
+    lnat_add(sb, b + h, hn, b, h);
+    lnat_mul(mid, sa, sn, sb, sn);
+    int mn = lnat_sub(mid, mid, 2 * sn, r, 2 * h);
+    mn = lnat_sub(mid, mid, mn, r + 2 * h, 2 * hn);
+
+    lnat_add_in(r + h, 2 * n - h, mid, lnat_trim(mid, mn));
+    free(t);
+}
+
+// r = a * b, r has room for an + bn limbs and doesn't overlap a or b
+void lnat_mul(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn){
+    if(an < bn) {
+        lnat_mul(r, b, bn, a, an);
+        return;
+    }
+    if(bn < LNAT_KARATSUBA) {
+        lnat_mul_school(r, a, an, b, bn);
+        return;
+    }
+    if(an == bn) {
+        lnat_karatsuba(r, a, b, an);
+        return;
+    }
+
+    // Longer a, multiply b by slices of it as long as b
+    memset(r, 0, sizeof(uint64_t) * (an + bn));
+    uint64_t *t = malloc(sizeof(uint64_t) * 2 * bn);
+    for(int i = 0; i < an; i += bn) {
+        int n = an - i < bn ? an - i : bn;
+        lnat_mul(t, a + i, n, b, bn);
+        lnat_add_in(r + i, an + bn - i, t, n + bn);
+    }
+    free(t);
+}
+
+// r = r * m + add, r has room for rn + 1 limbs. Returns the size.
+int lnat_mul_1_add(uint64_t *r, int rn, uint64_t m, uint64_t add){
+    uint64_t carry = add;
+    for(int i = 0; i < rn; i++) {
+        lnat_wide t = (lnat_wide)r[i] * m + carry;
+        r[i] = (uint64_t)t;
+        carry = t >> 64;
+    }
+    if(carry) r[rn++] = carry;
+    return rn;
+}
+
+// q = a / d, returns a % d. q can be a.
+uint64_t lnat_divmod_1(uint64_t *q, uint64_t *a, int an, uint64_t d){
+    lnat_wide rem = 0;
+    for(int i = an - 1; i >= 0; i--) {
+        lnat_wide cur = (rem << 64) | a[i];
+        q[i] = (uint64_t)(cur / d);
+        rem = cur % d;
+    }
+    return (uint64_t)rem;
+}
+
+// q = a / b and r = a % b for a >= b (Knuth's algorithm D). q has room for
+// an - bn + 1 limbs and r for bn limbs.
+void lnat_divmod(uint64_t *q, uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn){
+    if(bn == 1) {
+        r[0] = lnat_divmod_1(q, a, an, b[0]);
+        return;
+    }
+
+    // Shift both so the top bit of b is set, which keeps the estimated
+    // quotient limbs at most two too big
+    int s = __builtin_clzll(b[bn - 1]);
+    uint64_t *u = malloc(sizeof(uint64_t) * (an + 1));
+    uint64_t *v = malloc(sizeof(uint64_t) * bn);
+    for(int i = bn - 1; i > 0; i--) v[i] = (b[i] << s) | (s ? b[i - 1] >> (64 - s) : 0);
+    v[0] = b[0] << s;
+    u[an] = s ? a[an - 1] >> (64 - s) : 0;
+    for(int i = an - 1; i > 0; i--) u[i] = (a[i] << s) | (s ? a[i - 1] >> (64 - s) : 0);
+    u[0] = a[0] << s;
+
+    for(int j = an - bn; j >= 0; j--) {
+        // Estimate the quotient limb from the top limbs
+        lnat_wide top = ((lnat_wide)u[j + bn] << 64) | u[j + bn - 1];
+        lnat_wide qhat = top / v[bn - 1];
+        lnat_wide rhat = top % v[bn - 1];
+        while(qhat >> 64 || qhat * v[bn - 2] > ((rhat << 64) | u[j + bn - 2])) {
+            qhat--;
+            rhat += v[bn - 1];
+            if(rhat >> 64) break;
+        }
+
+        // u -= qhat * v at limb j
+        uint64_t carry = 0;
+        uint64_t borrow = 0;
+        for(int i = 0; i <= bn; i++) {
+            uint64_t lo = carry;
+            if(i < bn) {
+                lnat_wide p = qhat * v[i] + carry;
+                lo = (uint64_t)p;
+                carry = p >> 64;
+            }
+            uint64_t t = u[i + j] - lo;
+            uint64_t under = u[i + j] < lo;
+            u[i + j] = t - borrow;
+            borrow = under | (t < borrow);
+        }
+
+        // Still one too big, add v back
+        if(borrow) {
+            qhat--;
+            carry = 0;
+            for(int i = 0; i < bn; i++) {
+                lnat_wide t = (lnat_wide)u[i + j] + v[i] + carry;
+                u[i + j] = (uint64_t)t;
+                carry = t >> 64;
+            }
+            u[j + bn] += carry;
+        }
+        q[j] = (uint64_t)qhat;
+    }
+
+    // The remainder is what's left of u, shifted back
+    for(int i = 0; i < bn; i++) r[i] = (u[i] >> s) | (s ? u[i + 1] << (64 - s) : 0);
+    free(u);
+    free(v);
+}
+
+// Write the decimal digits of "a" at "s", padded with zeros to "width"
+// digits, and return the end. Long numbers are split in two by
+// pow[k] = 10^(19 * 2^k) and each half is converted on its own, so most
+// of the work is multiplications and subtractions inside lnat_divmod
+// instead of one slow single limb division per limb and per 19 digits.
+char *lnat_decimal(char *s, uint64_t *a, int an, int width, uint64_t **pow, int *pown, int k){
+    an = lnat_trim(a, an);
+    while(k >= 0 && pown[k] * 2 > an) k--;
+
+    if(k < 0 || an <= LNAT_PRINT_SPLIT) {
+        // 19 digits at a time, the least significant first
+        uint64_t t[LNAT_PRINT_SPLIT];
+        char d[LNAT_PRINT_SPLIT * 20];
+        int n = 0;
+        memcpy(t, a, sizeof(uint64_t) * an);
+        while(an) {
+            uint64_t chunk = lnat_divmod_1(t, t, an, LNAT_CHUNK);
+            an = lnat_trim(t, an);
+            for(int i = 0; i < LNAT_DIGITS && (an || chunk); i++) {
+                d[n++] = '0' + chunk % 10;
+                chunk /= 10;
+            }
+        }
+        for(; width > n; width--) *s++ = '0';
+        while(n) *s++ = d[--n];
+        return s;
+    }
+
+    // a = hi * pow[k] + lo, lo has exactly 19 * 2^k digits
+    int digits = LNAT_DIGITS << k;
+    int hn = an - pown[k] + 1;
+    uint64_t *hi = malloc(sizeof(uint64_t) * hn);
+    uint64_t *lo = malloc(sizeof(uint64_t) * pown[k]);
+    lnat_divmod(hi, lo, a, an, pow[k], pown[k]);
+
+    s = lnat_decimal(s, hi, hn, width > digits ? width - digits : 0, pow, pown, k);
+    s = lnat_decimal(s, lo, pown[k], digits, pow, pown, k - 1);
+    free(hi);
+    free(lo);
+    return s;
+}
+
+// Integer from a string of decimal digits with an optional '-'
+lval *lval_read_big(char *s){
+    int sign = 1;
+    if(*s == '-') {
+        sign = -1;
+        s++;
+    }
+
+    int len = strlen(s);
+    uint64_t *r = malloc(sizeof(uint64_t) * (len / LNAT_DIGITS + 2));
+    int rn = 0;
+
+    // 19 digits at a time, the first chunk takes what's left over
+    int n = len % LNAT_DIGITS ? len % LNAT_DIGITS : LNAT_DIGITS;
+    for(int i = 0; i < len; i += n, n = LNAT_DIGITS) {
+        uint64_t chunk = 0;
+        uint64_t scale = 1;
+        for(int j = 0; j < n; j++) {
+            chunk = chunk * 10 + (s[i + j] - '0');
+            scale *= 10;
+        }
+        rn = lnat_mul_1_add(r, rn, scale, chunk);
+    }
+
+    lval *v = lval_int(sign, r, rn);
+    free(r);
+    return v;
+}
+
+// Decimal string of a big number, to be freed by the caller
+char *lval_big_string(lval *v){
+    int an = v->limbs;
+
+    // Powers of 10^19 by squaring, up to about half the size of v
+    uint64_t *pow[32];
+    int pown[32];
+    int k = 0;
+    pow[0] = malloc(sizeof(uint64_t));
+    pow[0][0] = LNAT_CHUNK;
+    pown[0] = 1;
+    while(pown[k] * 4 <= an) {
+        pow[k + 1] = malloc(sizeof(uint64_t) * 2 * pown[k]);
+        lnat_mul(pow[k + 1], pow[k], pown[k], pow[k], pown[k]);
+        pown[k + 1] = lnat_trim(pow[k + 1], 2 * pown[k]);
+        k++;
+    }
+
+    // Each limb is less than 20 digits
+    char *s = malloc(an * 20 + 2);
+    char *end = s;
+    if(v->sign < 0) *end++ = '-';
+    end = lnat_decimal(end, LVAL_LIMB(v), an, 0, pow, pown, k);
+    *end = '\0';
+
+    for(int i = 0; i <= k; i++) free(pow[i]);
+    return s;
+}
+
+void lval_big_print(lval *v){
+    char *s = lval_big_string(v);
+    fputs(s, stdout);
+    free(s);
+}
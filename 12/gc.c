@@ -0,0 +1,413 @@
+// Garbage collector, see "Garbage collector" in lispy.h
+#include "lispy.h"
+
+#ifdef LISPY_GC
+
+lgc_state lgc = { NULL, NULL, NULL, GC_NURSERY_SIZE, GC_OLD_LIMIT, GC_OLD_LIMIT };
+
+// Allocate "size" bytes in the nursery, or from the pool when it's full
+void *gc_alloc(size_t size){
+    if(size <= LPOOL_MAX_SIZE) {
+        if(!lgc.nursery) {
+            lgc.nursery = malloc(lgc.nursery_size);
+            lgc.bump = lgc.nursery;
+            lgc.end = lgc.nursery + lgc.nursery_size;
+        }
+        // Keep every block 8 byte aligned
+        size = (size + 7) & ~(size_t)7;
+        if(lgc.bump + size <= lgc.end) {
+            void *p = lgc.bump;
+            lgc.bump += size;
+            return p;
+        }
+        lgc.overflow++;
+    }
+    return lpool_alloc(size);
+}
+
+// Nursery memory is only reclaimed by collections
+void gc_free(void *p, size_t size){
+    if(!gc_in_nursery(p)) lpool_free(p, size);
+}
+
+int gc_in_nursery(void *p){
+    return (char*)p >= lgc.nursery && (char*)p < lgc.end;
+}
+
+// Collect if needed. Must only be called when every live lval is
+// reachable from "e".
+void gc_safepoint(lenv *e){
+    // Nothing allocated since the last collection
+    if(lgc.bump == lgc.nursery && lgc.overflow == 0) return;
+    gc_collect(e, NULL);
+}
+
+// Collect inside the top evaluation once the nursery is full. "roots" are
+// its frames, with the environments they run in they reach every live
+// lval. Returns 1 when it collected: the lvals the frames point to may
+// have moved.
+int gc_poll(lgc_roots *roots){
+    if(lgc.overflow == 0) return 0;
+    lenv *e = roots->ev ? roots->ev->frames[0].env : roots->frames[0].env;
+    while(e->par) e = e->par;
+    gc_collect(e, roots);
+    return 1;
+}
+
+// A minor collection, then a major one if the old generation is big or
+// dead enough. "roots" are the frames of the top evaluation, or NULL
+// between two.
+void gc_collect(lenv *e, lgc_roots *roots){
+    clock_t start = clock();
+
+    gc_minor(e, roots);
+    // Not worth a sweep until at least a nursery's worth is dead
+    int dead = lgc.dead_bytes > lgc.old_bytes / 2 && lgc.dead_bytes >= lgc.nursery_size;
+    if(lgc.old_bytes > lgc.old_next || dead) {
+        gc_major(e, roots);
+        // Room for the survivors to double before the next one
+        lgc.old_next = lgc.old_bytes * 2;
+        if(lgc.old_next < lgc.old_limit) lgc.old_next = lgc.old_limit;
+    }
+
+    double pause = (double)(clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    lgc.pause_total += pause;
+    if(pause > lgc.pause_max) lgc.pause_max = pause;
+}
+
+// Move every young lval reachable from "e" and "roots" to the old
+// generation
+void gc_minor(lenv *e, lgc_roots *roots){
+    int scan = lgc.old_count;
+
+    // The roots, lenv vals are the only slots old lvals can change
+    for(; e; e = e->par) {
+        for(int i = 0; i < e->count; i++) {
+            e->vals[i] = gc_evacuate(e->vals[i]);
+        }
+    }
+    if(roots) gc_minor_roots(roots);
+
+    // Then everything the newly promoted lvals point to
+    while(scan < lgc.old_count) gc_scan(lgc.old[scan++]);
+
+    // The nursery only holds dead lvals and forwarding pointers now
+    if(lgc.nursery_size != (size_t)(lgc.end - lgc.nursery)) {
+        free(lgc.nursery);
+        lgc.nursery = malloc(lgc.nursery_size);
+        lgc.end = lgc.nursery + lgc.nursery_size;
+    }
+    lgc.bump = lgc.nursery;
+    lgc.overflow = 0;
+    lgc.minor++;
+}
+
+// Evacuate the values of "e" and its parents but the global environment,
+// which is a root anyway
+void gc_minor_env(lenv *e){
+    for(; e->par; e = e->par) {
+        for(int i = 0; i < e->count; i++) e->vals[i] = gc_evacuate(e->vals[i]);
+    }
+}
+
+// Evacuate what the frames of the top evaluation point to
+void gc_minor_roots(lgc_roots *r){
+    for(int i = 0; r->ev && i < r->ev->count; i++) {
+        leval_frame *fr = r->ev->frames + i;
+        if(fr->v) {
+            // Its cells can be young even when it is old
+            fr->v = gc_evacuate(fr->v);
+            gc_scan(fr->v);
+        }
+        gc_minor_env(fr->env);
+    }
+    if(r->code) r->code->consts = gc_evacuate(r->code->consts);
+    for(int i = 0; i < r->nframes; i++) {
+        lvm_frame *fr = r->frames + i;
+        fr->code->consts = gc_evacuate(fr->code->consts);
+        if(fr->fn) fr->fn = gc_evacuate(fr->fn);
+        gc_minor_env(fr->env);
+    }
+    for(int i = 0; i < r->nstack; i++) r->stack[i] = gc_evacuate(r->stack[i]);
+}
+
+// Promote a young lval and return its new address
+lval *gc_evacuate(lval *v){
+    if(LVAL_IS_FIXNUM(v)) return v;
+    if(v->gc == GC_FORWARD) return v->fwd;
+    if(v->gc != GC_YOUNG) return v;
+
+    lval *x = v;
+
+    // Nursery lvals are copied, the others are promoted where they are
+    if(gc_in_nursery(v)) {
+        x = lpool_alloc(lval_size(v));
+        memcpy(x, v, lval_size(v));
+        v->gc = GC_FORWARD;
+        v->fwd = x;
+    }
+    x->gc = GC_OLD;
+
+    // Cell arrays move along with their lval
+    if((x->type == LVAL_SEXPR || x->type == LVAL_QEXPR) && x->cap && gc_in_nursery(LVAL_CELL_BASE(x))) {
+        lval **cell = x->count ? lpool_alloc(sizeof(lval*) * x->count) : NULL;
+        if(cell) memcpy(cell, x->cell, sizeof(lval*) * x->count);
+        x->cell = cell;
+        x->off = 0;
+        x->cap = x->count;
+    }
+
+    if(lgc.old_count == lgc.old_cap) {
+        lgc.old_cap = lgc.old_cap ? lgc.old_cap * 2 : 1024;
+        lgc.old = realloc(lgc.old, sizeof(lval*) * lgc.old_cap);
+    }
+    lgc.old[lgc.old_count++] = x;
+    lgc.old_bytes += gc_size(x);
+    lgc.promoted += gc_size(x);
+    return x;
+}
+
+// Evacuate everything a promoted lval points to
+void gc_scan(lval *v){
+    switch(v->type) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i = 0; i < v->count; i++) {
+                v->cell[i] = gc_evacuate(v->cell[i]);
+            }
+            break;
+
+        case LVAL_FUN:
+            if(!v->builtin) {
+                v->formals = gc_evacuate(v->formals);
+                v->body = gc_evacuate(v->body);
+                if(v->code) v->code->consts = gc_evacuate(v->code->consts);
+                gc_minor_env(v->env);
+            }
+            break;
+
+        case LVAL_VEC:
+            lvec_scan(v->vec);
+            break;
+    }
+}
+
+// Free the old lvals that are dead or can't be reached from "e" and
+// "roots"
+void gc_major(lenv *e, lgc_roots *roots){
+    // Mark
+    for(lenv *p = e; p; p = p->par) {
+        for(int i = 0; i < p->count; i++) gc_mark(p->vals[i]);
+    }
+    if(roots) gc_mark_roots(roots);
+
+    // Sweep
+    int live = 0;
+    lgc.old_bytes = 0;
+    for(int i = 0; i < lgc.old_count; i++) {
+        lval *v = lgc.old[i];
+        if(v->gc & GC_MARK) {
+            v->gc = GC_OLD;
+            lgc.old[live++] = v;
+            lgc.old_bytes += gc_size(v);
+            continue;
+        }
+        // Unreachable but never released, only happens with cycles
+        if(v->gc == GC_OLD) gc_release(v);
+        lpool_free(v, lval_size(v));
+    }
+    lgc.old_count = live;
+    lgc.dead_bytes = 0;
+    lgc.major++;
+}
+
+void gc_mark(lval *v){
+    if(LVAL_IS_FIXNUM(v) || (v->gc & GC_MARK)) return;
+    v->gc |= GC_MARK;
+
+    switch(v->type) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i = 0; i < v->count; i++) gc_mark(v->cell[i]);
+            break;
+
+        case LVAL_FUN:
+            if(!v->builtin) {
+                gc_mark(v->formals);
+                gc_mark(v->body);
+                if(v->code) gc_mark(v->code->consts);
+                gc_mark_env(v->env);
+            }
+            break;
+
+        case LVAL_VEC:
+            lvec_mark(v->vec);
+            break;
+    }
+}
+
+// Mark the values of "e" and its parents but the global environment
+void gc_mark_env(lenv *e){
+    for(; e->par; e = e->par) {
+        for(int i = 0; i < e->count; i++) gc_mark(e->vals[i]);
+    }
+}
+
+// Mark what the frames of the top evaluation point to
+void gc_mark_roots(lgc_roots *r){
+    for(int i = 0; r->ev && i < r->ev->count; i++) {
+        if(r->ev->frames[i].v) gc_mark(r->ev->frames[i].v);
+        gc_mark_env(r->ev->frames[i].env);
+    }
+    if(r->code) gc_mark(r->code->consts);
+    for(int i = 0; i < r->nframes; i++) {
+        gc_mark(r->frames[i].code->consts);
+        if(r->frames[i].fn) gc_mark(r->frames[i].fn);
+        gc_mark_env(r->frames[i].env);
+    }
+    for(int i = 0; i < r->nstack; i++) gc_mark(r->stack[i]);
+}
+
+// Free what an unreachable lval owns. Unreachable children are swept on
+// their own, reachable ones just lose a reference.
+void gc_release(lval *v){
+    lval **children = NULL;
+    int count = 0;
+
+    switch(v->type) {
+        case LVAL_ERR: return;
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            children = v->cell;
+            count = v->count;
+            break;
+
+        case LVAL_FUN:
+            if(v->builtin) return;
+            if(v->formals->gc & GC_MARK) v->formals->refs--;
+            if(v->body->gc & GC_MARK) v->body->refs--;
+            // Code shared with other lambdas is kept
+            if(v->code && --v->code->refs == 0) {
+                if(v->code->consts->gc & GC_MARK) v->code->consts->refs--;
+                free(v->code);
+            }
+            gc_release_env(v->env);
+            return;
+
+        case LVAL_VEC:
+            lvec_release(v->vec);
+            return;
+
+        default:
+            return;
+    }
+
+    for(int i = 0; i < count; i++) {
+        lval *c = children[i];
+        if(!LVAL_IS_FIXNUM(c) && (c->gc & GC_MARK) && c->refs > 1) c->refs--;
+    }
+
+    lcell_resize(LVAL_CELL_BASE(v), v->cap, 0);
+}
+
+// Drop the reference of an unreachable lambda to "e". The values of freed
+// environments are handled like the children in gc_release.
+void gc_release_env(lenv *e){
+    while(e->par && --e->refs == 0) {
+        for(int i = 0; i < e->count; i++) {
+            lval *c = e->vals[i];
+            if(!LVAL_IS_FIXNUM(c) && (c->gc & GC_MARK) && c->refs > 1) c->refs--;
+        }
+        lenv *par = e->par;
+        lenv_free(e);
+        e = par;
+    }
+}
+
+// Evacuate the values of a vector tree. Nodes are never modified, so a
+// node only has to be scanned once, new versions of a vector only add
+// nodes that weren't.
+void lvec_scan(lvec *t){
+    if(!t || (t->gc & LVEC_SCANNED)) return;
+    if(t->height == 0) {
+        for(int i = 0; i < t->count; i++) t->item[i] = gc_evacuate(t->item[i]);
+    } else {
+        lvec_scan(t->child[0]);
+        lvec_scan(t->child[1]);
+    }
+    t->gc |= LVEC_SCANNED;
+}
+
+// Mark the values of a vector tree, nodes shared by several vectors are
+// only visited once per collection
+void lvec_mark(lvec *t){
+    if(!t || t->mark == lgc.major + 1) return;
+    t->mark = lgc.major + 1;
+    if(t->height == 0) {
+        for(int i = 0; i < t->count; i++) gc_mark(t->item[i]);
+    } else {
+        lvec_mark(t->child[0]);
+        lvec_mark(t->child[1]);
+    }
+}
+
+// Drop the reference of an unreachable vector to "t". The values of freed
+// leaves are handled like the children in gc_release.
+void lvec_release(lvec *t){
+    if(!t || --t->refs > 0) return;
+    if(t->height == 0) {
+        for(int i = 0; i < t->count; i++) {
+            lval *c = t->item[i];
+            if(!LVAL_IS_FIXNUM(c) && (c->gc & GC_MARK) && c->refs > 1) c->refs--;
+        }
+        lpool_free(t, LVEC_LEAF_SIZE(t->count));
+    } else {
+        lvec_release(t->child[0]);
+        lvec_release(t->child[1]);
+        lpool_free(t, LVEC_NODE_SIZE);
+    }
+}
+
+// Bytes used by an lval and its cell array
+size_t gc_size(lval *v){
+    size_t size = lval_size(v);
+    if(v->type == LVAL_SEXPR || v->type == LVAL_QEXPR) size += sizeof(lval*) * v->cap;
+    return size;
+}
+
+// Set the nursery size and the old generation limit in bytes
+// A major collection runs when the old generation grows past the larger
+// of the limit and twice what survived the last major collection, so a
+// program whose live data outgrows the limit isn't collected after every
+// minor one. The threshold comes back down to the limit as soon as the
+// live data shrinks. The limit itself is never changed.
+lval *builtin_gc(lenv *e, lval *v){
+    LASSERT_NUM("gc", v, 2);
+    LASSERT_TYPE("gc", v, 0, LVAL_NUM);
+    LASSERT_TYPE("gc", v, 1, LVAL_NUM);
+
+    long nursery = lval_num_value(v->cell[0]);
+    long old = lval_num_value(v->cell[1]);
+    LASSERT(v, (nursery >= 4096 && old >= 4096), LERR_VALUE, "Function 'gc' passed a size smaller than 4096 bytes");
+
+    // The nursery is resized by the next collection
+    lgc.nursery_size = nursery;
+    lgc.old_limit = old;
+    lgc.old_next = old;
+    lval_del(v);
+    return lval_sexpr();
+}
+
+// The garbage collector
+void lstats_gc(void){
+    printf("collections:  %li minor, %li major\n", lgc.minor, lgc.major);
+    printf("pauses:       %.3f ms total, %.3f ms max\n", lgc.pause_total, lgc.pause_max);
+    printf("nursery:      %zu / %zu bytes used, %li overflowed\n",
+            (size_t)(lgc.bump - lgc.nursery), lgc.nursery_size, lgc.overflow);
+    printf("old:          %i lvals, %zu bytes, %zu dead\n", lgc.old_count, lgc.old_bytes, lgc.dead_bytes);
+    printf("next major:   %zu bytes, limit %zu\n", lgc.old_next, lgc.old_limit);
+    printf("promoted:     %zu bytes\n", lgc.promoted);
+}
+
+#endif
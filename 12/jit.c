@@ -0,0 +1,528 @@
+// Native code, see "Native code" in lispy.h
+#include "lispy.h"
+
+#ifdef LISPY_JIT
+
+int ljit_enabled = 1;
+static int ljit_depth = 0;          // Native calls running
+static long ljit_lambdas = 0;       // Printed by "stats"
+static long ljit_bytes = 0;
+static long ljit_runs = 0;
+static FILE *ljit_perf_map = NULL;
+
+// Whether the body of the lambda "f" runs as native code. It is compiled
+// once it has been called LJIT_HOT_CALLS times.
+int ljit_ready(lval *f){
+    lcode *c = f->code;
+    if(!ljit_enabled || lpar_root || ljit_depth >= LJIT_DEPTH_MAX) return 0;
+    if(c->native) return 1;
+    if(c->calls < 0 || ++c->calls < LJIT_HOT_CALLS) return 0;
+    ljit_compile(c, f->formals);
+    if(!c->native) c->calls = -1;
+    return c->native != NULL;
+}
+
+// Run the native code of "c" in "e"
+lval *ljit_run(lcode *c, lenv *e, ljit_exit *x){
+    ljit_depth++;
+    ljit_runs++;
+    lval *r = ((ljit_fn)c->native)(e, c->consts->cell, x);
+    ljit_depth--;
+    return r;
+}
+
+// Evaluate an S-Expression of the "n" values at "args" for native code,
+// like the call in lvm_exec. A lambda that isn't in "tail" position is run
+// to the end, otherwise it is left in "*x" and NULL is returned.
+lval *ljit_call(lenv *e, lval **args, int n, int tail, ljit_exit *x){
+    if(tail && n == 2 && LVM_IS_BUILTIN(args[0], builtin_eval) && lval_is_list(args[1])) {
+        lval *l = args[1]->type == LVAL_VEC ? lval_vec_to_expr(lval_copy(args[1]), LVAL_QEXPR) : lval_copy(args[1]);
+        lcode *code = lcode_compile(l);
+        lval_del(l);
+        if(code) {
+            lval_del(args[0]);
+            lval_del(args[1]);
+            x->code = code;
+            return NULL;
+        }
+    }
+
+    lval *f = NULL;
+    lenv *fenv = NULL;
+    lval *r = lvm_call(e, args, n, &f, &fenv);
+    if(r) return r;
+    if(tail) {
+        x->fn = f;
+        x->env = fenv;
+        return NULL;
+    }
+
+    // Native code is called directly, lvm_exec runs what it calls in tail
+    // position
+    if(ljit_ready(f)) {
+        ljit_exit t = { NULL, NULL, NULL };
+        r = ljit_run(f->code, fenv, &t);
+        if(!r && t.code) {
+            r = lvm_run(fenv, t.code);
+            lcode_del(t.code);
+        } else if(!r) {
+            r = lvm_exec(t.env, t.fn->code, t.fn);
+            lenv_unref(t.env);
+        }
+        lval_del(f);
+    } else {
+        r = lvm_exec(fenv, f->code, f);
+    }
+    lenv_unref(fenv);
+    return r;
+}
+
+// Compile "c", the body of a lambda with "formals", to native code.
+// Registers while it runs:
+//
+//   r12  Top of the value stack, which is in the C frame
+//   r13  Constants
+//   r14  Environment
+//   r15  ljit_exit for tail calls
+//
+// The slow paths of the templates are stubs after the code.
+void ljit_compile(lcode *c, lval *formals){
+    ljit_buf b = { NULL, 0, 0, NULL, 0, 0, NULL, NULL, 0, NULL, 0, 0 };
+    b.labels = malloc(sizeof(int) * c->count);
+    b.fixups = malloc(sizeof(int) * 2 * c->count);
+
+    // push rbp; mov rbp, rsp; push rbx, r12, r13, r14, r15
+    ljit_emit(&b, "\x55\x48\x89\xE5\x53\x41\x54\x41\x55\x41\x56\x41\x57", 13);
+    // sub rsp, stack, an odd number of slots keeps rsp 16 byte aligned
+    ljit_emit(&b, "\x48\x81\xEC", 3);
+    ljit_u32(&b, 8 * (c->stack | 1));
+    // mov r14, rdi; mov r13, rsi; mov r15, rdx; mov r12, rsp
+    ljit_emit(&b, "\x49\x89\xFE\x49\x89\xF5\x49\x89\xD7\x49\x89\xE4", 12);
+
+    uint16_t *pc = c->code;
+    lval **k = c->consts->cell;
+    while(pc < c->code + c->count) {
+        b.labels[pc - c->code] = b.count;
+        switch(*pc++) {
+            case LOP_CONST:
+                // mov rax, [r13 + k]
+                ljit_emit(&b, "\x49\x8B\x85", 3);
+                ljit_u32(&b, 8 * *pc++);
+                ljit_push(&b, 1);
+                break;
+
+            case LOP_SYM: {
+                int i = *pc++;
+                ljit_emit_sym(&b, i, lval_formal_slot(formals, k[i]->sym) < 0);
+                break;
+            }
+
+            case LOP_LOCAL:
+                ljit_emit_local(&b, pc[0], pc[1]);
+                pc += 2;
+                break;
+
+            case LOP_ADD:
+            case LOP_SUB:
+            case LOP_MUL:
+                ljit_emit_arith(&b, pc[-1]);
+                break;
+
+            case LOP_CALL:
+                ljit_emit_call(&b, *pc++, 0);
+                break;
+
+            case LOP_TAIL:
+                ljit_emit_call(&b, *pc++, 1);
+                break;
+
+            case LOP_RETURN:
+                // mov rax, [r12 - 8]
+                ljit_emit(&b, "\x49\x8B\x44\x24\xF8", 5);
+                ljit_ret(&b);
+                break;
+
+            case LOP_LAZY:
+                // lea rdi, [r12 - 8]; mov esi, form; mov rdx, [r13 + k]; mov rcx, r14
+                ljit_emit(&b, "\x49\x8D\x7C\x24\xF8\xBE", 6);
+                ljit_u32(&b, pc[0]);
+                ljit_emit(&b, "\x49\x8B\x95", 3);
+                ljit_u32(&b, 8 * pc[1]);
+                ljit_emit(&b, "\x4C\x89\xF1", 3);
+                ljit_call_c(&b, (uintptr_t)lvm_lazy);
+                // test eax, eax; jz JUMP; lea r12, [r12 - 8]; jmp past the JUMP
+                ljit_emit(&b, "\x85\xC0\x74\x0A\x4D\x8D\x64\x24\xF8", 9);
+                pc += 2;
+                ljit_branch(&b, "\xE9", 1, pc + 2 - c->code);
+                break;
+
+            case LOP_JUMP:
+                ljit_branch(&b, "\xE9", 1, *pc++);
+                break;
+
+            case LOP_TEST:
+                // lea rdi, [r12 - 8]
+                ljit_emit(&b, "\x49\x8D\x7C\x24\xF8", 5);
+                ljit_call_c(&b, (uintptr_t)lvm_test);
+                // test eax, eax; js unwind; lea r12, [r12 - 8]; jz f
+                ljit_emit(&b, "\x85\xC0", 2);
+                ljit_unwind_jump(&b, "\x0F\x88", 2);
+                ljit_emit(&b, "\x4D\x8D\x64\x24\xF8", 5);
+                ljit_branch(&b, "\x0F\x84", 2, *pc++);
+                break;
+
+            case LOP_FOLD:
+                // mov rdi, [r13 + k]; mov rsi, r14
+                ljit_emit(&b, "\x49\x8B\xBD", 3);
+                ljit_u32(&b, 8 * pc[0]);
+                ljit_emit(&b, "\x4C\x89\xF6", 3);
+                ljit_call_c(&b, (uintptr_t)lvm_fold);
+                // test rax, rax; jz the call; push rax; jmp t
+                ljit_emit(&b, "\x48\x85\xC0", 3);
+                ljit_branch(&b, "\x0F\x84", 2, pc + 2 - c->code);
+                ljit_push(&b, 0);
+                ljit_branch(&b, "\xE9", 1, pc[1]);
+                pc += 2;
+                break;
+
+            case LOP_AND:
+            case LOP_OR:
+                // lea rdi, [r12 - 8]; mov esi, or
+                ljit_emit(&b, "\x49\x8D\x7C\x24\xF8\xBE", 6);
+                ljit_u32(&b, pc[-1] == LOP_OR);
+                ljit_call_c(&b, (uintptr_t)lvm_and);
+                // test eax, eax; js unwind; jz t; lea r12, [r12 - 8]
+                ljit_emit(&b, "\x85\xC0", 2);
+                ljit_unwind_jump(&b, "\x0F\x88", 2);
+                ljit_branch(&b, "\x0F\x84", 2, *pc++);
+                ljit_emit(&b, "\x4D\x8D\x64\x24\xF8", 5);
+                break;
+        }
+    }
+
+    // Jumps are all forward, every label is known now
+    for(int i = 0; i < b.nfixups; i += 2) {
+        int32_t rel = b.labels[b.fixups[i + 1]] - (b.fixups[i] + 4);
+        memcpy(b.buf + b.fixups[i], &rel, 4);
+    }
+    free(b.labels);
+    free(b.fixups);
+
+    for(int i = 0; i < b.nstubs; i++) {
+        ljit_stub *st = b.stubs + i;
+        for(int j = 0; j < st->count; j++) ljit_patch(&b, st->jumps[j]);
+        if(st->k >= 0) {
+            // mov rdi, r14; mov rsi, [r13 + k]
+            ljit_emit(&b, "\x4C\x89\xF7\x49\x8B\xB5", 6);
+            ljit_u32(&b, 8 * st->k);
+            ljit_call_c(&b, (uintptr_t)lval_lookup);
+            ljit_push(&b, 0);
+            ljit_check_err(&b);
+        } else {
+            ljit_emit_call(&b, 3, 0);
+        }
+        int at = ljit_jump(&b, "\xE9", 1);
+        int32_t rel = st->resume - b.count;
+        memcpy(b.buf + at, &rel, 4);
+    }
+    free(b.stubs);
+
+    // An error on top of the stack is returned, what is under it released
+    for(int i = 0; i < b.nunwinds; i++) ljit_patch(&b, b.unwinds[i]);
+    // mov rdi, rsp; mov rsi, r12
+    ljit_emit(&b, "\x48\x89\xE7\x4C\x89\xE6", 6);
+    ljit_call_c(&b, (uintptr_t)ljit_unwind);
+    ljit_ret(&b);
+    free(b.unwinds);
+
+    // Copy the code to its own pages and make them executable
+    long page = sysconf(_SC_PAGESIZE);
+    size_t size = (b.count + page - 1) / page * page;
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(p == MAP_FAILED) {
+        free(b.buf);
+        return;
+    }
+    memcpy(p, b.buf, b.count);
+    free(b.buf);
+    if(mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(p, size);
+        return;
+    }
+    c->native = p;
+    c->native_size = size;
+    ljit_lambdas++;
+    ljit_bytes += b.count;
+
+    // perf reads symbols for JIT code from /tmp/perf-<pid>.map
+    if(!ljit_perf_map) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        ljit_perf_map = fopen(path, "w");
+    }
+    if(ljit_perf_map) {
+        fprintf(ljit_perf_map, "%lx %x lispy_lambda_%li\n", (unsigned long)(uintptr_t)p, b.count, ljit_lambdas);
+        fflush(ljit_perf_map);
+    }
+}
+
+// Append "n" bytes of machine code
+void ljit_emit(ljit_buf *b, const void *bytes, int n){
+    if(b->count + n > b->cap) {
+        while(b->count + n > b->cap) b->cap = b->cap ? b->cap * 2 : 256;
+        b->buf = realloc(b->buf, b->cap);
+    }
+    memcpy(b->buf + b->count, bytes, n);
+    b->count += n;
+}
+
+void ljit_u32(ljit_buf *b, uint32_t x){
+    ljit_emit(b, &x, 4);
+}
+
+void ljit_u64(ljit_buf *b, uint64_t x){
+    ljit_emit(b, &x, 8);
+}
+
+// Append the jump "op" with a 32 bit offset, to be set by ljit_patch.
+// Returns where the offset is.
+int ljit_jump(ljit_buf *b, const char *op, int n){
+    ljit_emit(b, op, n);
+    ljit_u32(b, 0);
+    return b->count - 4;
+}
+
+// Make the jump whose offset is "at" go to the end of the code
+void ljit_patch(ljit_buf *b, int at){
+    int32_t rel = b->count - (at + 4);
+    memcpy(b->buf + at, &rel, 4);
+}
+
+// Append the jump "op" with an "n" byte opcode to the code unit "to"
+void ljit_branch(ljit_buf *b, const char *op, int n, int to){
+    int at = ljit_jump(b, op, n);
+    b->fixups[b->nfixups++] = at;
+    b->fixups[b->nfixups++] = to;
+}
+
+// New stub for a slow path that looks up constant "k", or calls the three
+// values on top of the stack when "k" is -1. It returns to the end of the
+// code.
+ljit_stub *ljit_stub_new(ljit_buf *b, int k){
+    if(b->nstubs == b->stubs_cap) {
+        b->stubs_cap = b->stubs_cap ? b->stubs_cap * 2 : 16;
+        b->stubs = realloc(b->stubs, sizeof(ljit_stub) * b->stubs_cap);
+    }
+    ljit_stub *st = b->stubs + b->nstubs++;
+    st->count = 0;
+    st->k = k;
+    st->resume = -1;
+    return st;
+}
+
+// Call the C function at "f"
+void ljit_call_c(ljit_buf *b, uintptr_t f){
+    // mov rax, f; call rax
+    ljit_emit(b, "\x48\xB8", 2);
+    ljit_u64(b, f);
+    ljit_emit(b, "\xFF\xD0", 2);
+}
+
+// Push rax, after counting a reference to it if "copy" is set
+void ljit_push(ljit_buf *b, int copy){
+    if(copy) {
+        // test al, 1; jnz push; inc dword [rax + refs]
+        unsigned char inc[] = { 0xA8, 0x01, 0x75, 0x03, 0xFF, 0x40, offsetof(lval, refs) };
+        ljit_emit(b, inc, sizeof(inc));
+    }
+    // mov [r12], rax; add r12, 8
+    ljit_emit(b, "\x49\x89\x04\x24\x49\x83\xC4\x08", 8);
+}
+
+// Return rax
+void ljit_ret(ljit_buf *b){
+    // lea rsp, [rbp - 40]; pop r15, r14, r13, r12, rbx, rbp; ret
+    ljit_emit(b, "\x48\x8D\x65\xD8\x41\x5F\x41\x5E\x41\x5D\x41\x5C\x5B\x5D\xC3", 15);
+}
+
+// SYM k. A symbol that isn't one of the formals, in a lambda called from
+// the global environment, can only be bound there: the environment of the
+// call only has the formals. Its cached binding is read inline like in
+// lval_lookup.
+void ljit_emit_sym(ljit_buf *b, int k, int global){
+    if(!global) {
+        // mov rdi, r14; mov rsi, [r13 + k]
+        ljit_emit(b, "\x4C\x89\xF7\x49\x8B\xB5", 6);
+        ljit_u32(b, 8 * k);
+        ljit_call_c(b, (uintptr_t)lval_lookup);
+        ljit_push(b, 0);
+        return;
+    }
+
+    ljit_stub *st = ljit_stub_new(b, k);
+    // The parent is the global environment:
+    // mov rax, [r14 + par]; mov rdx, [rax + par]; test rdx, rdx; jnz stub
+    ljit_emit(b, "\x49\x8B\x86", 3);
+    ljit_u32(b, offsetof(lenv, par));
+    ljit_emit(b, "\x48\x8B\x90", 3);
+    ljit_u32(b, offsetof(lenv, par));
+    ljit_emit(b, "\x48\x85\xD2", 3);
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x85", 2);
+    // The cache is valid:
+    // mov rsi, [r13 + k]; mov rdx, [rax + ver]; cmp rdx, [rsi + ver]; jne stub
+    ljit_emit(b, "\x49\x8B\xB5", 3);
+    ljit_u32(b, 8 * k);
+    ljit_emit(b, "\x48\x8B\x90", 3);
+    ljit_u32(b, offsetof(lenv, ver));
+    ljit_emit(b, "\x48\x3B\x96", 3);
+    ljit_u32(b, offsetof(lval, ver));
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x85", 2);
+    // mov rax, [rsi + ref]; mov rax, [rax]; inc qword [lenv_cache_hits]
+    ljit_emit(b, "\x48\x8B\x86", 3);
+    ljit_u32(b, offsetof(lval, ref));
+    ljit_emit(b, "\x48\x8B\x00\x48\xBA", 5);
+    ljit_u64(b, (uintptr_t)&lenv_cache_hits);
+    ljit_emit(b, "\x48\xFF\x02", 3);
+    ljit_push(b, 1);
+    st->resume = b->count;
+}
+
+// LOCAL slot k, the slot is checked like in lval_lookup
+void ljit_emit_local(ljit_buf *b, int slot, int k){
+    ljit_stub *st = ljit_stub_new(b, k);
+    // mov rsi, [r13 + k]
+    ljit_emit(b, "\x49\x8B\xB5", 3);
+    ljit_u32(b, 8 * k);
+    // cmp dword [r14 + count], slot; jle stub
+    ljit_emit(b, "\x41\x81\xBE", 3);
+    ljit_u32(b, offsetof(lenv, count));
+    ljit_u32(b, slot);
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x8E", 2);
+    // mov rax, [r14 + syms]; mov rax, [rax + slot]; cmp rax, [rsi + sym]; jne stub
+    ljit_emit(b, "\x49\x8B\x86", 3);
+    ljit_u32(b, offsetof(lenv, syms));
+    ljit_emit(b, "\x48\x8B\x80", 3);
+    ljit_u32(b, 8 * slot);
+    ljit_emit(b, "\x48\x3B\x86", 3);
+    ljit_u32(b, offsetof(lval, sym));
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x85", 2);
+    // mov rax, [r14 + vals]; mov rax, [rax + slot]
+    ljit_emit(b, "\x49\x8B\x86", 3);
+    ljit_u32(b, offsetof(lenv, vals));
+    ljit_emit(b, "\x48\x8B\x80", 3);
+    ljit_u32(b, 8 * slot);
+    ljit_push(b, 1);
+    st->resume = b->count;
+}
+
+// CALL or TAIL of the "n" values on top of the stack, see ljit_call
+void ljit_emit_call(ljit_buf *b, int n, int tail){
+    // sub r12, n; mov rdi, r14; mov rsi, r12
+    ljit_emit(b, "\x49\x81\xEC", 3);
+    ljit_u32(b, 8 * n);
+    ljit_emit(b, "\x4C\x89\xF7\x4C\x89\xE6", 6);
+    // mov edx, n; mov ecx, tail; mov r8, r15
+    ljit_emit(b, "\xBA", 1);
+    ljit_u32(b, n);
+    ljit_emit(b, "\xB9", 1);
+    ljit_u32(b, tail);
+    ljit_emit(b, "\x4D\x89\xF8", 3);
+    ljit_call_c(b, (uintptr_t)ljit_call);
+    if(tail) {
+        // test rax, rax; jnz push; return NULL
+        ljit_emit(b, "\x48\x85\xC0\x75\x0F", 5);
+        ljit_ret(b);
+    }
+    ljit_push(b, 0);
+    if(!tail) ljit_check_err(b);
+}
+
+// Go to the unwinding code if rax, just pushed, is an error
+void ljit_check_err(ljit_buf *b){
+    // test al, 1; jnz over; cmp word [rax + type], LVAL_ERR; je unwind
+    unsigned char cmp[] = { 0xA8, 0x01, 0x75, 0x0B, 0x66, 0x83, 0x78, offsetof(lval, type), LVAL_ERR };
+    ljit_emit(b, cmp, sizeof(cmp));
+    ljit_unwind_jump(b, "\x0F\x84", 2);
+}
+
+// Append the jump "op" with an "n" byte opcode to the unwinding code
+void ljit_unwind_jump(ljit_buf *b, const char *op, int n){
+    if(b->nunwinds == b->unwinds_cap) {
+        b->unwinds_cap = b->unwinds_cap ? b->unwinds_cap * 2 : 16;
+        b->unwinds = realloc(b->unwinds, sizeof(int) * b->unwinds_cap);
+    }
+    b->unwinds[b->nunwinds++] = ljit_jump(b, op, n);
+}
+
+// Release the values from "base" to under the error on top at "top" and
+// return the error, for native code that got it
+lval *ljit_unwind(lval **base, lval **top){
+    lval *err = *--top;
+    while(top > base) lval_del(*--top);
+    return err;
+}
+
+// ADD, SUB or MUL. Fixnums are 2x + 1, so the arithmetic is done on the
+// tagged values and the overflow flag tells when the result doesn't fit.
+void ljit_emit_arith(ljit_buf *b, int op){
+    lbuiltin f = op == LOP_ADD ? builtin_add : op == LOP_SUB ? builtin_sub : builtin_mul;
+    ljit_stub *st = ljit_stub_new(b, -1);
+
+    // The function: mov rdi, [r12 - 24]; test dil, 1; jnz stub
+    ljit_emit(b, "\x49\x8B\x7C\x24\xE8\x40\xF6\xC7\x01", 9);
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x85", 2);
+    // cmp word [rdi + type], LVAL_FUN; jne stub
+    unsigned char type[] = { 0x66, 0x83, 0x7F, offsetof(lval, type), LVAL_FUN };
+    ljit_emit(b, type, sizeof(type));
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x85", 2);
+    // mov rax, f; cmp [rdi + builtin], rax; jne stub
+    ljit_emit(b, "\x48\xB8", 2);
+    ljit_u64(b, (uintptr_t)f);
+    ljit_emit(b, "\x48\x39\x87", 3);
+    ljit_u32(b, offsetof(lval, builtin));
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x85", 2);
+
+    // The arguments: mov rax, [r12 - 16]; mov rcx, [r12 - 8]
+    ljit_emit(b, "\x49\x8B\x44\x24\xF0\x49\x8B\x4C\x24\xF8", 10);
+    // Both fixnums: mov edx, eax; and edx, ecx; test dl, 1; jz stub
+    ljit_emit(b, "\x89\xC2\x21\xCA\xF6\xC2\x01", 7);
+    st->jumps[st->count++] = ljit_jump(b, "\x0F\x84", 2);
+
+    switch(op) {
+        case LOP_ADD:
+            // sub rax, 1; add rax, rcx; jo stub
+            ljit_emit(b, "\x48\x83\xE8\x01\x48\x01\xC8", 7);
+            st->jumps[st->count++] = ljit_jump(b, "\x0F\x80", 2);
+            break;
+        case LOP_SUB:
+            // sub rax, rcx; jo stub; add rax, 1
+            ljit_emit(b, "\x48\x29\xC8", 3);
+            st->jumps[st->count++] = ljit_jump(b, "\x0F\x80", 2);
+            ljit_emit(b, "\x48\x83\xC0\x01", 4);
+            break;
+        default:
+            // sar rax, 1; sub rcx, 1; imul rax, rcx; jo stub; add rax, 1
+            ljit_emit(b, "\x48\xD1\xF8\x48\x83\xE9\x01\x48\x0F\xAF\xC1", 11);
+            st->jumps[st->count++] = ljit_jump(b, "\x0F\x80", 2);
+            ljit_emit(b, "\x48\x83\xC0\x01", 4);
+            break;
+    }
+
+    // The result replaces the call: mov [r12 - 24], rax; sub r12, 16
+    ljit_emit(b, "\x49\x89\x44\x24\xE8\x49\x83\xEC\x10", 9);
+    // Release the function:
+    // cmp dword [rdi + refs], 1; jle del; dec dword [rdi + refs]; jmp done
+    unsigned char last[] = { 0x83, 0x7F, offsetof(lval, refs), 0x01, 0x7E, 0x05, 0xFF, 0x4F, offsetof(lval, refs), 0xEB, 0x0C };
+    ljit_emit(b, last, sizeof(last));
+    // del: lval_del(rdi)
+    ljit_call_c(b, (uintptr_t)lval_del);
+    st->resume = b->count;
+}
+
+// How many lambdas were compiled to native code
+void lstats_jit(void){
+    printf("lambdas: %li\n", ljit_lambdas);
+    printf("bytes:   %li\n", ljit_bytes);
+    printf("runs:    %li\n", ljit_runs);
+}
+#endif
@@ -0,0 +1,1350 @@
+#ifndef lispy_h
+#define lispy_h
+
+// sysconf, and mmap and MAP_ANONYMOUS for LISPY_JIT
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <limits.h>
+#include <float.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "mpc.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define LSIMD_AVX2
+#endif
+#ifdef LISPY_JIT
+#if !defined(__x86_64__) || !defined(__GNUC__) || defined(_WIN32)
+#error "LISPY_JIT needs x86-64 and a GNU C compiler"
+#endif
+#include <sys/mman.h>
+#endif
+#ifdef LISPY_COMPILER
+#include <sys/wait.h>
+#endif
+
+#define LASSERT(args, cond, code, fmt, ...) \
+    if (!(cond)) { \
+        lval *err = lval_err(code, fmt, ##__VA_ARGS__); \
+        lval_del(args); \
+        return err; \
+    }
+
+#define LASSERT_NUM(func_name, args, arg_count) \
+    LASSERT(args, args->count == arg_count, LERR_ARITY, \
+        "Function '%s' passed incorrect number of arguments. Got %i, Expected %i", func_name, args->count, arg_count);
+
+#define LASSERT_TYPE(func_name, args, index, expected) \
+    LASSERT(args, LVAL_TYPE(args->cell[index]) == expected, LERR_TYPE, \
+        "Function '%s' passed incorrect type for argument %i. Got %s, expected %s", func_name, index, ltype_name(LVAL_TYPE(args->cell[index])), ltype_name(expected));
+
+#define LASSERT_LIST(func_name, args, index) \
+    LASSERT(args, lval_is_list(args->cell[index]), LERR_TYPE, \
+        "Function '%s' passed incorrect type. Got %s, expected %s or %s", func_name, ltype_name(LVAL_TYPE(args->cell[index])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+// A list or an array, anything "foreach" and the higher order functions
+// can go through
+#define LASSERT_SEQ(func_name, args, index) \
+    LASSERT(args, lval_is_list(args->cell[index]) || LVAL_TYPE(args->cell[index]) == LVAL_ARR, LERR_TYPE, \
+        "Function '%s' passed incorrect type for argument %i. Got %s, expected Q-Expression, Vector or Array", func_name, index, \
+        ltype_name(LVAL_TYPE(args->cell[index])));
+
+// Forward declarations
+struct lval;
+struct lenv;
+typedef struct lval lval;
+typedef struct lenv lenv;
+typedef struct lvec lvec;
+typedef struct lcode lcode;
+
+// Function pointer definition for builtin functions
+typedef lval*(*lbuiltin)(lenv*, lval*);
+
+// All the possible lval types
+enum Lval_types { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN, LVAL_VEC, LVAL_BIG, LVAL_DBL, LVAL_ARR };
+
+// Errors
+// An error keeps the format of its message and the arguments it formats,
+// the message is only made when the error is printed (see lerr_format).
+// Most errors never are: the first one an expression gets is its value,
+// and the rest of it isn't evaluated. Formats are string literals and the
+// strings they format are literals or interned, so nothing is copied.
+// "errcode" tells what went wrong without the message.
+enum { LERR_UNBOUND, LERR_ARITY, LERR_TYPE, LERR_VALUE, LERR_DIV_ZERO, LERR_LIMIT, LERR_NOT_FUN };
+
+#define LERR_ARGS 4         // Most arguments a format takes
+#define LERR_MSG_MAX 512    // Longest message, with the terminating null
+
+// An argument of an error message, by its conversion
+typedef union {
+    long i;     // %i, %li and %c
+    double d;   // %f, %g and %e
+    char *s;    // %s
+} lerr_arg;
+
+// Lisp value struct
+// Only the type is shared by all values, everything else is a union and
+// each type allocates just the part of it that it uses (see LVAL_SIZEOF).
+struct lval {
+    short type;
+    short gc;   // Garbage collector state, see LISPY_GC
+    int refs;   // Number of references, see lval_copy and lval_del
+
+    union {
+        // Basic types
+        // Only numbers that don't fit in a fixnum are allocated
+        long num;
+        double dbl;
+
+        // Big number type, for integers that don't fit in a long. The
+        // magnitude follows the header in "limbs" limbs, see LVAL_LIMB.
+        struct {
+            int sign;   // 1 or -1
+            int limbs;
+        };
+
+        // Array type, "len" numbers of type "elem" follow the header, see
+        // LVAL_I64 and LVAL_F64
+        struct {
+            int elem;   // LARR_INT or LARR_DBL
+            int len;
+        };
+        // Error type, see lval_err
+        struct {
+            char *fmt;
+            int errcode;    // LERR_*
+            lerr_arg args[LERR_ARGS];
+        };
+
+        // Symbol type, the name is interned (see lsym_intern)
+        // Symbols inside lambda bodies can also have a lexical address,
+        // "slot" in the frame "depth" levels up, see lval_resolve.
+        // Global bindings are cached in the symbol, see lval_lookup.
+        struct {
+            char *sym;
+            int depth;  // -1 when not resolved
+            int slot;
+            lval **ref;         // Binding in the global environment
+            unsigned long ver;  // Its version when "ref" was cached
+        };
+#ifdef LISPY_GC
+        // Where a nursery lval was moved to during a collection
+        lval *fwd;
+#endif
+
+        // Function type
+        // Builtins only allocate the "builtin" field, lambdas set it to NULL
+        struct {
+            lbuiltin builtin;
+            lenv *env;      // Scope the lambda was made in, see lval_bind
+            lval *formals;
+            lval *body;
+            lcode *code;    // Compiled body, NULL when it isn't compiled
+        };
+
+        // Expression type
+        // Count and pointer to a list of "lval". The list starts "off"
+        // cells into an array of "cap" cells (see LVAL_CELL_BASE) so
+        // both ends can be popped without moving the other cells.
+        struct {
+            int count;
+            int off;
+            int cap;
+            lval **cell;
+        };
+
+        // Vector type, the root of the tree or NULL when empty
+        lvec *vec;
+    };
+};
+
+// Allocation size of a heap lval whose payload ends with "member"
+#define LVAL_SIZEOF(member) (offsetof(lval, member) + sizeof(((lval*)0)->member))
+
+// Limbs of a big number, least significant first
+#define LVAL_LIMB(v) ((uint64_t*)((char*)(v) + LVAL_SIZEOF(limbs)))
+
+// Numbers of an array
+#define LVAL_I64(v) ((int64_t*)((char*)(v) + LVAL_SIZEOF(len)))
+#define LVAL_F64(v) ((double*)((char*)(v) + LVAL_SIZEOF(len)))
+
+// Start of the allocated cell array of an expression
+#define LVAL_CELL_BASE(v) ((v)->cell - (v)->off)
+
+// Small integers are stored in the lval pointer itself. A pointer with the
+// lowest bit set is a fixnum, the number is kept in the remaining bits.
+// Heap lvals are always at least 2 byte aligned so the bit is free.
+#define LVAL_FIXNUM_MAX (LONG_MAX >> 1)
+#define LVAL_FIXNUM_MIN (LONG_MIN >> 1)
+#define LVAL_IS_FIXNUM(v) (((uintptr_t)(v)) & 1)
+#define LVAL_FIXNUM(x) ((lval*)((((uintptr_t)(x)) << 1) | 1))
+#define LVAL_FIXNUM_VALUE(v) (((intptr_t)(v)) >> 1)
+
+// Type of any lval, fixnums included. Use this instead of "v->type"
+// whenever "v" could be a number.
+#define LVAL_TYPE(v) (LVAL_IS_FIXNUM(v) ? LVAL_NUM : (v)->type)
+
+// Big numbers
+// Integer arithmetic is done on longs and only switches to big numbers
+// when a result overflows. Results are always normalized, so a value that
+// fits in a long is never an LVAL_BIG. The lnat_ functions work on
+// magnitudes, arrays of 64 bit limbs with the least significant first.
+#define LNAT_KARATSUBA 32       // Smallest size multiplied with Karatsuba
+#define LNAT_PRINT_SPLIT 32     // Largest size printed with single limb divisions
+#define LNAT_DIGITS 19          // Decimal digits in a chunk of LNAT_CHUNK
+#define LNAT_CHUNK 10000000000000000000ULL
+#define LNAT_MAX_BITS INT_MAX   // Largest result of "^"
+
+typedef unsigned __int128 lnat_wide;
+
+// Magnitude and sign of any integer lval. Longs are kept in "small".
+typedef struct {
+    int sign;       // 1, -1 or 0
+    int limbs;
+    uint64_t *limb;
+    uint64_t small;
+} lint;
+
+// Numeric arrays
+// An array holds numbers of a single type, 64 bit integers or doubles,
+// in one block right after the lval header. Arrays are made from lists
+// with "array" or with "range". The arithmetic builtins work element by
+// element on them, and the comparison builtins give masks of 0 and 1.
+// Integer arrays wrap around on overflow instead of making big numbers.
+// Dividing by zero with "/" or "%" is an error as it is for numbers, float
+// arrays included, and "%" of floats is fmod.
+//
+// The loops over arrays are lsimd kernels. There is a table of them for
+// AVX2, for SSE2 and in plain C, and the best one the CPU supports is
+// picked when the builtins are added. LISPY_SIMD=avx2, sse2 or scalar in
+// the environment picks one by hand.
+#define LARR_INT 0
+#define LARR_DBL 1
+
+// Kernel operations
+enum { LARR_ADD, LARR_SUB, LARR_MUL, LARR_DIV, LARR_MOD, LARR_MIN, LARR_MAX };
+enum { LARR_LT, LARR_GT, LARR_LE, LARR_GE, LARR_EQ, LARR_NE };
+enum { LMATH_SQRT, LMATH_EXP, LMATH_LOG, LMATH_SIN };
+
+// "r = a op b" kernels take "as" or "bs" set when that operand is a single
+// number to use for every element. Reductions only take LARR_ADD, LARR_MIN
+// and LARR_MAX. "math_f64" replaces the "n" doubles at "x" by their
+// LMATH_SQRT, LMATH_EXP, LMATH_LOG or LMATH_SIN.
+typedef struct {
+    char *name;
+    double (*reduce_f64)(double *x, long n, int op);
+    int64_t (*reduce_i64)(int64_t *x, long n, int op);
+    double (*dot_f64)(double *a, double *b, long n);
+    int64_t (*dot_i64)(int64_t *a, int64_t *b, long n);
+    void (*map_f64)(double *r, double *a, double *b, long n, int op, int as, int bs);
+    void (*map_i64)(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+    void (*cmp_f64)(int64_t *r, double *a, double *b, long n, int op, int as, int bs);
+    void (*cmp_i64)(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+    void (*math_f64)(double *x, long n, int fn);
+} lsimd_kernels;
+
+// Kernels in use, set by lsimd_init
+extern lsimd_kernels *lsimd;
+
+// The tables lsimd_init picks from
+extern lsimd_kernels lsimd_scalar;
+#ifdef __SSE2__
+extern lsimd_kernels lsimd_sse2;
+#endif
+#ifdef LSIMD_AVX2
+extern lsimd_kernels lsimd_avx2;
+#endif
+
+// Persistent vectors
+// A vector "[a b c]" holds a list like a Q-Expression, but in a tree of
+// immutable nodes instead of a flat cell array. Leaves hold up to
+// LVEC_LEAF values, inner nodes have two children whose heights differ by
+// at most one. Every node counts the values below it, so indexing goes
+// straight down. Nodes are reference counted and shared by every vector
+// they are part of: head, tail, init, cons and join only build the
+// O(log n) nodes along one path and never copy the rest of the list.
+#define LVEC_LEAF 30    // A full leaf fills a 256 byte pool block
+
+struct lvec {
+    int refs;
+    short height;   // 0 for leaves
+    short gc;       // LVEC_SCANNED when no value below is young, see LISPY_GC
+    int count;      // Values below this node
+    int mark;       // Last major collection that marked the node, see LISPY_GC
+    union {
+        lvec *child[2];
+        lval *item[LVEC_LEAF];
+    };
+};
+
+// Allocation size of a leaf with "n" values and of an inner node
+#define LVEC_LEAF_SIZE(n) (offsetof(lvec, item) + sizeof(lval*) * (n))
+#define LVEC_NODE_SIZE (offsetof(lvec, child) + sizeof(lvec*) * 2)
+
+#define LVEC_SCANNED 1
+
+// State every thread has its own copy of, see "Parallel map"
+#define LTHREAD __thread
+
+// Memory pool
+// Heap lvals and small cell arrays are carved out of big slabs, one slab
+// list per size class. Released blocks go to the free list of their class
+// and are reused before the slab is bumped again. Larger cell arrays fall
+// back to malloc. Slabs are never returned to the system.
+//
+// Every thread has its own pool. A block released by another thread than
+// the one that allocated it goes to the free list of the thread releasing
+// it, so free lists are handed over between threads in magazines of
+// LPOOL_MAGAZINE blocks: a thread with a full free list and a full spare
+// one puts the spare in the depot, and a thread that runs out of both
+// takes a magazine from the depot before carving new blocks.
+#define LPOOL_SLAB_SIZE (64 * 1024)
+#define LPOOL_CLASSES 8
+#define LPOOL_MAX_SIZE 512
+#define LPOOL_MAGAZINE 1024
+
+typedef struct lpool_block {
+    struct lpool_block *next;
+    struct lpool_block *next_magazine;  // In the first block of a magazine
+                                        // in the depot
+} lpool_block;
+
+typedef struct {
+    lpool_block *free;  // Released blocks of this class
+    int nfree;          // Blocks in "free", at most LPOOL_MAGAZINE
+    lpool_block *spare; // Full magazine or NULL
+    char *bump;         // Next never used block in the newest slab
+    char *end;          // End of the newest slab
+    long slabs;
+    long allocs;
+    long frees;
+} lpool_class;
+
+// Symbol table
+// Every symbol name is interned once and never freed, so two symbols are
+// the same if their "sym" pointers are equal. The hash of a name is kept
+// in front of it (see LSYM_HASH).
+//
+// Lookups don't take any lock. Slots are only ever filled, never changed,
+// and a full table is replaced by a bigger copy that is published with a
+// single pointer store. Old tables are kept since a reader could still be
+// using them. Insertions take "lock" and look again in the current table
+// before adding anything.
+typedef struct {
+    unsigned long hash;
+    char name[];
+} lsym;
+
+typedef struct {
+    unsigned long mask;  // Capacity - 1, the capacity is a power of 2
+    unsigned long count;
+    char **slots;
+    void *prev;          // Replaced table, kept for concurrent readers
+} lsym_table;
+
+#define LSYM_HASH(s) (((lsym*)((s) - offsetof(lsym, name)))->hash)
+
+extern char *lsym_amp;
+
+#ifdef LISPY_GC
+
+// Garbage collector
+// Optional generational collector, built with "make gc". New lvals and
+// their small cell arrays are bump allocated in the nursery. Temporaries
+// still release their children when their last reference goes away, but
+// their memory is only given back all at once by the next collection.
+// When the nursery is full lvals are allocated from the pool until then.
+//
+// Collections run at safepoints between two top-level expressions, where
+// nothing is alive on the C stack and the only roots are the lenv chain,
+// and inside the evaluation of one once the nursery is full (gc_poll).
+// Only the evaluation main starts, the top one, collects: its frames,
+// the tree walker's or lvm's with their value stack, are roots too, and
+// nothing else holds lvals. The evaluations started inside it by builtins
+// like "map", "eval" or the loops, and the native code of a lambda, run
+// to the end without collecting, their callers keep lvals on the C stack.
+// The tree walker polls before every step, lvm when it enters a lambda.
+//
+// A minor collection moves every young lval reachable from the roots to
+// the old generation. A major collection frees old lvals that are dead or
+// unreachable, reference cycles included. It runs when the old generation
+// grows past its threshold (see builtin_gc), or when more than half of it
+// is dead: old lvals whose last reference goes away are counted, but their
+// memory can only be given back by a sweep.
+//
+// Old lvals are never modified (lval_unshare copies them), so they can't
+// point to young ones and minor collections don't have to scan them. The
+// S-Expressions of the tree walker's frames are the exception: their
+// cells are replaced by the values of the children, so they are scanned
+// at every collection, and they are copied when old before a builtin gets
+// them as its arguments.
+
+// Defaults of the "gc" builtin, "make check" builds with tiny ones
+#ifndef GC_NURSERY_SIZE
+#define GC_NURSERY_SIZE (4 * 1024 * 1024)
+#endif
+#ifndef GC_OLD_LIMIT
+#define GC_OLD_LIMIT (32 * 1024 * 1024)
+#endif
+
+// lval->gc states
+#define GC_YOUNG   0    // Allocated since the last collection
+#define GC_OLD     1    // Survived a collection
+#define GC_DEAD    2    // Old lval without references, counted in dead_bytes until swept
+#define GC_FORWARD 3    // Nursery lval moved to "fwd"
+#define GC_MARK    0x10 // Reachable, only set during major collections
+
+typedef struct {
+    char *nursery;
+    char *bump;
+    char *end;
+    size_t nursery_size;    // Tunable with the "gc" builtin
+    size_t old_limit;       // Tunable with the "gc" builtin
+    size_t old_next;        // Size of the old generation that starts a major collection
+
+    // Every lval in the old generation, dead ones included
+    lval **old;
+    int old_count;
+    int old_cap;
+    size_t old_bytes;
+    size_t dead_bytes;
+
+    // Statistics
+    long minor;
+    long major;
+    long overflow;          // lvals that didn't fit in the nursery
+    size_t promoted;        // Bytes moved to the old generation
+    double pause_total;     // Milliseconds
+    double pause_max;
+
+    int top;                // Set by main before the evaluation it starts
+} lgc_state;
+
+extern lgc_state lgc;
+
+#define LVAL_MALLOC(size) gc_alloc(size)
+#define LVAL_FREE(p, size) gc_free(p, size)
+
+#else
+
+#define LVAL_MALLOC(size) lpool_alloc(size)
+#define LVAL_FREE(p, size) lpool_free(p, size)
+
+#endif
+
+// Environment structure
+// The bindings are kept in the order they were added, in parallel arrays.
+// Environments with more than LENV_INDEX_MIN bindings also get a hash
+// index into those arrays (open addressing, linear probing). A full index
+// is replaced by one twice as big, and the bindings are moved over a few
+// at a time by the following lenv_puts. Until then lookups check both.
+//
+// Scope is lexical. A lambda keeps a reference to the environment it was
+// made in, and a call binds the arguments in one new environment whose
+// parent is that one. Environments are reference counted and shared by
+// the lambdas, frames and child environments that point to them, so
+// making or copying a lambda never copies any bindings. Only the global
+// environment is changed after it is made (by "def"), the others are
+// filled when they are made and then only read. References to the global
+// environment aren't counted, it belongs to whoever made it (see
+// lenv_ref).
+//
+// Symbols cache where their binding in the global environment is, with
+// the environment's version. The version changes whenever "vals" is
+// reallocated, and every environment gets versions no other one had, so
+// a cache is used as long as the versions match. Bindings don't move
+// when their value is replaced, "def" of an existing name keeps the
+// caches.
+//
+// Every call makes an environment for its arguments. Freed environments
+// with at most LENV_SPARE_CAP bindings are kept, with their arrays, for
+// the next lenv_new, so most calls don't allocate one. At most
+// LENV_SPARE_MAX are kept per thread, building with -DLENV_SPARE_MAX=0
+// turns the reuse off. "stats {mem}" shows how many were reused.
+#define LENV_INDEX_MIN 8
+#define LENV_MIGRATE_STEP 16
+#define LENV_SPARE_CAP 8
+#ifndef LENV_SPARE_MAX
+#define LENV_SPARE_MAX 256
+#endif
+
+struct lenv {
+    int run;    // Used to exit the program, set to 0 in builtin_exit
+    int refs;   // References, see lenv_ref and lenv_unref
+    lenv *par;  // Parent environment, NULL for the global one
+    unsigned long ver;  // Changes when "vals" moves, see lenv_versions
+    lenv *shared;       // Global environment the root of a parallel map
+                        // part copies bindings from, see lpar_import
+
+    // Bindings
+    int count;
+    int cap;
+    lval **vals;
+    char **syms;
+    unsigned long *hashes;  // Cached symbol hashes, used to rebuild the index
+
+    // Hash index, slots hold a binding position or -1
+    int *index;
+    int mask;
+
+    // Index being replaced and how many bindings have been moved out of it
+    int *old_index;
+    int old_mask;
+    int migrated;
+    int migrating;
+};
+
+// Last version given to an environment by this thread, and the global
+// lookups that used a cached binding or had to find it, printed by
+// "stats". Threads hand out versions LPAR_THREADS_MAX apart from
+// their own start, so no two environments get the same one.
+extern LTHREAD unsigned long lenv_versions;
+extern LTHREAD long lenv_cache_hits;
+extern LTHREAD long lenv_cache_misses;
+
+// Bytecode
+// S-Expressions are compiled to bytecode for a small stack machine, lvm,
+// instead of being evaluated by walking their lval trees. Lambda bodies
+// are compiled once when the lambda is made, the expressions typed at the
+// prompt right before they run. Expressions built at run time and passed
+// to "eval" are usually run once, they are still walked by lval_eval.
+// LISPY_EVAL=tree in the environment turns lvm off, the tree walker is
+// kept as the reference.
+//
+// An instruction is a 16 bit opcode followed by its 16 bit operands:
+//
+//   CONST k      Push constant k
+//   SYM k        Push the value of symbol constant k
+//   LOCAL s k    Push frame slot s, which is symbol constant k
+//   CALL n       Evaluate an S-Expression of the n values on top of the
+//                stack, the function first, and push the result
+//   TAIL n       CALL n as the last thing the code does, see below
+//   ADD, SUB, MUL
+//                CALL 3, done inline for two fixnums and the builtin
+//   RETURN       Return the value on top of the stack
+//   LAZY f k     Pop the function on top if it is the builtin of special
+//                form f and skip the JUMP after this instruction, the
+//                code after that evaluates the arguments. Otherwise
+//                replace it with the value of constant k, the whole
+//                S-Expression, from the tree walker.
+//   JUMP t       Go on at t
+//   TEST f       Pop the condition on top and go on at f if it is false
+//   AND t, OR t  Go on at t, keeping the value on top, if it is false for
+//                AND or true for OR. Otherwise pop it.
+//   FOLD k t     Push the value of the folded call constant k and go on
+//                at t if its builtins are still bound (lfold_valid),
+//                otherwise go on with the code of the call after this
+//                instruction
+//
+// An error is the value of the whole code as soon as it is pushed, also
+// when a condition isn't a number. The rest isn't run and every frame
+// returns it, see "unwind" in lvm_exec.
+//
+// Special forms are compiled to jumps, a call to "if", "and", "or" or
+// "cond" starts with LAZY. Jump targets are offsets in the code.
+//
+// lvm has its own stack of frames, a call to a compiled lambda doesn't
+// recurse in C. Only builtins that evaluate something, like "eval", start
+// another lvm_run.
+//
+// Tail calls don't use a frame. The callee's environment chains to the
+// lambda's scope and not to the caller's, so the callee always takes the
+// place of the frame that calls it and the caller's environment is
+// released, unless a closure still refers to it. "eval" of a list in tail
+// position compiles the list and runs it in the same frame. Tail
+// recursive loops, directly or through "eval", run in constant space.
+// The tree walker does the same in lval_eval_sexpr.
+enum {
+    LOP_CONST, LOP_SYM, LOP_LOCAL, LOP_CALL, LOP_TAIL, LOP_ADD, LOP_SUB, LOP_MUL, LOP_RETURN,
+    LOP_LAZY, LOP_JUMP, LOP_TEST, LOP_AND, LOP_OR, LOP_FOLD
+};
+
+#define LCODE_MAX 65535     // Largest operand, bigger expressions aren't compiled
+#define LCOMP_NESTING_MAX 1024  // Deepest S-Expression compiled, the compiler recurses
+#define LVM_STACK_MIN 64    // Stack slots and frames before lvm_run allocates any
+#define LVM_FRAMES_MIN 16
+
+// Whether "v" is the builtin "b", lvm and native code check calls with it
+#define LVM_IS_BUILTIN(v, b) (!LVAL_IS_FIXNUM(v) && (v)->type == LVAL_FUN && (v)->builtin == (b))
+
+// Labels as values make the dispatch one indirect jump per instruction
+#ifdef __GNUC__
+#define LVM_COMPUTED_GOTO
+#endif
+
+struct lcode {
+    int refs;
+    int count;      // Code units
+    int stack;      // Most stack slots in use at once
+    lval *consts;   // Q-Expression of the constants
+#ifdef LISPY_JIT
+    int calls;      // Calls so far, -1 when it can't be compiled
+    void *native;   // Native code, see ljit_compile
+    size_t native_size;
+#endif
+    uint16_t code[];
+};
+
+// Code being compiled
+typedef struct {
+    uint16_t *code;
+    int count;
+    int cap;
+    lval *consts;
+    int depth;      // Stack slots in use at this point
+    int stack;
+    int nesting;    // S-Expressions being compiled
+    int failed;     // Too big for 16 bit operands, or nested too deep
+} lcomp;
+
+typedef struct {
+    lcode *code;
+    uint16_t *pc;
+    lenv *env;      // Counted reference, released on return
+    lval *fn;       // Lambda being run, NULL for the first frame
+    int own_code;   // "code" is deleted on return, it was compiled for "eval"
+} lvm_frame;
+
+extern int lvm_enabled;
+
+#ifdef LISPY_JIT
+// Native code
+// With LISPY_JIT, lambdas that are called often are compiled to x86-64
+// machine code. Each instruction of the lambda's lcode becomes a fixed
+// template: constants, frame slots and cached global bindings are pushed
+// inline, and ADD, SUB and MUL check for the builtin and two fixnums and
+// do the arithmetic inline, falling back to a call when a guard fails or
+// the result overflows. Everything else calls the C functions lvm_exec
+// uses.
+//
+// Native code runs the whole body and returns its value. The lambdas it
+// calls are run by another lvm_exec, which recurses in C, so at most
+// LJIT_DEPTH_MAX native calls are nested and deeper ones are left to the
+// interpreter. A tail call returns the lambda to lvm_exec instead, which
+// runs it in place of the frame like for LOP_TAIL, so tail loops still
+// run in constant space.
+//
+// An lcode counts the calls to its lambdas and is compiled on call
+// LJIT_HOT_CALLS. The code gets its own mmap'd pages, which are made
+// executable once written, and a line in /tmp/perf-<pid>.map so perf can
+// name it. LISPY_JIT=off in the environment turns it off.
+#define LJIT_HOT_CALLS 100
+#define LJIT_DEPTH_MAX 32
+
+// What native code calls in tail position, it returns NULL instead of a
+// value
+typedef struct {
+    lval *fn;       // Lambda to run in "env"
+    lenv *env;
+    lcode *code;    // Or a list compiled for "eval", run in the same environment
+} ljit_exit;
+
+typedef lval *(*ljit_fn)(lenv *e, lval **k, ljit_exit *x);
+
+// Slow path of a template, see ljit_stub_new
+typedef struct {
+    int jumps[5];   // Jumps to the stub
+    int count;
+    int resume;     // Where the stub jumps back to
+    int k;          // Constant to look up, or -1 to call
+} ljit_stub;
+
+// Machine code being written
+typedef struct {
+    unsigned char *buf;
+    int count;
+    int cap;
+    ljit_stub *stubs;
+    int nstubs;
+    int stubs_cap;
+    int *labels;    // Where each code unit starts, for jumps
+    int *fixups;    // Jump offsets and the code units they go to, in pairs
+    int nfixups;
+    int *unwinds;   // Jumps to the code returning an error, see ljit_unwind
+    int nunwinds;
+    int unwinds_cap;
+} ljit_buf;
+
+extern int ljit_enabled;
+#endif
+
+// Tree walker
+// lval_eval doesn't recurse in C. The S-Expressions being evaluated are
+// kept on a stack of frames on the heap, so nesting is only limited by
+// memory. An evaluation runs a step at a time, a step evaluates a symbol
+// or applies a function once its arguments are evaluated, and it can be
+// stopped after any number of steps and resumed (see leval_run). The
+// frames can be listed with "frames".
+#define LEVAL_FRAMES_MIN 16     // Frames before an evaluation allocates any
+
+typedef struct {
+    lval *v;        // S-Expression whose children are being evaluated, NULL
+                    // while its function is applied
+    int next;       // Child being evaluated
+    lenv *env;      // Counted reference, released on return
+    int form;       // Special form being run, LFORM_NONE for a call and
+                    // -1 until the function is evaluated
+} leval_frame;
+
+typedef struct leval {
+    leval_frame *frames;
+    int count;
+    int cap;
+    lval *result;           // Value, once the last frame returned
+    long steps;             // Steps run so far
+    struct leval *outer;    // Evaluation running when this one was started
+    leval_frame frames_local[LEVAL_FRAMES_MIN];
+} leval;
+
+#ifdef LISPY_GC
+// Frames of the top evaluation, the roots gc_poll adds to the lenv chain
+typedef struct {
+    leval *ev;          // Tree walker, or NULL
+    lcode *code;        // Code lvm started with, its caller still has it
+    lvm_frame *frames;  // lvm frames and value stack
+    int nframes;
+    lval **stack;
+    int nstack;
+} lgc_roots;
+#endif
+
+// Special forms
+// "if", "and", "or" and "cond" are builtins, but a call to one of them
+// only evaluates the arguments it needs:
+//
+//   if c a b       a when c is true, otherwise b, or () without it
+//   and x y ...    The first false value, or the last value
+//   or x y ...     The first true value, or the last value
+//   cond c1 e1 c2 e2 ... d
+//                  The expression after the first true test, otherwise
+//                  d, or () without it
+//
+// Conditions are numbers, zero is false and any other number true. The
+// comparison builtins give 1 or 0 for two numbers. The argument evaluated
+// last is in tail position. Evaluators recognize a form by the value of
+// its function, so the names can still be redefined, and a form called
+// like any other function, with its arguments evaluated, has the same
+// value. Folded calls are run like a special form too, see "Constant
+// folding".
+enum { LFORM_NONE, LFORM_IF, LFORM_AND, LFORM_OR, LFORM_COND, LFORM_FOLD };
+
+// Loops
+// The bodies are Q-Expressions, like lambda bodies, and so is the loop
+// variable, like the symbols given to "def":
+//
+//   while {c} {b}           b while c is true
+//   dotimes {i} n {b}       b with i bound to 0, 1, ... n-1
+//   foreach {x} l {b}       b with x bound to each value of the list,
+//                           vector or array l
+//
+// A loop is () once it is done, or the first error its body gives. The
+// body is made into a lambda of the loop variable once, and every
+// iteration runs it in the same environment where only the value of the
+// variable is replaced: no arguments are built and nothing is bound or
+// looked up by name. Values are accumulated with "def", which replaces a
+// global binding in place. A body that keeps its environment, in a
+// lambda made in it, gets a new one for the next iteration.
+typedef struct {
+    lval *fn;       // Lambda of the loop variables run for an iteration
+    lenv *env;      // Its environment, reused while nothing else holds it
+} lloop;
+
+// Higher-order functions
+//   map f l          The values of f for each value of l
+//   filter f l       The values of l f is true for
+//   foldl f z l      f applied to z and the first value of l, then to
+//                    that and the second value, and so on
+//   foldr f z l      The same from the last value, f gets the value of
+//                    l first: (f l0 (f l1 ... (f ln z)))
+//   reduce f l       foldl with the first value of l as z
+//
+// l is a Q-Expression, a vector or an array, map and filter give the same
+// type. The values map makes from an array must be numbers, the array it
+// gives holds floats if any of them is one. A Q-Expression nothing else
+// refers to is changed in place, otherwise the result is made with room
+// for every value at once. f is called the way lvm calls a function,
+// without an S-Expression of its arguments.
+
+// Parallel map
+// "pmap f l" and "preduce f l" are "map f l" and "reduce f l" with the
+// values of l split in parts, which a fixed pool of worker threads
+// evaluates at the same time. The calling thread does the first part. The
+// pool is started by the first call, with LISPY_THREADS threads or one
+// per processor, and is kept for the next ones. pmap puts every value at
+// its index. preduce reduces every part and then their values from the
+// first part on, so f must be associative. The error of the first part
+// that failed is the value of a call that fails. Lists with fewer than
+// LPAR_MIN_PART values per thread, and calls from inside a part, are left
+// to map and reduce.
+//
+// A part never touches a value another thread can see, so reference
+// counts stay plain increments and decrements:
+//   - The thread running it copies f, the values of its part and the
+//     environments they refer to (lpar_copy). The root of the copies is a
+//     new environment whose "shared" is the global one. The first lookup
+//     of a global name there copies its binding (lpar_import), and the
+//     symbol caches the copy. The shared values are only read, and the
+//     caller waits for every part before it changes anything again.
+//   - "def" is an error. So that a program does the same with any number
+//     of threads, it also is when pmap and preduce are left to map and
+//     reduce (lpar_depth).
+//   - Native code isn't compiled or run.
+//   - Every thread allocates from its own pool, keeps its own spare
+//     environments and has its own evaluation (see LTHREAD).
+// Once a part is done its values are bound to the global environment
+// instead of the copy of it (lpar_rebind), which is deleted. Errors are
+// values like any other, their arguments are literals or interned.
+// With the collector the nursery is shared by everything, so pmap and
+// preduce always run sequentially.
+#define LPAR_THREADS_MAX 64
+#define LPAR_MIN_PART 64    // Fewest values a part is given
+
+typedef struct {
+    lenv *env;      // Environment of the call
+    lval *f;
+    lval *l;        // List of the values
+    int n;          // Its length
+    int parts;
+    int reduce;     // preduce, otherwise pmap
+    lval **out;     // pmap: value at every index, NULL until it is made
+    lval **vals;    // preduce: value of every part. pmap: error of every
+                    // part, NULL when it didn't fail.
+} lpar_job;
+
+// Copies made by a part, by the address of the original. Every copy is
+// kept with a reference until the part is over, so a value met twice is
+// copied once. Also used as the set of values lpar_rebind has seen.
+typedef struct {
+    void **from;
+    void **to;
+    char *kind;     // LPAR_LVAL, LPAR_LENV, LPAR_LVEC, LPAR_LCODE or
+                    // LPAR_SEEN for a value without a reference
+    int count;
+    int mask;       // Capacity - 1, 0 when empty
+} lpar_map;
+
+enum { LPAR_SEEN, LPAR_LVAL, LPAR_LENV, LPAR_LVEC, LPAR_LCODE };
+
+// Root environment and copies of the part this thread runs, NULL when it
+// runs none
+extern LTHREAD lenv *lpar_root;
+extern LTHREAD lpar_map *lpar_copies;
+
+// pmap and preduce calls this thread is running, sequentially or in parts
+extern LTHREAD int lpar_depth;
+
+// Constant folding
+// Calls to pure builtins whose arguments are all literals are replaced by
+// their value before anything runs: in the forms typed at the prompt, and
+// in lambda bodies when the lambda is made. Nested calls are folded first,
+// so "(* 60 (+ 1 2))" becomes 180 and "(+ x (* 60 60))" becomes
+// "(+ x 3600)". Q-Expressions are data, nothing inside them is folded.
+//
+// A call is only folded when its symbol is bound to one of the builtins
+// lfold_builtin accepts where the call is, and isn't a formal of the lambda.
+// The call is kept next to its value, in an S-Expression of the function
+// builtin_folded, the value, the call and the builtin it calls. Evaluators run
+// it like a special form: the value is used while the symbol, and those
+// of the folded calls among its arguments, are still bound to the same
+// builtins, otherwise the call is evaluated. The lookups go through the
+// symbols' caches, so a lambda made before "*" is redefined calls the new
+// "*". Forms that call "def" anywhere aren't folded at all. Calls that
+// give an error are left alone to fail when they run. LISPY_FOLD=off in
+// the environment turns folding off.
+extern int lfold_enabled;
+
+// Statistics
+// "stats" prints every section, "stats {gc jit}" only the ones named. The
+// jit and gc sections are only there in the builds that have them.
+typedef struct {
+    char *name;
+    void (*print)(void);
+} lstats_section;
+
+// Ahead-of-time compilation
+// "make compiler" builds lispyc, which turns a .lspy file into C and links
+// it with lispyrt.o, the interpreter built with LISPY_AOT, into a standalone
+// program. Every line of the file is a form, read like a line typed at the
+// prompt. Each form becomes a C function that evaluates the children of
+// its S-Expressions in order and applies them like lvm_call, without
+// reading, folding or compiling anything when it runs. Calls whose head is
+// a builtin's name call the builtin's function directly once a guard has
+// checked the name is still bound to it. Symbols keep their global cache
+// and quoted values are built once at startup, lambdas are made and run
+// like in the REPL. The program prints the value of every form like the
+// REPL does, without the prompts.
+#if defined(LISPY_AOT) && defined(LISPY_GC)
+#error "LISPY_AOT keeps constants outside the collector's roots"
+#endif
+#ifdef LISPY_AOT
+// Written by lispyc, the form functions end with NULL
+extern lval *(*laot_forms[])(lenv *e);
+void laot_init(lenv *e);
+#endif
+#ifdef LISPY_COMPILER
+typedef struct {
+    FILE *out;          // Form functions
+    lenv *env;          // Builtins, to tell which calls can be direct
+    lenv *syms;         // Symbols looked up, S[i] being the i-th binding
+    lval *consts;       // Quoted values and literals built once, K[i]
+    lenv *builtins;     // Builtins called directly, B[i] likewise
+    int arrays;         // Argument arrays used so far in the form
+    int *live;          // Argument arrays being filled and their values
+    int nlive;          // so far, in pairs
+    int live_cap;
+} lispyc;
+#endif
+
+char *ltype_name(int t);
+
+lval *lval_eval_sexpr(lenv *e, lval *v);
+lval *lval_eval(lenv *e, lval *v);
+lval *lval_call(lenv *e, lval *f, lval *v);
+lval *lval_bind(lenv *e, lval *f, lval *v, lenv **env);
+void leval_init(leval *ev, lenv *e, lval *v);
+int leval_run(leval *ev, long steps);
+void leval_free(leval *ev);
+leval_frame *leval_push(leval *ev, lval *v, lenv *e);
+lval *leval_apply(leval *ev, int i);
+void leval_return(leval *ev, lval *r);
+int leval_form(leval *ev, leval_frame *fr);
+int leval_test(leval *ev, leval_frame *fr, int i);
+void leval_branch(leval *ev, leval_frame *fr, int i);
+lval *leval_take(leval_frame *fr, int i);
+int lform_of(lval *f, int count);
+int lval_truth(lval *v);
+lval *lval_cond_err(lval *v);
+lcode *lcode_compile(lval *v);
+void lcomp_emit(lcomp *c, int op, int n, int a, int b);
+int lcomp_const(lcomp *c, lval *x);
+void lcomp_expr(lcomp *c, lval *v);
+void lcomp_sexpr(lcomp *c, lval *v, int tail);
+void lcomp_push(lcomp *c);
+int lcomp_form_of(lval *v);
+void lcomp_form(lcomp *c, lval *v, int form, int tail);
+void lcomp_branch(lcomp *c, lval *x, int tail);
+int lcomp_jump(lcomp *c, int op, int n);
+void lcomp_patch(lcomp *c, int at);
+void lcode_del(lcode *c);
+lval *lvm_eval(lenv *e, lval *v);
+lval *lvm_run(lenv *e, lcode *c);
+lval *lvm_exec(lenv *e, lcode *c, lval *fn);
+lval *lvm_call(lenv *e, lval **args, int n, lval **enter, lenv **env);
+lval *lvm_apply(lenv *e, lval **args, int n);
+int lvm_lazy(lval **top, int form, lval *expr, lenv *e);
+int lvm_test(lval **top);
+int lvm_and(lval **top, int or);
+lval *lvm_fold(lval *v, lenv *e);
+void lvm_reserve(void **buf, void *local, int *cap, int need, size_t size);
+#ifdef LISPY_JIT
+int ljit_ready(lval *f);
+lval *ljit_run(lcode *c, lenv *e, ljit_exit *x);
+lval *ljit_call(lenv *e, lval **args, int n, int tail, ljit_exit *x);
+void ljit_compile(lcode *c, lval *formals);
+void ljit_emit(ljit_buf *b, const void *bytes, int n);
+void ljit_u32(ljit_buf *b, uint32_t x);
+void ljit_u64(ljit_buf *b, uint64_t x);
+int ljit_jump(ljit_buf *b, const char *op, int n);
+void ljit_patch(ljit_buf *b, int at);
+void ljit_branch(ljit_buf *b, const char *op, int n, int to);
+ljit_stub *ljit_stub_new(ljit_buf *b, int k);
+void ljit_call_c(ljit_buf *b, uintptr_t f);
+void ljit_push(ljit_buf *b, int copy);
+void ljit_ret(ljit_buf *b);
+void ljit_emit_sym(ljit_buf *b, int k, int global);
+void ljit_emit_local(ljit_buf *b, int slot, int k);
+void ljit_emit_call(ljit_buf *b, int n, int tail);
+void ljit_check_err(ljit_buf *b);
+void ljit_unwind_jump(ljit_buf *b, const char *op, int n);
+lval *ljit_unwind(lval **base, lval **top);
+void ljit_emit_arith(ljit_buf *b, int op);
+void lstats_jit(void);
+#endif
+lval *lval_pop(lval *v, int i);
+lval *lval_take(lval *v, int i);
+lval *lval_unshare(lval *v);
+lval *lval_slice(lval *v, int start, int end);
+
+lval *builtin(lenv *e, lval *v, char *func);
+lval *builtin_add(lenv* e, lval* a);
+lval *builtin_sub(lenv* e, lval* a);
+lval *builtin_mul(lenv* e, lval* a);
+lval *builtin_div(lenv* e, lval* a);
+lval *builtin_op(lenv *e, lval *v, char *op);
+lval *builtin_head(lenv *e, lval *v);
+lval *builtin_tail(lenv *e, lval *v);
+lval *builtin_list(lenv *e, lval *v);
+lval *builtin_eval(lenv *e, lval *v);
+lval *builtin_join(lenv *e, lval *v);
+lval *builtin_cons(lenv *e, lval *v);
+lval *builtin_len(lenv *e, lval *v);
+lval *builtin_init(lenv *e, lval *v);
+lval *builtin_def(lenv *e, lval *v);
+lval *builtin_exit(lenv *e, lval *v);
+lval *builtin_printenv(lenv *e, lval *v);
+lval *builtin_lambda(lenv *e, lval *v);
+void lstats_mem(void);
+lstats_section *lstats_find(char *name);
+lval *builtin_stats(lenv *e, lval *v);
+void lstats_cache(void);
+void lstats_fold(void);
+lval *builtin_frames(lenv *e, lval *v);
+int builtin_takes_no_args(lval *f);
+
+lval *lval_join(lval *x, lval *y);
+lval *builtin_vec(lenv *e, lval *v);
+lval *builtin_nth(lenv *e, lval *v);
+int lval_is_list(lval *v);
+int lval_len(lval *v);
+lval *lval_resolve(lval *body, lval *formals, lenv *e);
+lval *lval_resolve_expr(lval *v, lval *formals, lenv *e);
+int lval_formal_slot(lval *formals, char *sym);
+lval *lval_fold(lenv *e, lval *v, lval *formals);
+lval *lval_fold_cells(lenv *e, lval *v, lval *formals);
+lval *lfold_form(lenv *e, lval *v, lval *formals);
+int lfold_defines(lenv *e, lval *v, lval *formals);
+int lval_is_folded(lval *v);
+lval *lfold_value(lval *v);
+int lfold_valid(lenv *e, lval *v);
+lval *builtin_folded(lenv *e, lval *v);
+lbuiltin lfold_builtin(lenv *e, lval *sym, lval *formals);
+int lval_is_literal(lval *v);
+long lval_nodes(lval *v);
+lval *lval_lookup(lenv *e, lval *k);
+
+void *lpool_alloc(size_t size);
+void lpool_free(void *p, size_t size);
+void lpool_reload(lpool_class *c, int i);
+void lpool_unload(lpool_class *c, int i);
+lval **lcell_resize(lval **cell, int old_cap, int new_cap);
+#ifdef LISPY_GC
+void *gc_alloc(size_t size);
+void gc_free(void *p, size_t size);
+int gc_in_nursery(void *p);
+void gc_safepoint(lenv *e);
+int gc_poll(lgc_roots *roots);
+void gc_collect(lenv *e, lgc_roots *roots);
+void gc_minor(lenv *e, lgc_roots *roots);
+void gc_minor_env(lenv *e);
+void gc_minor_roots(lgc_roots *r);
+void gc_major(lenv *e, lgc_roots *roots);
+void gc_mark_env(lenv *e);
+void gc_mark_roots(lgc_roots *r);
+lval *gc_evacuate(lval *v);
+void gc_scan(lval *v);
+void gc_mark(lval *v);
+void gc_release(lval *v);
+void gc_release_env(lenv *e);
+size_t gc_size(lval *v);
+lval *builtin_gc(lenv *e, lval *v);
+void lstats_gc(void);
+#endif
+lval *lval_arith(lval *x, lval *y, char *op);
+lval *lval_dbl_arith(lval *x, lval *y, char *op);
+double lval_to_double(lval *v);
+int lval_is_number(lval *v);
+lval *builtin_math(lenv *e, lval *v, char *func, void (*kernel)(double*, int));
+void lmath_sqrt(double *x, int n);
+void lmath_exp(double *x, int n);
+void lmath_log(double *x, int n);
+void lmath_sin(double *x, int n);
+void lmath_f64_scalar(double *x, long n, int fn);
+#ifdef __SSE2__
+__m128d lmath_exp_sse2(__m128d x);
+__m128d lmath_log_sse2(__m128d x);
+__m128d lmath_sin_sse2(__m128d x);
+void lmath_f64_sse2(double *x, long n, int fn);
+#endif
+#ifdef LSIMD_AVX2
+__m256d lmath_exp_avx2(__m256d x);
+__m256d lmath_log_avx2(__m256d x);
+__m256d lmath_sin_avx2(__m256d x);
+void lmath_f64_avx2(double *x, long n, int fn);
+#endif
+lval *lval_arr(int elem, int len);
+lval *builtin_array(lenv *e, lval *v);
+int larr_non_number(lval *x);
+lval *larr_from(lval *x, int elem);
+lval *builtin_range(lenv *e, lval *v);
+lval *larr_reduce(lval *v, char *func, int op);
+lval *builtin_sum(lenv *e, lval *v);
+lval *builtin_amin(lenv *e, lval *v);
+lval *builtin_amax(lenv *e, lval *v);
+lval *builtin_dot(lenv *e, lval *v);
+double *larr_to_f64(lval *v, double *one);
+lval *larr_result(lval *x, lval *y, int elem, int len);
+lval *lval_arr_arith(lval *x, lval *y, char *op);
+lval *larr_check(lval *x, lval *y, char *op);
+int larr_has_zero(lval *v);
+int larr_is_int(lval *v);
+lval *builtin_ord(lenv *e, lval *v, char *op);
+lval *builtin_lt(lenv *e, lval *v);
+lval *builtin_gt(lenv *e, lval *v);
+lval *builtin_le(lenv *e, lval *v);
+lval *builtin_ge(lenv *e, lval *v);
+lval *builtin_eq(lenv *e, lval *v);
+lval *builtin_ne(lenv *e, lval *v);
+lval *builtin_if(lenv *e, lval *v);
+lval *builtin_and(lenv *e, lval *v);
+lval *builtin_or(lenv *e, lval *v);
+lval *builtin_logic(lenv *e, lval *v, int or);
+lval *builtin_cond(lenv *e, lval *v);
+void lloop_init(lloop *l, lenv *e, lval *vars, lval *body);
+void lloop_set(lloop *l, lval *x);
+lval *lloop_run(lloop *l);
+void lloop_free(lloop *l);
+lval *builtin_while(lenv *e, lval *v);
+lval *builtin_dotimes(lenv *e, lval *v);
+lval *builtin_foreach(lenv *e, lval *v);
+lval *lval_apply(lenv *e, lval *f, lval *x, lval *y);
+lval *lhof_item(lval *l, int i);
+lval *lhof_out(int n);
+lval *lhof_result(lval *l, lval *r, char *func);
+lval *builtin_map(lenv *e, lval *v);
+lval *builtin_filter(lenv *e, lval *v);
+lval *builtin_foldl(lenv *e, lval *v);
+lval *builtin_foldr(lenv *e, lval *v);
+lval *builtin_fold(lenv *e, lval *v, int right);
+lval *builtin_reduce(lenv *e, lval *v);
+int lpar_start(void);
+void *lpar_worker(void *arg);
+void lpar_run_part(lpar_job *j, int p);
+lval *lpar_item(lval *l, int i);
+void *lpar_map_get(lpar_map *m, void *of);
+void lpar_map_put(lpar_map *m, void *of, void *to, int kind);
+void lpar_map_del(lpar_map *m);
+lval *lpar_copy(lval *v);
+lenv *lpar_copy_env(lenv *e);
+lvec *lpar_copy_vec(lvec *t);
+lcode *lpar_copy_code(lcode *c);
+int lpar_import(lenv *e, lval *k);
+void lpar_rebind(lval *v, lpar_map *seen);
+void lpar_rebind_env(lenv *e, lpar_map *seen);
+void lpar_rebind_vec(lvec *t, lpar_map *seen);
+lval *lpar_run(lpar_job *j);
+lval *lpar_seq(lenv *e, lval *v, lbuiltin f);
+int lpar_parts(lval *v);
+lval *builtin_pmap(lenv *e, lval *v);
+lval *builtin_preduce(lenv *e, lval *v);
+void lval_arr_print(lval *v);
+double lsimd_op_f64(double a, double b, int op);
+int64_t lsimd_op_i64(int64_t a, int64_t b, int op);
+int lsimd_cmp_f64(double a, double b, int op);
+int lsimd_cmp_i64(int64_t a, int64_t b, int op);
+double lsimd_reduce_f64_scalar(double *x, long n, int op);
+int64_t lsimd_reduce_i64_scalar(int64_t *x, long n, int op);
+double lsimd_dot_f64_scalar(double *a, double *b, long n);
+int64_t lsimd_dot_i64_scalar(int64_t *a, int64_t *b, long n);
+void lsimd_map_f64_scalar(double *r, double *a, double *b, long n, int op, int as, int bs);
+void lsimd_map_i64_scalar(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+void lsimd_cmp_f64_scalar(int64_t *r, double *a, double *b, long n, int op, int as, int bs);
+void lsimd_cmp_i64_scalar(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+#ifdef __SSE2__
+double lsimd_reduce_f64_sse2(double *x, long n, int op);
+int64_t lsimd_reduce_i64_sse2(int64_t *x, long n, int op);
+double lsimd_dot_f64_sse2(double *a, double *b, long n);
+void lsimd_map_f64_sse2(double *r, double *a, double *b, long n, int op, int as, int bs);
+void lsimd_map_i64_sse2(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+void lsimd_cmp_f64_sse2(int64_t *r, double *a, double *b, long n, int op, int as, int bs);
+#endif
+#ifdef LSIMD_AVX2
+double lsimd_reduce_f64_avx2(double *x, long n, int op);
+int64_t lsimd_reduce_i64_avx2(int64_t *x, long n, int op);
+double lsimd_dot_f64_avx2(double *a, double *b, long n);
+int64_t lsimd_dot_i64_avx2(int64_t *a, int64_t *b, long n);
+void lsimd_map_f64_avx2(double *r, double *a, double *b, long n, int op, int as, int bs);
+void lsimd_map_i64_avx2(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+void lsimd_cmp_f64_avx2(int64_t *r, double *a, double *b, long n, int op, int as, int bs);
+void lsimd_cmp_i64_avx2(int64_t *r, int64_t *a, int64_t *b, long n, int op, int as, int bs);
+#endif
+void lsimd_init(void);
+lval *lval_big_arith(lval *x, lval *y, char *op);
+lval *lval_int(int sign, uint64_t *limb, int limbs);
+void lint_of(lint *x, lval *v);
+int lint_cmp(lint *x, lint *y);
+lval *lint_add(lint *x, lint *y, int ysign);
+lval *lint_mul(lint *x, lint *y);
+lval *lint_divmod(lint *x, lint *y, int mod);
+lval *lint_pow(lint *x, long e);
+int lnat_cmp(uint64_t *a, int an, uint64_t *b, int bn);
+int lnat_add(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn);
+void lnat_add_in(uint64_t *r, int rn, uint64_t *b, int bn);
+int lnat_sub(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn);
+int lnat_trim(uint64_t *a, int an);
+void lnat_mul_school(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn);
+void lnat_karatsuba(uint64_t *r, uint64_t *a, uint64_t *b, int n);
+void lnat_mul(uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn);
+int lnat_mul_1_add(uint64_t *r, int rn, uint64_t m, uint64_t add);
+uint64_t lnat_divmod_1(uint64_t *q, uint64_t *a, int an, uint64_t d);
+void lnat_divmod(uint64_t *q, uint64_t *r, uint64_t *a, int an, uint64_t *b, int bn);
+char *lnat_decimal(char *s, uint64_t *a, int an, int width, uint64_t **pow, int *pown, int k);
+lval *lval_read_big(char *s);
+char *lval_big_string(lval *v);
+void lval_big_print(lval *v);
+lvec *lvec_alloc(int height, int count);
+lvec *lvec_copy(lvec *t);
+void lvec_del(lvec *t);
+int lvec_count(lvec *t);
+int lvec_height(lvec *t);
+lvec *lvec_leaf(lval **items, int count);
+lvec *lvec_node(lvec *l, lvec *r);
+lvec *lvec_balance(lvec *l, lvec *r);
+lvec *lvec_join(lvec *l, lvec *r);
+void lvec_split(lvec *t, int i, lvec **l, lvec **r);
+lval *lvec_get(lvec *t, int i);
+lvec *lvec_from_cells(lvec *t, lval **cell, int count);
+void lvec_append_to(lvec *t, lval *q);
+void lvec_print(lenv *e, lvec *t, int *first);
+lval *lval_vec(lvec *t);
+lval *lval_vec_from(lval *q);
+lval *lval_vec_to_expr(lval *v, int type);
+#ifdef LISPY_GC
+void lvec_scan(lvec *t);
+void lvec_mark(lvec *t);
+void lvec_release(lvec *t);
+#endif
+unsigned long lsym_hash(const char *s);
+char *lsym_find(lsym_table *t, const char *s, unsigned long hash);
+char *lsym_intern(const char *s);
+lval *lval_alloc(int type, size_t size);
+size_t lval_size(lval *v);
+lval *lval_dbl(double x);
+void lval_dbl_print(double x);
+lval *lval_err(int code, char *fmt, ...);
+char *lerr_format(lval *v, char *buf, int size);
+lval *lval_sym(char *s);
+lval *lval_sexpr(void);
+lval *lval_qexpr(void);
+lval *lval_fun(lbuiltin func);
+lval *lval_lambda(lval *formals, lval *body, lenv *env);
+
+lenv *lenv_new(void);
+void lenv_del(lenv *e);
+void lenv_free(lenv *e);
+int lenv_find(lenv *e, char *sym);
+int lenv_probe(int *index, int mask, char **syms, char *sym, unsigned long hash);
+void lenv_index_add(int *index, int mask, unsigned long hash, int pos);
+void lenv_index_grow(lenv *e);
+void lenv_migrate(lenv *e, int steps);
+lval *lenv_get(lenv *e, lval *k);
+void lenv_put(lenv *e, lval *k, lval *v);
+void lenv_append(lenv *e, char *sym, lval *v);
+void lenv_def(lenv *e, lval *k, lval *v);
+void lenv_add_builtin(lenv *e, char *name, lbuiltin func);
+void lenv_add_builtins(lenv *e);
+
+void lval_print(lenv *e, lval *v);
+void lval_expr_print(lenv *e, lval *v, char open, char close);
+void lval_println(lenv *e, lval *v);
+lval *lval_add(lval *v, lval *x);
+lval *lval_read_num(mpc_ast_t *t);
+lval *lval_read(mpc_ast_t *t);
+void lval_free(lval *v);
+
+#ifdef LISPY_BENCH
+int bench_run(int argc, char **argv);
+#endif
+#ifdef LISPY_AOT
+lval *laot_expr(int open, int n, ...);
+lbuiltin laot_builtin(lenv *e, char *name);
+int laot_direct(lval **args, int n, lbuiltin f);
+lval *laot_args(lval **args, int n);
+int laot_err(lval *v);
+void laot_drop(lval **args, int n);
+lval *laot_call(lenv *e, lval **args, int n);
+int laot_run(void);
+#endif
+#ifdef LISPY_COMPILER
+int lispyc_run(int argc, char **argv);
+int lispyc_exec(char **args);
+int lispyc_file(char *path, FILE *out);
+void lispyc_form(lispyc *c, lval *v);
+void lispyc_expr(lispyc *c, lval *v, char *dst);
+void lispyc_special(lispyc *c, lval *v, int form, char *dst);
+void lispyc_check(lispyc *c, char *dst);
+void lispyc_data(FILE *out, lval *v);
+void lispyc_str(FILE *out, char *s);
+int lispyc_find(lenv *names, lval *k);
+#endif
+
+// Inline functions
+// Reference counts and fixnums are used by every file. The definitions
+// here are inline ones, so calls from files other than parsing.c don't
+// cost a call. parsing.c has the external definitions.
+
+// Get a new reference to "v". Values are shared between all their
+// references, use lval_unshare before modifying one in place.
+inline lval *lval_copy(lval *v){
+    // Fixnums are immutable values, nothing to count
+    if(!LVAL_IS_FIXNUM(v)) v->refs++;
+    return v;
+}
+
+inline void lval_del(lval *v) {
+    // Fixnums are not allocated
+    if(LVAL_IS_FIXNUM(v)) return;
+
+    // Only free the value when the last reference is gone
+    if(--v->refs > 0) return;
+    lval_free(v);
+}
+
+inline lval *lval_num(long x){
+    // Small numbers don't need any memory
+    if(x >= LVAL_FIXNUM_MIN && x <= LVAL_FIXNUM_MAX) return LVAL_FIXNUM(x);
+
+    lval *v = lval_alloc(LVAL_NUM, LVAL_SIZEOF(num));
+    v->num = x;
+    return v;
+}
+
+inline long lval_num_value(lval *v){
+    if(LVAL_IS_FIXNUM(v)) return LVAL_FIXNUM_VALUE(v);
+    return v->num;
+}
+
+// Only one reference and, with the collector, not old, so "v" can be
+// modified in place
+inline int lval_unique(lval *v){
+#ifdef LISPY_GC
+    return v->refs == 1 && v->gc == GC_YOUNG;
+#else
+    return v->refs == 1;
+#endif
+}
+
+// New reference to "e". The global environment, the one without a
+// parent, isn't counted: lambdas defined in it are bound in it, so it
+// would always be part of a cycle. It outlives everything that refers to
+// it and is deleted by its owner with lenv_del.
+inline lenv *lenv_ref(lenv *e){
+    if(e->par) e->refs++;
+    return e;
+}
+
+// Drop a reference to "e", the last one deletes it
+inline void lenv_unref(lenv *e){
+    if(e->par && --e->refs == 0) lenv_del(e);
+}
+
+// Grammar of the language, the benchmarks also read Lispy with it
+#define LISPY_GRAMMAR "\
+    number   : /-?[0-9]+(\\.[0-9]+)?([eE][-+]?[0-9]+)?/ ; \
+    symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%^]+/ ; \
+    sexpr    : '(' <expr>* ')' ; \
+    qexpr    : '{' <expr>* '}' ; \
+    vector   : '[' <expr>* ']' ; \
+    expr     : <number> | <symbol> | <sexpr> | <qexpr> | <vector> ; \
+    lispy    : /^/ <expr>* /$/ ; \
+"
+
+#endif
@@ -0,0 +1,430 @@
+// lispyc, see "Ahead-of-time compilation" in lispy.h
+#include "lispy.h"
+
+#ifdef LISPY_COMPILER
+
+// Compile the .lspy file named in the arguments into a program, or only
+// write its C with "-S"
+int lispyc_run(int argc, char **argv){
+    char *in = NULL;
+    char *out = NULL;
+    int only_c = 0;
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-S") == 0) only_c = 1;
+        else if(strcmp(argv[i], "-o") == 0 && i + 1 < argc) out = argv[++i];
+        else in = argv[i];
+    }
+    if(!in) {
+        fprintf(stderr, "usage: %s [-S] [-o program] file.lspy\n", argv[0]);
+        return 2;
+    }
+
+    // The program is named after the file without its extension
+    char name[4096];
+    snprintf(name, sizeof(name), "%s", out ? out : in);
+    char *dot = strrchr(name, '.');
+    char *slash = strrchr(name, '/');
+    if(!out && dot && (!slash || dot > slash)) *dot = '\0';
+    if(strcmp(name, in) == 0) {
+        fprintf(stderr, "lispyc: the program would replace %s, name it with -o\n", in);
+        return 2;
+    }
+
+    char c_path[4100];
+    snprintf(c_path, sizeof(c_path), "%s.c", name);
+    FILE *f = fopen(c_path, "w");
+    if(!f) {
+        fprintf(stderr, "lispyc: can't write %s\n", c_path);
+        return 1;
+    }
+    int ok = lispyc_file(in, f);
+    fclose(f);
+    if(!ok) {
+        remove(c_path);
+        return 1;
+    }
+    if(only_c) return 0;
+
+    // lispyrt.o and mpc.o are next to lispyc, unless LISPY_RT says where
+    char dir[4096];
+    char *rt = getenv("LISPY_RT");
+    snprintf(dir, sizeof(dir), "%s", rt ? rt : argv[0]);
+    if(!rt) {
+        char *slash = strrchr(dir, '/');
+        if(slash) *slash = '\0';
+        else strcpy(dir, ".");
+    }
+
+    // CC and CFLAGS are used like make does, split into words at spaces.
+    // Big files compile much faster with CFLAGS=-O0, most of the time is
+    // spent in lispyrt.o anyway. The compiler is run without a shell, so
+    // the paths are passed as they are.
+    char *cc = getenv("CC");
+    char *cflags = getenv("CFLAGS");
+    char words[8192];
+    snprintf(words, sizeof(words), "%s -std=c99 %s", cc ? cc : "cc", cflags ? cflags : "-O2");
+    char rt_path[4200];
+    char mpc_path[4200];
+    snprintf(rt_path, sizeof(rt_path), "%s/lispyrt.o", dir);
+    snprintf(mpc_path, sizeof(mpc_path), "%s/mpc.o", dir);
+
+    char *args[sizeof(words) / 2 + 16];
+    int n = 0;
+    for(char *w = strtok(words, " \t"); w; w = strtok(NULL, " \t")) args[n++] = w;
+    char *rest[] = { "-o", name, c_path, rt_path, mpc_path, "-lm", "-pthread", NULL };
+    for(int i = 0; i < (int)(sizeof(rest) / sizeof(rest[0])); i++) args[n++] = rest[i];
+    return lispyc_exec(args);
+}
+
+// Run the program args[0] with the NULL terminated "args" and wait for it.
+// Returns 0 when it exits with 0, otherwise 1.
+int lispyc_exec(char **args){
+    pid_t pid = fork();
+    if(pid < 0) {
+        perror("lispyc");
+        return 1;
+    }
+    if(pid == 0) {
+        execvp(args[0], args);
+        fprintf(stderr, "lispyc: can't run %s\n", args[0]);
+        _exit(127);
+    }
+    int status;
+    if(waitpid(pid, &status, 0) < 0) return 1;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : 1;
+}
+
+// Write the C of the program for the file at "path" to "out". Returns 0
+// when it can't be read or a line doesn't parse.
+int lispyc_file(char *path, FILE *out){
+    FILE *in = fopen(path, "rb");
+    if(!in) {
+        fprintf(stderr, "lispyc: can't open %s\n", path);
+        return 0;
+    }
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    rewind(in);
+    char *text = malloc(size + 1);
+    text[fread(text, 1, size, in)] = '\0';
+    fclose(in);
+
+    mpc_parser_t* Number = mpc_new("number");
+    mpc_parser_t* Symbol = mpc_new("symbol");
+    mpc_parser_t* Sexpr  = mpc_new("sexpr");
+    mpc_parser_t* Qexpr  = mpc_new("qexpr");
+    mpc_parser_t* Vector = mpc_new("vector");
+    mpc_parser_t* Expr   = mpc_new("expr");
+    mpc_parser_t* Lispy  = mpc_new("lispy");
+    mpca_lang(MPC_LANG_DEFAULT, LISPY_GRAMMAR, Number, Symbol, Sexpr, Qexpr, Vector, Expr, Lispy);
+
+    // The form functions are written first, the tables they use are only
+    // known at the end
+    lispyc c = { tmpfile(), lenv_new(), lenv_new(), lval_qexpr(), lenv_new(), 0, NULL, 0, 0 };
+    lenv_add_builtins(c.env);
+
+    // Every line is a form, like a line typed at the prompt
+    int ok = 1;
+    int forms = 0;
+    int line = 1;
+    for(char *s = text; *s; line++) {
+        char *end = strchr(s, '\n');
+        if(end) *end = '\0';
+
+        char where[4200];
+        snprintf(where, sizeof(where), "%s line %i", path, line);
+        mpc_result_t r;
+        if(mpc_parse(where, s, Lispy, &r)) {
+            lval *v = lval_read(r.output);
+            mpc_ast_delete(r.output);
+            fprintf(c.out, "\nstatic lval *form_%i(lenv *e){\n", forms++);
+            lispyc_form(&c, v);
+            lval_del(v);
+        } else {
+            mpc_err_print_to(r.error, stderr);
+            mpc_err_delete(r.error);
+            ok = 0;
+        }
+
+        if(!end) break;
+        s = end + 1;
+    }
+
+    if(ok) {
+        fprintf(out, "// Generated by lispyc from %s, link with lispyrt.o and mpc.o\n", path);
+        fputs("#include <stddef.h>\n#include <limits.h>\n\n", out);
+        fputs("typedef struct lval lval;\n", out);
+        fputs("typedef struct lenv lenv;\n", out);
+        fputs("typedef lval*(*lbuiltin)(lenv*, lval*);\n\n", out);
+        fputs("lval *lval_num(long x);\n", out);
+        fputs("lval *lval_dbl(double x);\n", out);
+        fputs("lval *lval_err(int code, char *fmt, ...);\n", out);
+        fputs("lval *lval_sym(char *s);\n", out);
+        fputs("lval *lval_sexpr(void);\n", out);
+        fputs("lval *lval_read_big(char *s);\n", out);
+        fputs("lval *lval_vec_from(lval *q);\n", out);
+        fputs("lval *lval_copy(lval *v);\n", out);
+        fputs("lval *lval_lookup(lenv *e, lval *k);\n", out);
+        fputs("lval *laot_expr(int open, int n, ...);\n", out);
+        fputs("lbuiltin laot_builtin(lenv *e, char *name);\n", out);
+        fputs("int laot_direct(lval **args, int n, lbuiltin f);\n", out);
+        fputs("lval *laot_args(lval **args, int n);\n", out);
+        fputs("int laot_err(lval *v);\n", out);
+        fputs("void laot_drop(lval **args, int n);\n", out);
+        fputs("lval *laot_call(lenv *e, lval **args, int n);\n", out);
+        fputs("int lvm_lazy(lval **top, int form, lval *expr, lenv *e);\n", out);
+        fputs("int lvm_test(lval **top);\n", out);
+        fputs("int lvm_and(lval **top, int or);\n\n", out);
+
+        // Arrays can't be empty
+        fprintf(out, "static lval *S[%i];\n", c.syms->count + 1);
+        fprintf(out, "static lval *K[%i];\n", c.consts->count + 1);
+        fprintf(out, "static lbuiltin B[%i];\n", c.builtins->count + 1);
+
+        rewind(c.out);
+        char buf[4096];
+        size_t n;
+        while((n = fread(buf, 1, sizeof(buf), c.out)) > 0) fwrite(buf, 1, n, out);
+
+        fputs("\nlval *(*laot_forms[])(lenv *e) = {\n", out);
+        for(int i = 0; i < forms; i++) fprintf(out, "    form_%i,\n", i);
+        fputs("    NULL\n};\n", out);
+
+        fputs("\nvoid laot_init(lenv *e){\n", out);
+        for(int i = 0; i < c.syms->count; i++) {
+            fprintf(out, "    S[%i] = lval_sym(", i);
+            lispyc_str(out, c.syms->syms[i]);
+            fputs(");\n", out);
+        }
+        for(int i = 0; i < c.builtins->count; i++) {
+            fprintf(out, "    B[%i] = laot_builtin(e, ", i);
+            lispyc_str(out, c.builtins->syms[i]);
+            fputs(");\n", out);
+        }
+        for(int i = 0; i < c.consts->count; i++) {
+            fprintf(out, "    K[%i] = ", i);
+            lispyc_data(out, c.consts->cell[i]);
+            fputs(";\n", out);
+        }
+        fputs("}\n", out);
+    }
+
+    fclose(c.out);
+    lenv_del(c.env);
+    lenv_del(c.syms);
+    lval_del(c.consts);
+    lenv_del(c.builtins);
+    free(c.live);
+    mpc_cleanup(7, Number, Symbol, Sexpr, Qexpr, Vector, Expr, Lispy);
+    free(text);
+    return ok;
+}
+
+// Write the body of the function for the form "v"
+void lispyc_form(lispyc *c, lval *v){
+    c->arrays = 0;
+    fputs("    lval *r;\n", c->out);
+    lispyc_expr(c, v, "r");
+    fputs("    return r;\n}\n", c->out);
+}
+
+// Write the statements evaluating "v" into the C lvalue "dst"
+void lispyc_expr(lispyc *c, lval *v, char *dst){
+    FILE *out = c->out;
+    switch(LVAL_TYPE(v)) {
+        case LVAL_NUM: {
+            long x = lval_num_value(v);
+            if(x == LONG_MIN) fprintf(out, "    %s = lval_num(LONG_MIN);\n", dst);
+            else fprintf(out, "    %s = lval_num(%liL);\n", dst, x);
+            return;
+        }
+
+        case LVAL_SYM:
+            fprintf(out, "    %s = lval_lookup(e, S[%i]);\n", dst, lispyc_find(c->syms, v));
+            lispyc_check(c, dst);
+            return;
+
+        case LVAL_SEXPR:
+            break;
+
+        default:
+            // Everything else evaluates to itself and is built once
+            lval_add(c->consts, lval_copy(v));
+            fprintf(out, "    %s = lval_copy(K[%i]);\n", dst, c->consts->count - 1);
+            return;
+    }
+
+    if(v->count == 0) {
+        fprintf(out, "    %s = lval_sexpr();\n", dst);
+        return;
+    }
+    int form = lcomp_form_of(v);
+    if(form != LFORM_NONE) {
+        lispyc_special(c, v, form, dst);
+        lispyc_check(c, dst);
+        return;
+    }
+
+    // The children are evaluated in order into an array, like on
+    // lvm_exec's stack
+    int a = c->arrays++;
+    int n = v->count;
+    fprintf(out, "    lval *a%i[%i];\n", a, n);
+    if(c->nlive + 2 > c->live_cap) {
+        c->live_cap = c->live_cap ? c->live_cap * 2 : 32;
+        c->live = realloc(c->live, sizeof(int) * c->live_cap);
+    }
+    int at = c->nlive;
+    c->live[c->nlive++] = a;
+    c->live[c->nlive++] = 0;
+    for(int i = 0; i < n; i++) {
+        char arg[32];
+        snprintf(arg, sizeof(arg), "a%i[%i]", a, i);
+        c->live[at + 1] = i;
+        lispyc_expr(c, v->cell[i], arg);
+    }
+    c->nlive -= 2;
+
+    // A head naming a builtin is called directly while it is still bound
+    // to it, anything else is applied like lvm_exec does
+    lval *h = v->cell[0];
+    int i = n > 1 && LVAL_TYPE(h) == LVAL_SYM ? lenv_find(c->env, h->sym) : -1;
+    if(i >= 0 && LVAL_TYPE(c->env->vals[i]) == LVAL_FUN && c->env->vals[i]->builtin) {
+        int b = lispyc_find(c->builtins, h);
+        fprintf(out, "    %s = laot_direct(a%i, %i, B[%i]) ? B[%i](e, laot_args(a%i, %i)) : laot_call(e, a%i, %i);\n",
+                dst, a, n, b, b, a, n, a, n);
+    } else {
+        fprintf(out, "    %s = laot_call(e, a%i, %i);\n", dst, a, n);
+    }
+    lispyc_check(c, dst);
+}
+
+// Write the statements returning "dst" from the form if it is an error,
+// after releasing the values of the arrays being filled
+void lispyc_check(lispyc *c, char *dst){
+    fprintf(c->out, "    if(laot_err(%s)) {\n", dst);
+    for(int i = 0; i < c->nlive; i += 2) {
+        if(c->live[i + 1] > 0) fprintf(c->out, "    laot_drop(a%i, %i);\n", c->live[i], c->live[i + 1]);
+    }
+    fprintf(c->out, "    return %s;\n    }\n", dst);
+}
+
+// Write the statements of the special form "form" called by "v" into
+// "dst", they branch like lvm_exec does. "v" itself is kept for when the
+// name of the form is bound to something else, see lvm_lazy.
+void lispyc_special(lispyc *c, lval *v, int form, char *dst){
+    FILE *out = c->out;
+    int a = c->arrays++;
+    char top[32];
+    snprintf(top, sizeof(top), "a%i[0]", a);
+    lval_add(c->consts, lval_copy(v));
+    fprintf(out, "    lval *a%i[1];\n    int t%i;\n", a, a);
+    lispyc_expr(c, v->cell[0], top);
+    fprintf(out, "    if(!lvm_lazy(a%i, %i, K[%i], e)) {\n", a, form, c->consts->count - 1);
+    fprintf(out, "    %s = a%i[0];\n", dst, a);
+    int closes = 1;
+
+    if(form == LFORM_AND || form == LFORM_OR) {
+        fputs("    } else {\n", out);
+        for(int i = 1; i < v->count; i++) {
+            lispyc_expr(c, v->cell[i], dst);
+            if(i == v->count - 1) break;
+            fprintf(out, "    if(lvm_and(&%s, %i) > 0) {\n", dst, form == LFORM_OR);
+            closes++;
+        }
+    } else {
+        // "if" is a "cond" of one clause
+        int i = 1;
+        for(; i + 1 < v->count && (form == LFORM_COND || i == 1); i += 2) {
+            fputs("    } else {\n", out);
+            lispyc_expr(c, v->cell[i], top);
+            fprintf(out, "    t%i = lvm_test(a%i);\n", a, a);
+            fprintf(out, "    if(t%i < 0) {\n    %s = a%i[0];\n    } else if(t%i) {\n", a, dst, a, a);
+            lispyc_expr(c, v->cell[i + 1], dst);
+            closes++;
+        }
+        fputs("    } else {\n", out);
+        if(i < v->count) lispyc_expr(c, v->cell[i], dst);
+        else fprintf(out, "    %s = lval_sexpr();\n", dst);
+    }
+    while(closes--) fputs("    }\n", out);
+}
+
+// Write a C expression building the value "v", which was read
+void lispyc_data(FILE *out, lval *v){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_NUM: {
+            long x = lval_num_value(v);
+            if(x == LONG_MIN) fputs("lval_num(LONG_MIN)", out);
+            else fprintf(out, "lval_num(%liL)", x);
+            break;
+        }
+
+        case LVAL_DBL:
+            // Hexadecimal floats are exact
+            fprintf(out, "lval_dbl(%a)", v->dbl);
+            break;
+
+        case LVAL_BIG: {
+            char *s = lval_big_string(v);
+            fprintf(out, "lval_read_big(\"%s\")", s);
+            free(s);
+            break;
+        }
+
+        case LVAL_ERR: {
+            char msg[LERR_MSG_MAX];
+            fprintf(out, "lval_err(%i, \"%%s\", ", v->errcode);
+            lispyc_str(out, lerr_format(v, msg, sizeof(msg)));
+            putc(')', out);
+            break;
+        }
+
+        case LVAL_SYM:
+            fputs("lval_sym(", out);
+            lispyc_str(out, v->sym);
+            putc(')', out);
+            break;
+
+        case LVAL_VEC: {
+            lval *q = lval_vec_to_expr(lval_copy(v), LVAL_QEXPR);
+            fputs("lval_vec_from(", out);
+            lispyc_data(out, q);
+            putc(')', out);
+            lval_del(q);
+            break;
+        }
+
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            fprintf(out, "laot_expr('%c', %i", v->type == LVAL_SEXPR ? '(' : '{', v->count);
+            for(int i = 0; i < v->count; i++) {
+                fputs(", ", out);
+                lispyc_data(out, v->cell[i]);
+            }
+            putc(')', out);
+            break;
+    }
+}
+
+// Write "s" as a C string literal
+void lispyc_str(FILE *out, char *s){
+    putc('"', out);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') putc('\\', out);
+        if(*s == '\n') fputs("\\n", out);
+        else putc(*s, out);
+    }
+    putc('"', out);
+}
+
+// Index of the symbol "k" in "names", added if it isn't there yet.
+// Bindings are only ever appended, so the index stays the same.
+int lispyc_find(lenv *names, lval *k){
+    int i = lenv_find(names, k->sym);
+    if(i >= 0) return i;
+    lenv_put(names, k, k);
+    return names->count - 1;
+}
+
+#endif
@@ -0,0 +1,272 @@
+// Math functions of floats and their kernels, see "Numeric arrays" in
+// lispy.h
+#include "lispy.h"
+
+// Math function of a number, or of every number of a list. The numbers of
+// a list are gathered in one array so "kernel" runs over all of them at
+// once.
+lval *builtin_math(lenv *e, lval *v, char *func, void (*kernel)(double*, int)){
+    LASSERT_NUM(func, v, 1);
+    lval *x = v->cell[0];
+    LASSERT(v, lval_is_number(x) || lval_is_list(x) || LVAL_TYPE(x) == LVAL_ARR, LERR_TYPE, "Function '%s' passed incorrect type. Got %s, expected a number, a list or an array",
+            func, ltype_name(LVAL_TYPE(x)));
+
+    if(lval_is_number(x)) {
+        double d = lval_to_double(x);
+        kernel(&d, 1);
+        lval_del(v);
+        return lval_dbl(d);
+    }
+
+    // Arrays give a float array
+    if(LVAL_TYPE(x) == LVAL_ARR) {
+        lval *r = larr_result(x, x, LARR_DBL, x->len);
+        double one;
+        double *d = larr_to_f64(x, &one);
+        if(d != LVAL_F64(r)) memcpy(LVAL_F64(r), d, sizeof(double) * x->len);
+        if(d != LVAL_F64(x)) free(d);
+        kernel(LVAL_F64(r), r->len);
+        lval_del(v);
+        return r;
+    }
+
+    // Vectors are done as a Q-Expression and converted back
+    int vec = x->type == LVAL_VEC;
+    x = lval_take(v, 0);
+    if(vec) x = lval_vec_to_expr(x, LVAL_QEXPR);
+
+    for(int i = 0; i < x->count; i++) {
+        if(!lval_is_number(x->cell[i])) {
+            lval *err = lval_err(LERR_TYPE, "Function '%s' passed a list with a %s, expected only numbers", func, ltype_name(LVAL_TYPE(x->cell[i])));
+            lval_del(x);
+            return err;
+        }
+    }
+
+    double *d = malloc(sizeof(double) * ((unsigned)x->count + 1));
+    for(int i = 0; i < x->count; i++) d[i] = lval_to_double(x->cell[i]);
+    kernel(d, x->count);
+
+    // A list nobody else has keeps its cells, its floats are overwritten
+    lval *r;
+    if(lval_unique(x)) {
+        for(int i = 0; i < x->count; i++) {
+            lval *c = x->cell[i];
+            if(LVAL_TYPE(c) == LVAL_DBL && lval_unique(c)) { c->dbl = d[i]; continue; }
+            lval_del(c);
+            x->cell[i] = lval_dbl(d[i]);
+        }
+        r = x;
+    } else {
+        r = lval_qexpr();
+        for(int i = 0; i < x->count; i++) lval_add(r, lval_dbl(d[i]));
+        lval_del(x);
+    }
+    free(d);
+
+    return vec ? lval_vec_from(r) : r;
+}
+
+// Math kernels, in place over "n" doubles. They are lsimd kernels: with
+// SSE2 or AVX2 they run on two or four values at a time. sqrt is one
+// instruction, exp, log and sin are the fdlibm algorithms (the same range
+// reduction and polynomials) written with vector operations, and are within
+// two ulps of libm. There is no FMA, so SSE2 and AVX2 give the same bits.
+// Values outside the range a kernel reduces exactly, NaN and infinities
+// included, go to libm. The scalar table is all libm. A single number goes
+// through the same kernel as a list, so both give the same result.
+void lmath_sqrt(double *x, int n){ lsimd->math_f64(x, n, LMATH_SQRT); }
+void lmath_exp(double *x, int n){ lsimd->math_f64(x, n, LMATH_EXP); }
+void lmath_log(double *x, int n){ lsimd->math_f64(x, n, LMATH_LOG); }
+void lmath_sin(double *x, int n){ lsimd->math_f64(x, n, LMATH_SIN); }
+
+void lmath_f64_scalar(double *x, long n, int fn){
+    double (*libm)(double) = fn == LMATH_SQRT ? sqrt : fn == LMATH_EXP ? exp : fn == LMATH_LOG ? log : sin;
+    for(long i = 0; i < n; i++) x[i] = libm(x[i]);
+}
+
+#ifdef __SSE2__
+
+// The kernels below are written once for SSE2 (p is _mm_, w is 128) and
+// AVX2 (_mm256_, 256) vectors. "V" and "VI" are the double and integer
+// vector types.
+#define LMATH_CMP_mm_(op, a, b) _mm_cmp##op##_pd(a, b)
+#define LMATH_CMP_mm256_(op, a, b) _mm256_cmp_pd(a, b, LMATH_CMP_##op)
+#define LMATH_CMP_ge _CMP_GE_OQ
+#define LMATH_CMP_le _CMP_LE_OQ
+#define LMATH_CMP_lt _CMP_LT_OQ
+#define LMATH_BITS(p, w, c) p##castsi##w##_pd(p##set1_epi64x(c))
+
+// Adding 1.5 * 2^52 rounds a double to an integer, which is then in the
+// low bits of the sum
+#define LMATH_ROUND 6755399441055744.0
+
+#define LMATH_LN2_HI 6.93147180369123816490e-01
+#define LMATH_LN2_LO 1.90821492927058770002e-10
+
+// exp of doubles in [-708, 708]: x = k ln2 + r with |r| <= ln2 / 2, exp(r)
+// from a rational approximation, then scaled by 2^k
+#define LMATH_EXP_BODY(p, w, V, VI) { \
+    V kd = p##add_pd(p##mul_pd(x, p##set1_pd(1.44269504088896338700e+00)), p##set1_pd(LMATH_ROUND)); \
+    VI k = p##sub_epi64(p##castpd_si##w(kd), p##castpd_si##w(p##set1_pd(LMATH_ROUND))); \
+    kd = p##sub_pd(kd, p##set1_pd(LMATH_ROUND)); \
+    V hi = p##sub_pd(x, p##mul_pd(kd, p##set1_pd(LMATH_LN2_HI))); \
+    V lo = p##mul_pd(kd, p##set1_pd(LMATH_LN2_LO)); \
+    V r = p##sub_pd(hi, lo); \
+    V t = p##mul_pd(r, r); \
+    V c = p##add_pd(p##set1_pd(-1.65339022054652515390e-06), p##mul_pd(t, p##set1_pd(4.13813679705723846039e-08))); \
+    c = p##add_pd(p##set1_pd(6.61375632143793436117e-05), p##mul_pd(t, c)); \
+    c = p##add_pd(p##set1_pd(-2.77777777770155933842e-03), p##mul_pd(t, c)); \
+    c = p##add_pd(p##set1_pd(1.66666666666666019037e-01), p##mul_pd(t, c)); \
+    c = p##sub_pd(r, p##mul_pd(t, c)); \
+    /* y = 1 - ((lo - r c / (2 - c)) - hi) */ \
+    V y = p##div_pd(p##mul_pd(r, c), p##sub_pd(p##set1_pd(2.0), c)); \
+    y = p##sub_pd(p##set1_pd(1.0), p##sub_pd(p##sub_pd(lo, y), hi)); \
+    /* 2^k is built from its exponent bits, k is in [-1021, 1021] */ \
+    VI scale = p##slli_epi64(p##add_epi64(k, p##set1_epi64x(1023)), 52); \
+    return p##mul_pd(y, p##castsi##w##_pd(scale)); \
+}
+
+// log of positive normal doubles: x = 2^k (1 + f) with 1 + f in
+// [sqrt(2)/2, sqrt(2)), log(1 + f) from a polynomial in s = f / (2 + f)
+#define LMATH_LOG_BODY(p, w, V, VI) { \
+    VI u = p##add_epi64(p##castpd_si##w(x), p##set1_epi64x((0x3ff00000LL - 0x3fe6a09eLL) << 32)); \
+    VI k = p##sub_epi64(p##srli_epi64(u, 52), p##set1_epi64x(0x3ff)); \
+    u = p##add_epi64(p##and_si##w(u, p##set1_epi64x(0x000fffffffffffffLL)), p##set1_epi64x(0x3fe6a09eLL << 32)); \
+    V f = p##sub_pd(p##castsi##w##_pd(u), p##set1_pd(1.0)); \
+    /* k is small, adding it to the bits of LMATH_ROUND converts it */ \
+    V dk = p##castsi##w##_pd(p##add_epi64(k, p##castpd_si##w(p##set1_pd(LMATH_ROUND)))); \
+    dk = p##sub_pd(dk, p##set1_pd(LMATH_ROUND)); \
+    V hfsq = p##mul_pd(p##mul_pd(p##set1_pd(0.5), f), f); \
+    V s = p##div_pd(f, p##add_pd(p##set1_pd(2.0), f)); \
+    V z = p##mul_pd(s, s); \
+    V ww = p##mul_pd(z, z); \
+    V t1 = p##add_pd(p##set1_pd(2.222219843214978396e-01), p##mul_pd(ww, p##set1_pd(1.531383769920937332e-01))); \
+    t1 = p##mul_pd(ww, p##add_pd(p##set1_pd(3.999999999940941908e-01), p##mul_pd(ww, t1))); \
+    V t2 = p##add_pd(p##set1_pd(1.818357216161805012e-01), p##mul_pd(ww, p##set1_pd(1.479819860511658591e-01))); \
+    t2 = p##add_pd(p##set1_pd(2.857142874366239149e-01), p##mul_pd(ww, t2)); \
+    t2 = p##mul_pd(z, p##add_pd(p##set1_pd(6.666666666666735130e-01), p##mul_pd(ww, t2))); \
+    V r = p##add_pd(t2, t1); \
+    /* s (hfsq + r) + k ln2_lo - hfsq + f + k ln2_hi */ \
+    V y = p##add_pd(p##mul_pd(s, p##add_pd(hfsq, r)), p##mul_pd(dk, p##set1_pd(LMATH_LN2_LO))); \
+    y = p##add_pd(p##sub_pd(y, hfsq), f); \
+    return p##add_pd(y, p##mul_pd(dk, p##set1_pd(LMATH_LN2_HI))); \
+}
+
+// sin of doubles with |x| <= 2^19 pi/2: x = n pi/2 + y0 + y1 with pi/2 in
+// three parts of 33 bits, then sin or cos of y0 + y1 depending on n
+#define LMATH_SIN_BODY(p, w, V, VI) { \
+    V fn = p##add_pd(p##mul_pd(x, p##set1_pd(6.36619772367581382433e-01)), p##set1_pd(LMATH_ROUND)); \
+    VI n = p##castpd_si##w(fn); \
+    fn = p##sub_pd(fn, p##set1_pd(LMATH_ROUND)); \
+    V r = p##sub_pd(x, p##mul_pd(fn, p##set1_pd(1.57079632673412561417e+00))); \
+    V t = r; \
+    V ww = p##mul_pd(fn, p##set1_pd(6.07710050630396597660e-11)); \
+    r = p##sub_pd(t, ww); \
+    ww = p##sub_pd(p##mul_pd(fn, p##set1_pd(2.02226624879595063154e-21)), p##sub_pd(p##sub_pd(t, r), ww)); \
+    t = r; \
+    ww = p##mul_pd(fn, p##set1_pd(2.02226624871116645580e-21)); \
+    r = p##sub_pd(t, ww); \
+    ww = p##sub_pd(p##mul_pd(fn, p##set1_pd(8.47842766036889956997e-32)), p##sub_pd(p##sub_pd(t, r), ww)); \
+    V y0 = p##sub_pd(r, ww); \
+    V y1 = p##sub_pd(p##sub_pd(r, y0), ww); \
+    V z = p##mul_pd(y0, y0); \
+    /* sin(y0 + y1) = y0 - ((z (y1 / 2 - v q) - y1) - v S1) with v = z y0 */ \
+    V v = p##mul_pd(z, y0); \
+    V q = p##add_pd(p##set1_pd(-2.50507602534068634195e-08), p##mul_pd(z, p##set1_pd(1.58969099521155010221e-10))); \
+    q = p##add_pd(p##set1_pd(2.75573137070700676789e-06), p##mul_pd(z, q)); \
+    q = p##add_pd(p##set1_pd(-1.98412698298579493134e-04), p##mul_pd(z, q)); \
+    q = p##add_pd(p##set1_pd(8.33333333332248946124e-03), p##mul_pd(z, q)); \
+    V sn = p##sub_pd(p##mul_pd(p##set1_pd(0.5), y1), p##mul_pd(v, q)); \
+    sn = p##sub_pd(p##sub_pd(p##mul_pd(z, sn), y1), p##mul_pd(v, p##set1_pd(-1.66666666666666324348e-01))); \
+    sn = p##sub_pd(y0, sn); \
+    /* cos(y0 + y1) = (1 - h) - ((z / 2 - h) - (z q - y0 y1)), h is 0 for */ \
+    /* |y0| < 0.3, 0.28125 above 0.78125 and about |y0| / 4 between */ \
+    q = p##add_pd(p##set1_pd(2.08757232129817482790e-09), p##mul_pd(z, p##set1_pd(-1.13596475577881948265e-11))); \
+    q = p##add_pd(p##set1_pd(-2.75573143513906633035e-07), p##mul_pd(z, q)); \
+    q = p##add_pd(p##set1_pd(2.48015872894767294178e-05), p##mul_pd(z, q)); \
+    q = p##add_pd(p##set1_pd(-1.38888888888741095749e-03), p##mul_pd(z, q)); \
+    q = p##mul_pd(z, p##add_pd(p##set1_pd(4.16666666666666019037e-02), p##mul_pd(z, q))); \
+    V ax = p##and_pd(y0, LMATH_BITS(p, w, 0x7fffffffffffffffLL)); \
+    V h = p##castsi##w##_pd(p##sub_epi64(p##and_si##w(p##castpd_si##w(ax), p##set1_epi64x(0xffffffff00000000LL)), \
+                                         p##set1_epi64x(0x0020000000000000LL))); \
+    V big = LMATH_CMP##p(ge, ax, LMATH_BITS(p, w, 0x3fe9000100000000LL)); \
+    h = p##or_pd(p##and_pd(big, p##set1_pd(0.28125)), p##andnot_pd(big, h)); \
+    h = p##andnot_pd(LMATH_CMP##p(lt, ax, LMATH_BITS(p, w, 0x3fd3333300000000LL)), h); \
+    V cs = p##sub_pd(p##mul_pd(z, q), p##mul_pd(y0, y1)); \
+    cs = p##sub_pd(p##sub_pd(p##set1_pd(1.0), h), p##sub_pd(p##sub_pd(p##mul_pd(p##set1_pd(0.5), z), h), cs)); \
+    /* Odd n takes the cosine, n & 2 flips the sign */ \
+    V odd = p##castsi##w##_pd(p##sub_epi64(p##setzero_si##w(), p##and_si##w(n, p##set1_epi64x(1)))); \
+    V y = p##or_pd(p##and_pd(odd, cs), p##andnot_pd(odd, sn)); \
+    VI sign = p##slli_epi64(p##and_si##w(n, p##set1_epi64x(2)), 62); \
+    return p##xor_pd(y, p##castsi##w##_pd(sign)); \
+}
+
+// Run "kernel" over the "n" doubles at "x", "lanes" at a time. The last
+// values are padded with the first of them. Values outside [lo, hi] use
+// "libm".
+#define LMATH_RUN(p, V, lanes, kernel, libm, x, n, lo, hi) \
+    for(long i = 0; i < (n); i += lanes) { \
+        double in[lanes], out[lanes]; \
+        int m = (n) - i < lanes ? (int)((n) - i) : lanes; \
+        V v; \
+        if(m == lanes) v = p##loadu_pd((x) + i); \
+        else { \
+            for(int j = 0; j < lanes; j++) in[j] = (x)[i + (j < m ? j : 0)]; \
+            v = p##loadu_pd(in); \
+        } \
+        V y = kernel(v); \
+        int ok = p##movemask_pd(p##and_pd(LMATH_CMP##p(ge, v, p##set1_pd(lo)), LMATH_CMP##p(le, v, p##set1_pd(hi)))); \
+        if(m == lanes && ok == (1 << lanes) - 1) { \
+            p##storeu_pd((x) + i, y); \
+            continue; \
+        } \
+        p##storeu_pd(out, y); \
+        for(int j = 0; j < m; j++) (x)[i + j] = (ok >> j) & 1 ? out[j] : libm((x)[i + j]); \
+    }
+
+__m128d lmath_exp_sse2(__m128d x) LMATH_EXP_BODY(_mm_, 128, __m128d, __m128i)
+__m128d lmath_log_sse2(__m128d x) LMATH_LOG_BODY(_mm_, 128, __m128d, __m128i)
+__m128d lmath_sin_sse2(__m128d x) LMATH_SIN_BODY(_mm_, 128, __m128d, __m128i)
+
+void lmath_f64_sse2(double *x, long n, int fn){
+    switch(fn) {
+        case LMATH_SQRT: {
+            long i = 0;
+            for(; i + 2 <= n; i += 2) _mm_storeu_pd(x + i, _mm_sqrt_pd(_mm_loadu_pd(x + i)));
+            for(; i < n; i++) x[i] = sqrt(x[i]);
+            break;
+        }
+        case LMATH_EXP: LMATH_RUN(_mm_, __m128d, 2, lmath_exp_sse2, exp, x, n, -708.0, 708.0); break;
+        case LMATH_LOG: LMATH_RUN(_mm_, __m128d, 2, lmath_log_sse2, log, x, n, DBL_MIN, DBL_MAX); break;
+        case LMATH_SIN: LMATH_RUN(_mm_, __m128d, 2, lmath_sin_sse2, sin, x, n, -823549.0, 823549.0); break;
+    }
+}
+
+#endif
+
+#ifdef LSIMD_AVX2
+
+__attribute__((target("avx2")))
+__m256d lmath_exp_avx2(__m256d x) LMATH_EXP_BODY(_mm256_, 256, __m256d, __m256i)
+__attribute__((target("avx2")))
+__m256d lmath_log_avx2(__m256d x) LMATH_LOG_BODY(_mm256_, 256, __m256d, __m256i)
+__attribute__((target("avx2")))
+__m256d lmath_sin_avx2(__m256d x) LMATH_SIN_BODY(_mm256_, 256, __m256d, __m256i)
+
+__attribute__((target("avx2")))
+void lmath_f64_avx2(double *x, long n, int fn){
+    switch(fn) {
+        case LMATH_SQRT: {
+            long i = 0;
+            for(; i + 4 <= n; i += 4) _mm256_storeu_pd(x + i, _mm256_sqrt_pd(_mm256_loadu_pd(x + i)));
+            for(; i < n; i++) x[i] = sqrt(x[i]);
+            break;
+        }
+        case LMATH_EXP: LMATH_RUN(_mm256_, __m256d, 4, lmath_exp_avx2, exp, x, n, -708.0, 708.0); break;
+        case LMATH_LOG: LMATH_RUN(_mm256_, __m256d, 4, lmath_log_avx2, log, x, n, DBL_MIN, DBL_MAX); break;
+        case LMATH_SIN: LMATH_RUN(_mm256_, __m256d, 4, lmath_sin_avx2, sin, x, n, -823549.0, 823549.0); break;
+    }
+}
+
+#endif
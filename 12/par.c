@@ -0,0 +1,458 @@
+// Parallel map, see "Parallel map" in lispy.h
+#include "lispy.h"
+
+// The pool, its threads wait for a job to be posted
+static struct {
+    int size;               // Threads with the caller, 0 until started
+    pthread_mutex_t lock;
+    pthread_cond_t posted;  // A job was posted
+    pthread_cond_t done;    // The last part being run finished
+    lpar_job *job;          // Job running, NULL between jobs
+    long jobs;              // Jobs posted so far
+    int pending;            // Parts the workers haven't finished
+} lpar = { 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0 };
+
+LTHREAD lenv *lpar_root = NULL;
+LTHREAD lpar_map *lpar_copies = NULL;
+
+LTHREAD int lpar_depth = 0;
+
+// Start the worker threads, returns how many threads the pool has with
+// the caller
+int lpar_start(void){
+    if(lpar.size) return lpar.size;
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    char *threads = getenv("LISPY_THREADS");
+    if(threads) n = strtol(threads, NULL, 10);
+    if(n < 1) n = 1;
+    if(n > LPAR_THREADS_MAX) n = LPAR_THREADS_MAX;
+
+    lpar.size = 1;
+    for(long i = 1; i < n; i++) {
+        pthread_t t;
+        if(pthread_create(&t, NULL, lpar_worker, (void*)i) != 0) break;
+        pthread_detach(t);
+        lpar.size++;
+    }
+    return lpar.size;
+}
+
+// Worker "arg" of the pool, runs its part of every job that has one
+void *lpar_worker(void *arg){
+    int p = (int)(long)arg;
+    long seen = 0;
+    lenv_versions = p;
+
+    pthread_mutex_lock(&lpar.lock);
+    for(;;) {
+        while(lpar.jobs == seen) pthread_cond_wait(&lpar.posted, &lpar.lock);
+        seen = lpar.jobs;
+
+        // The job can be over already when it had no part for this worker
+        lpar_job *j = lpar.job;
+        if(!j || p >= j->parts) continue;
+
+        pthread_mutex_unlock(&lpar.lock);
+        lpar_run_part(j, p);
+        pthread_mutex_lock(&lpar.lock);
+        if(--lpar.pending == 0) pthread_cond_signal(&lpar.done);
+    }
+    return NULL;
+}
+
+// Evaluate the part "p" of "j" on copies of what it uses
+void lpar_run_part(lpar_job *j, int p){
+    int lo = (long)j->n * p / j->parts;
+    int hi = (long)j->n * (p + 1) / j->parts;
+
+    lenv *global = j->env;
+    while(global->par) global = global->par;
+
+    lpar_map copies = { NULL, NULL, NULL, 0, 0 };
+    lpar_depth++;
+    lpar_root = lenv_new();
+    lpar_root->shared = global;
+    lpar_copies = &copies;
+    lenv *env = lpar_copy_env(j->env);
+    lval *f = lpar_copy(j->f);
+
+    lpar_map seen = { NULL, NULL, NULL, 0, 0 };
+    if(j->reduce) {
+        lval *acc = lpar_item(j->l, lo);
+        for(int i = lo + 1; i < hi && LVAL_TYPE(acc) != LVAL_ERR; i++) {
+            acc = lval_apply(env, f, acc, lpar_item(j->l, i));
+        }
+        lpar_rebind(acc, &seen);
+        j->vals[p] = acc;
+    } else {
+        for(int i = lo; i < hi; i++) {
+            lval *x = lval_apply(env, f, lpar_item(j->l, i), NULL);
+            if(LVAL_TYPE(x) == LVAL_ERR) {
+                j->vals[p] = x;
+                break;
+            }
+            lpar_rebind(x, &seen);
+            j->out[i] = x;
+        }
+    }
+    lpar_map_del(&seen);
+
+    lval_del(f);
+    lenv_unref(env);
+    lpar_map_del(&copies);
+    // "exit" in the part stops the prompt of the global environment
+    if(!lpar_root->run) {
+        pthread_mutex_lock(&lpar.lock);
+        global->run = 0;
+        pthread_mutex_unlock(&lpar.lock);
+    }
+    lenv_del(lpar_root);
+    lpar_copies = NULL;
+    lpar_root = NULL;
+    lpar_depth--;
+}
+
+// Copy of the value at "i" of the list "l"
+lval *lpar_item(lval *l, int i){
+    // Numbers of arrays are made anew
+    if(l->type == LVAL_ARR) return lhof_item(l, i);
+    return lpar_copy(l->type == LVAL_VEC ? lvec_get(l->vec, i) : l->cell[i]);
+}
+
+// Copy of "of" made before, or NULL
+void *lpar_map_get(lpar_map *m, void *of){
+    if(!m->mask) return NULL;
+    for(unsigned long i = ((uintptr_t)of >> 3) & m->mask; ; i = (i + 1) & m->mask) {
+        if(m->from[i] == of) return m->to[i];
+        if(!m->from[i]) return NULL;
+    }
+}
+
+// Remember "to" as the copy of "of", the map takes the reference to "to"
+void lpar_map_put(lpar_map *m, void *of, void *to, int kind){
+    // Keep the map at most half full
+    if((m->count + 1) * 2 > m->mask + 1) {
+        lpar_map old = *m;
+        m->mask = old.mask ? old.mask * 2 + 1 : 63;
+        m->from = calloc(m->mask + 1, sizeof(void*));
+        m->to = malloc(sizeof(void*) * (m->mask + 1));
+        m->kind = malloc(m->mask + 1);
+        m->count = 0;
+        for(int i = 0; old.mask && i <= old.mask; i++) {
+            if(old.from[i]) lpar_map_put(m, old.from[i], old.to[i], old.kind[i]);
+        }
+        free(old.from);
+        free(old.to);
+        free(old.kind);
+    }
+
+    unsigned long i = ((uintptr_t)of >> 3) & m->mask;
+    while(m->from[i]) i = (i + 1) & m->mask;
+    m->from[i] = of;
+    m->to[i] = to;
+    m->kind[i] = kind;
+    m->count++;
+}
+
+// Drop the references of "m" and free it
+void lpar_map_del(lpar_map *m){
+    for(int i = 0; m->mask && i <= m->mask; i++) {
+        if(!m->from[i]) continue;
+        switch(m->kind[i]) {
+            case LPAR_LVAL: lval_del(m->to[i]); break;
+            case LPAR_LENV: lenv_unref(m->to[i]); break;
+            case LPAR_LVEC: lvec_del(m->to[i]); break;
+            case LPAR_LCODE: lcode_del(m->to[i]); break;
+        }
+    }
+    free(m->from);
+    free(m->to);
+    free(m->kind);
+}
+
+// Copy of "v" and everything it refers to, for the part this thread runs.
+// Only reads "v", which other threads can be copying at the same time.
+lval *lpar_copy(lval *v){
+    if(LVAL_IS_FIXNUM(v)) return v;
+    lval *x = lpar_map_get(lpar_copies, v);
+    if(x) return lval_copy(x);
+
+    switch(v->type) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            x = lval_qexpr();
+            x->type = v->type;
+            x->cap = v->count;
+            x->cell = lcell_resize(NULL, 0, x->cap);
+            lpar_map_put(lpar_copies, v, lval_copy(x), LPAR_LVAL);
+            for(int i = 0; i < v->count; i++) {
+                x->cell[i] = lpar_copy(v->cell[i]);
+                x->count++;
+            }
+            return x;
+
+        case LVAL_FUN:
+            if(v->builtin) {
+                x = lval_fun(v->builtin);
+                break;
+            }
+            // The copy goes in the map first, the lambda can be bound in
+            // the environment it refers to
+            x = lval_lambda(NULL, NULL, NULL);
+            lpar_map_put(lpar_copies, v, lval_copy(x), LPAR_LVAL);
+            x->formals = lpar_copy(v->formals);
+            x->body = lpar_copy(v->body);
+            x->code = v->code ? lpar_copy_code(v->code) : NULL;
+            x->env = lpar_copy_env(v->env);
+            return x;
+
+        case LVAL_VEC:
+            x = lval_alloc(LVAL_VEC, LVAL_SIZEOF(vec));
+            x->vec = v->vec ? lpar_copy_vec(v->vec) : NULL;
+            break;
+
+        default: {
+            // Numbers, errors and symbols don't refer to other values.
+            // Symbols keep their cache, which is for the global
+            // environment and doesn't match the copy of it.
+            size_t size = lval_size(v);
+            x = lval_alloc(v->type, size);
+            memcpy((char*)x + offsetof(lval, num), (char*)v + offsetof(lval, num), size - offsetof(lval, num));
+            break;
+        }
+    }
+
+    lpar_map_put(lpar_copies, v, lval_copy(x), LPAR_LVAL);
+    return x;
+}
+
+// Counted reference to a copy of the environment "e" and its parents. The
+// global environment is replaced by the root of the part.
+lenv *lpar_copy_env(lenv *e){
+    if(!e->par) return lpar_root;
+    lenv *x = lpar_map_get(lpar_copies, e);
+    if(x) return lenv_ref(x);
+
+    // The parent first, references to "x" are only counted once it has one
+    x = lenv_new();
+    x->par = lpar_copy_env(e->par);
+    lpar_map_put(lpar_copies, e, lenv_ref(x), LPAR_LENV);
+    // Bindings keep their positions, symbols can have their address
+    for(int i = 0; i < e->count; i++) {
+        lval *val = lpar_copy(e->vals[i]);
+        lenv_append(x, e->syms[i], val);
+        lval_del(val);
+    }
+    return x;
+}
+
+lvec *lpar_copy_vec(lvec *t){
+    lvec *x = lpar_map_get(lpar_copies, t);
+    if(x) return lvec_copy(x);
+
+    x = lvec_alloc(t->height, t->count);
+    if(t->height) {
+        x->child[0] = lpar_copy_vec(t->child[0]);
+        x->child[1] = lpar_copy_vec(t->child[1]);
+    } else {
+        for(int i = 0; i < t->count; i++) x->item[i] = lpar_copy(t->item[i]);
+    }
+    lpar_map_put(lpar_copies, t, lvec_copy(x), LPAR_LVEC);
+    return x;
+}
+
+// Bytecode with copies of its constants
+lcode *lpar_copy_code(lcode *c){
+    lcode *x = lpar_map_get(lpar_copies, c);
+    if(x) {
+        x->refs++;
+        return x;
+    }
+
+    size_t size = offsetof(lcode, code) + sizeof(uint16_t) * c->count;
+    x = malloc(size);
+    memcpy(x, c, size);
+    x->refs = 1;
+    x->consts = lpar_copy(c->consts);
+#ifdef LISPY_JIT
+    x->calls = 0;
+    x->native = NULL;
+    x->native_size = 0;
+#endif
+    x->refs++;
+    lpar_map_put(lpar_copies, c, x, LPAR_LCODE);
+    return x;
+}
+
+// Binding of the global "k" for the root "e" of a part: the copy made by
+// an earlier lookup, or a new copy of the one in the global environment.
+// Returns its position in "e", or -1 when "k" is unbound.
+int lpar_import(lenv *e, lval *k){
+    int i = lenv_find(e->shared, k->sym);
+    if(i < 0) return -1;
+    lval *x = lpar_copy(e->shared->vals[i]);
+    lenv_append(e, k->sym, x);
+    lval_del(x);
+    return e->count - 1;
+}
+
+// Bind the lambdas and environments of "v", a value made by a part, to the
+// global environment instead of the root of the part
+void lpar_rebind(lval *v, lpar_map *seen){
+    if(LVAL_IS_FIXNUM(v) || lpar_map_get(seen, v)) return;
+    lpar_map_put(seen, v, v, LPAR_SEEN);
+
+    switch(v->type) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR:
+            for(int i = 0; i < v->count; i++) lpar_rebind(v->cell[i], seen);
+            break;
+
+        case LVAL_FUN:
+            if(v->builtin) break;
+            if(v->env->shared) v->env = v->env->shared;
+            else lpar_rebind_env(v->env, seen);
+            lpar_rebind(v->body, seen);
+            if(v->code) lpar_rebind(v->code->consts, seen);
+            break;
+
+        case LVAL_VEC:
+            if(v->vec) lpar_rebind_vec(v->vec, seen);
+            break;
+    }
+}
+
+void lpar_rebind_env(lenv *e, lpar_map *seen){
+    for(; e->par && !lpar_map_get(seen, e); e = e->par) {
+        lpar_map_put(seen, e, e, LPAR_SEEN);
+        for(int i = 0; i < e->count; i++) lpar_rebind(e->vals[i], seen);
+        if(e->par->shared) e->par = e->par->shared;
+    }
+}
+
+void lpar_rebind_vec(lvec *t, lpar_map *seen){
+    if(lpar_map_get(seen, t)) return;
+    lpar_map_put(seen, t, t, LPAR_SEEN);
+    if(t->height) {
+        lpar_rebind_vec(t->child[0], seen);
+        lpar_rebind_vec(t->child[1], seen);
+    } else {
+        for(int i = 0; i < t->count; i++) lpar_rebind(t->item[i], seen);
+    }
+}
+
+// Run the parts of "j" on the pool and wait for them. Returns the error
+// of the first part that failed, or NULL.
+lval *lpar_run(lpar_job *j){
+    j->vals = calloc(j->parts, sizeof(lval*));
+
+    pthread_mutex_lock(&lpar.lock);
+    lpar.job = j;
+    lpar.jobs++;
+    lpar.pending = j->parts - 1;
+    pthread_cond_broadcast(&lpar.posted);
+    pthread_mutex_unlock(&lpar.lock);
+
+    lpar_run_part(j, 0);
+
+    pthread_mutex_lock(&lpar.lock);
+    while(lpar.pending > 0) pthread_cond_wait(&lpar.done, &lpar.lock);
+    lpar.job = NULL;
+    pthread_mutex_unlock(&lpar.lock);
+
+    lval *err = NULL;
+    for(int p = 0; p < j->parts; p++) {
+        lval *x = j->vals[p];
+        if(!x || LVAL_TYPE(x) != LVAL_ERR) continue;
+        if(err) lval_del(x);
+        else err = x;
+        j->vals[p] = NULL;
+    }
+    return err;
+}
+
+// "map" or "reduce" for a call that isn't split in parts
+lval *lpar_seq(lenv *e, lval *v, lbuiltin f){
+    lpar_depth++;
+    lval *r = f(e, v);
+    lpar_depth--;
+    return r;
+}
+
+// The parts the call "v" is split in, or 1 to leave it to the
+// sequential builtin
+int lpar_parts(lval *v){
+#ifdef LISPY_GC
+    return 1;
+#else
+    if(lpar_depth) return 1;
+    int parts = lval_len(v->cell[1]) / LPAR_MIN_PART;
+    if(parts < 2) return 1;
+    int size = lpar_start();
+    return parts < size ? parts : size;
+#endif
+}
+
+lval *builtin_pmap(lenv *e, lval *v){
+    LASSERT_NUM("pmap", v, 2);
+    LASSERT_TYPE("pmap", v, 0, LVAL_FUN);
+    LASSERT_SEQ("pmap", v, 1);
+
+    int parts = lpar_parts(v);
+    if(parts < 2) return lpar_seq(e, v, builtin_map);
+
+    lpar_job j = { e, lval_pop(v, 0), lval_take(v, 0), 0, parts, 0, NULL, NULL };
+    j.n = lval_len(j.l);
+    lval *r = lhof_out(j.n);
+    j.out = r->cell;
+    memset(j.out, 0, sizeof(lval*) * j.n);
+
+    lval *err = lpar_run(&j);
+    if(err) {
+        for(int i = 0; i < j.n; i++) {
+            if(j.out[i]) lval_del(j.out[i]);
+        }
+    } else {
+        r->count = j.n;
+        r = lhof_result(j.l, r, "pmap");
+    }
+
+    free(j.vals);
+    lval_del(j.f);
+    lval_del(j.l);
+    if(err) lval_del(r);
+    return err ? err : r;
+}
+
+lval *builtin_preduce(lenv *e, lval *v){
+    LASSERT_NUM("preduce", v, 2);
+    LASSERT_TYPE("preduce", v, 0, LVAL_FUN);
+    LASSERT_SEQ("preduce", v, 1);
+    LASSERT(v, lval_len(v->cell[1]) > 0, LERR_VALUE, "Function 'preduce' passed an empty list");
+
+    int parts = lpar_parts(v);
+    if(parts < 2) return lpar_seq(e, v, builtin_reduce);
+
+    lpar_job j = { e, lval_pop(v, 0), lval_take(v, 0), 0, parts, 1, NULL, NULL };
+    j.n = lval_len(j.l);
+
+    lval *acc = lpar_run(&j);
+    if(!acc) {
+        // The values of the parts in order
+        acc = j.vals[0];
+        for(int p = 1; p < parts; p++) {
+            if(LVAL_TYPE(acc) == LVAL_ERR) lval_del(j.vals[p]);
+            else acc = lval_apply(e, j.f, acc, j.vals[p]);
+        }
+    } else {
+        for(int p = 0; p < parts; p++) {
+            if(j.vals[p]) lval_del(j.vals[p]);
+        }
+    }
+
+    free(j.vals);
+    lval_del(j.f);
+    lval_del(j.l);
+    return acc;
+}
@@ -1,20 +1,4 @@
-#include <stdio.h>
-#include <stdlib.h>
-#include "mpc.h"
-
-#define LASSERT(args, cond, fmt, ...) \
-    if (!(cond)) { \
-        lval *err = lval_err(fmt, ##__VA_ARGS__); \
-        lval_del(args); \
-        return err; \
-    }
-
-#define LASSERT_NUM(func_name, args, arg_count) \
-    if (args->count != arg_count) { \
-        lval *err = lval_err("Function 'func_name' passed too many arguments. Got %i, Expected %i", args->count, arg_count); \
-        lval_del(args); \
-        return err; \
-    }
+#include "lispy.h"
 
 #ifdef _WIN32
 
@@ -32,55 +16,48 @@ char* readline(char* prompt) {
 }
 
 /* Fake add_history function */
-void add_history(char* unused) {}
+void add_history(char* unused) {}
 
-#else
+#elif !defined(LISPY_AOT)
 
+// Compiled programs have no prompt, lispyrt.o doesn't need editline
 #include <editline/readline.h>
 #include <editline/history.h>
 
 #endif
 
-// Forward declarations
-struct lval;
-struct lenv;
-typedef struct lval lval;
-typedef struct lenv lenv;
-
-// Function pointer definition for builtin functions
-typedef lval*(*lbuiltin)(lenv*, lval*);
-
-// All the possible lval types
-enum Lval_types { LVAL_NUM, LVAL_ERR, LVAL_SYM, LVAL_SEXPR, LVAL_QEXPR, LVAL_FUN };
-// Lisp value struct
-struct lval {
-    int type;
-
-    // Basic types
-    long num;
-    // Error and Symbol types have some string data
-    char *err;
-    char *sym;
-
-    // Function type
-    lbuiltin builtin;
-    lenv *env;
-    lval *formals;
-    lval *body;
+// Size classes in bytes. The first ones match the lval types:
+// 16 numbers, errors and builtins, 32 expressions, 40 symbols and lambdas
+static const size_t lpool_sizes[LPOOL_CLASSES] = { 16, 24, 32, 40, 64, 128, 256, 512 };
 
-    // Expression type
-    // Count and pointer to a list of "lval"
-    int count;
-    lval **cell;
-};
+static LTHREAD lpool_class lpool[LPOOL_CLASSES];
+static LTHREAD long lpool_large_allocs = 0;
+static LTHREAD long lpool_large_frees = 0;
 
-// Environment structure
-struct lenv {
-    int run;    // Used to exit the program, set to 0 in builtin_exit
-    int count;
-    lval **vals;
-    char **syms;
-};
+// Full magazines shared by the threads, by size class
+static lpool_block *lpool_depot[LPOOL_CLASSES];
+static pthread_mutex_t lpool_depot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static lsym_table *lsym_current = NULL;
+static pthread_mutex_t lsym_lock = PTHREAD_MUTEX_INITIALIZER;
+char *lsym_amp = NULL;
+
+LTHREAD unsigned long lenv_versions = 0;
+LTHREAD long lenv_cache_hits = 0;
+LTHREAD long lenv_cache_misses = 0;
+
+// Spare environments, chained through "par"
+static LTHREAD lenv *lenv_spare = NULL;
+static LTHREAD int lenv_spare_count = 0;
+static LTHREAD long lenv_allocs = 0;    // Environments made by lenv_new
+static LTHREAD long lenv_reused = 0;    // The ones that were spare
+
+// Innermost evaluation being run
+static LTHREAD leval *leval_current = NULL;
+
+int lfold_enabled = 1;
+static LTHREAD long lfold_calls = 0;    // Calls folded, printed by "stats"
+static LTHREAD long lfold_nodes = 0;    // lvals they removed
 
 int number_of_nodes(mpc_ast_t *ast) {
     if(ast->children_num <= 0) return 1;
@@ -94,79 +71,36 @@ int number_of_nodes(mpc_ast_t *ast) {
     }
 }
 
-char *ltype_name(int t);
-
-lval *lval_eval_sexpr(lenv *e, lval *v);
-lval *lval_eval(lenv *e, lval *v);
-lval *lval_pop(lval *v, int i);
-lval *lval_take(lval *v, int i);
-lval *lval_copy(lval *v);
-
-lval *builtin(lenv *e, lval *v, char *func);
-lval *builtin_add(lenv* e, lval* a);
-lval *builtin_sub(lenv* e, lval* a);
-lval *builtin_mul(lenv* e, lval* a);
-lval *builtin_div(lenv* e, lval* a);
-lval *builtin_op(lenv *e, lval *v, char *op);
-lval *builtin_head(lenv *e, lval *v);
-lval *builtin_tail(lenv *e, lval *v);
-lval *builtin_list(lenv *e, lval *v);
-lval *builtin_eval(lenv *e, lval *v);
-lval *builtin_join(lenv *e, lval *v);
-lval *builtin_cons(lenv *e, lval *v);
-lval *builtin_len(lenv *e, lval *v);
-lval *builtin_init(lenv *e, lval *v);
-lval *builtin_def(lenv *e, lval *v);
-lval *builtin_exit(lenv *e, lval *v);
-lval *builtin_printenv(lenv *e, lval *v);
-lval *builtin_lambda(lenv *e, lval *v);
-
-lval *lval_join(lval *x, lval *y);
-
-lval *lval_num(long x);
-lval *lval_err(char *s, ...);
-lval *lval_sym(char *s);
-lval *lval_sexpr(void);
-lval *lval_qexpr(void);
-lval *lval_fun(lbuiltin func);
-lval *lval_lambda(lval *formals, lval *body);
-lval *lval_lambda(lval *formals, lval *body, lenv* env);
-
-lenv *lenv_new(void);
-void lenv_del(lenv *e);
-lval *lenv_get(lenv *e, lval *k);
-void lenv_put(lenv *e, lval *k, lval *v);
-void lenv_add_builtin(lenv *e, char *name, lbuiltin func);
-void lenv_add_builtins(lenv *e);
-
-void lval_print(lenv *e, lval *v);
-void lval_expr_print(lenv *e, lval *v, char open, char close);
-void lval_println(lenv *e, lval *v);
-lval *lval_add(lval *v, lval *x);
-lval *lval_read_num(mpc_ast_t *t);
-lval *lval_read(mpc_ast_t *t);
-void lval_del(lval *v);
-
 int main(int argc, char** argv) {
+#ifdef LISPY_BENCH
+    return bench_run(argc, argv);
+#endif
+#ifdef LISPY_COMPILER
+    return lispyc_run(argc, argv);
+#endif
 
+    // The tree walker can still be used for everything
+    char *eval = getenv("LISPY_EVAL");
+    if(eval && strcmp(eval, "tree") == 0) lvm_enabled = 0;
+    char *fold = getenv("LISPY_FOLD");
+    if(fold && strcmp(fold, "off") == 0) lfold_enabled = 0;
+#ifdef LISPY_JIT
+    char *jit = getenv("LISPY_JIT");
+    if(jit && strcmp(jit, "off") == 0) ljit_enabled = 0;
+#endif
+#ifdef LISPY_AOT
+    return laot_run();
+#else
     // Create and define parsers
     mpc_parser_t* Number = mpc_new("number");
     mpc_parser_t* Symbol = mpc_new("symbol");
     mpc_parser_t* Sexpr  = mpc_new("sexpr");
     mpc_parser_t* Qexpr  = mpc_new("qexpr");
+    mpc_parser_t* Vector = mpc_new("vector");
     mpc_parser_t* Expr   = mpc_new("expr");
     mpc_parser_t* Lispy  = mpc_new("lispy");
 
-    mpca_lang(MPC_LANG_DEFAULT,
-            "\
-                number   : /-?[0-9]+/ ; \
-                symbol   : /[a-zA-Z0-9_+\\-*\\/\\\\=<>!&%]+/ ; \
-                sexpr    : '(' <expr>* ')' ; \
-                qexpr    : '{' <expr>* '}' ; \
-                expr     : <number> | <symbol> | <sexpr> | <qexpr> ; \
-                lispy    : /^/ <expr>* /$/ ; \
-            ",
-            Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    mpca_lang(MPC_LANG_DEFAULT, LISPY_GRAMMAR, Number, Symbol, Sexpr, Qexpr, Vector, Expr, Lispy);
 
     puts("Lispy Version 0.0.0.0.8");
     puts("Press Ctrl+c to Exit\n");
@@ -177,6 +111,8 @@ int main(int argc, char** argv) {
 
     while(e->run) {
         char* input = readline("lispy> ");
+        // Ctrl+d or end of piped input
+        if(!input) break;
         add_history(input);
 
         // Try to parse the input
@@ -184,11 +120,19 @@ int main(int argc, char** argv) {
         if(mpc_parse("<stdin>", input, Lispy, &r)) {
 
             lval *val = lval_read(r.output);
-            val = lval_eval(e, val);
+            val = lfold_form(e, val, NULL);
+#ifdef LISPY_GC
+            lgc.top = 1;
+#endif
+            val = lvm_enabled && LVAL_TYPE(val) == LVAL_SEXPR ? lvm_eval(e, val) : lval_eval(e, val);
             lval_println(e, val);
             lval_del(val);
 
             mpc_ast_delete(r.output);
+#ifdef LISPY_GC
+            lgc.top = 0;
+            gc_safepoint(e);
+#endif
         } else {
             // Otherwise print the error
             mpc_err_print(r.error);
@@ -201,9 +145,10 @@ int main(int argc, char** argv) {
     lenv_del(e);
 
     // Undefine and Delete our Parsers
-    mpc_cleanup(6, Number, Symbol, Sexpr, Qexpr, Expr, Lispy);
+    mpc_cleanup(7, Number, Symbol, Sexpr, Qexpr, Vector, Expr, Lispy);
 
     return 0;
+#endif
 }
 
 char *ltype_name(int t) {
@@ -214,6 +159,10 @@ char *ltype_name(int t) {
         case LVAL_SYM: return "Symbol";
         case LVAL_SEXPR: return "S-Expression";
         case LVAL_QEXPR: return "Q-Expression";
+        case LVAL_VEC: return "Vector";
+        case LVAL_BIG: return "Big Number";
+        case LVAL_DBL: return "Float";
+        case LVAL_ARR: return "Array";
         default: return "Unknown";
     }
 }
@@ -222,62 +171,433 @@ lval *lval_eval_sexpr(lenv *e, lval *v){
     // Empty expression
     if(v->count == 0) return v;
 
-    // Evaluate children
-    for (int i = 0; i < v->count; i++) {
-        v->cell[i] = lval_eval(e, v->cell[i]);
+    leval ev;
+    leval_init(&ev, e, v);
+    leval_run(&ev, -1);
+    leval_free(&ev);
+    return ev.result;
+}
+
+lval *lval_eval(lenv *e, lval *v) {
+    if(LVAL_TYPE(v) == LVAL_SYM) {
+        lval *x = lval_lookup(e, v);
+        lval_del(v);
+        return x;
     }
+    if(LVAL_TYPE(v) == LVAL_SEXPR) return lval_eval_sexpr(e, v);
+    return v;
+}
 
-    // Error checking
-    for (int i = 0; i < v->count; i++) {
-        if(v->cell[i]->type == LVAL_ERR) {
-            return lval_take(v, i);
+// Value of the symbol "k", without a name lookup if it has an address or
+// a cached global binding
+lval *lval_lookup(lenv *e, lval *k) {
+    if(k->depth >= 0) {
+        lenv *f = e;
+        for(int d = 0; d < k->depth && f; d++) f = f->par;
+        // The frame is checked since the body could be evaluated elsewhere
+        if(f && k->slot < f->count && f->syms[k->slot] == k->sym) return lval_copy(f->vals[k->slot]);
+    }
+
+    // Local environments can shadow the global one, they are searched first
+    for(; e->par; e = e->par) {
+        int i = lenv_find(e, k->sym);
+        if(i >= 0) return lval_copy(e->vals[i]);
+    }
+
+    if(k->ver == e->ver) {
+        lenv_cache_hits++;
+        return lval_copy(*k->ref);
+    }
+    int i = lenv_find(e, k->sym);
+    if(i < 0 && e->shared) i = lpar_import(e, k);
+
+    lenv_cache_misses++;
+    if(i < 0) return lval_err(LERR_UNBOUND, "Unbound symbol '%s'", k->sym);
+    k->ref = e->vals + i;
+    k->ver = e->ver;
+    return lval_copy(e->vals[i]);
+}
+
+lval *lval_call(lenv *e, lval *f, lval *v) {
+    // Builtins are simply called
+    if(f->builtin) return f->builtin(e, v);
+
+    lenv *env;
+    lval *r = lval_bind(e, f, v, &env);
+    if(r) return r;
+
+    // All formals bound, evaluate the body in the new environment
+    if(f->code) r = lvm_exec(env, f->code, lval_copy(f));
+    else r = builtin_eval(env, lval_add(lval_sexpr(), lval_copy(f->body)));
+    lenv_unref(env);
+    return r;
+}
+
+// Bind the arguments "v" of a call to the lambda "f" in a new environment
+// whose parent is the lambda's. Returns NULL when every formal is bound
+// and the body can be run in "*env", otherwise the partially applied
+// function or an error. "f" itself is never changed, so lambdas can be
+// shared by any number of callers.
+lval *lval_bind(lenv *e, lval *f, lval *v, lenv **env) {
+    lval **formals = f->formals->cell;
+    int given = v->count;
+    int total = f->formals->count;
+
+    lenv *x = lenv_new();
+    x->par = lenv_ref(f->env);
+
+    // Bind the arguments to the formals one by one
+    int i = 0;
+    for(; v && v->count; i++) {
+        if(i == total) {
+            lval_del(v);
+            lenv_unref(x);
+            return lval_err(LERR_ARITY, "Function passed too many arguments. Got %i, Expected %i", given, total);
+        }
+
+        // Variable arguments, bind the rest of the arguments as a list
+        if(formals[i]->sym == lsym_amp) {
+            if(i + 2 != total) {
+                lval_del(v);
+                lenv_unref(x);
+                return lval_err(LERR_VALUE, "Function format invalid. Symbol '&' not followed by single symbol");
+            }
+            lval *rest = builtin_list(e, v);
+            lenv_put(x, formals[i + 1], rest);
+            lval_del(rest);
+            v = NULL;
+            i = total;
+            break;
+        }
+
+        lval *val = lval_pop(v, 0);
+        lenv_put(x, formals[i], val);
+        lval_del(val);
+    }
+    if(v) lval_del(v);
+
+    // No arguments were left for '&', bind it to an empty list
+    if(i < total && formals[i]->sym == lsym_amp) {
+        if(i + 2 != total) {
+            lenv_unref(x);
+            return lval_err(LERR_VALUE, "Function format invalid. Symbol '&' not followed by single symbol");
+        }
+        lval *val = lval_qexpr();
+        lenv_put(x, formals[i + 1], val);
+        lval_del(val);
+        i = total;
+    }
+
+    // Partially applied functions keep the bound arguments as their scope
+    // and wait for the remaining formals
+    if(i < total) {
+        lval *p = lval_lambda(lval_slice(f->formals, i, total), lval_copy(f->body), x);
+        p->code = f->code;
+        if(p->code) p->code->refs++;
+        return p;
+    }
+
+    *env = x;
+    return NULL;
+}
+
+// Start evaluating the S-Expression "v" in "e"
+void leval_init(leval *ev, lenv *e, lval *v){
+    ev->frames = ev->frames_local;
+    ev->count = 0;
+    ev->cap = LEVAL_FRAMES_MIN;
+    ev->result = NULL;
+    ev->steps = 0;
+    ev->outer = NULL;
+    leval_push(ev, lval_unshare(v), e);
+}
+
+// Run at most "steps" steps, or until the end when it is negative.
+// Returns 1 once the value is in "result".
+int leval_run(leval *ev, long steps){
+    ev->outer = leval_current;
+    leval_current = ev;
+#ifdef LISPY_GC
+    // Only the evaluation main started collects, see gc_poll
+    int top = lgc.top;
+    lgc.top = 0;
+#endif
+
+    long run = 0;
+    while(ev->count > 0 && run != steps) {
+#ifdef LISPY_GC
+        if(top) {
+            lgc_roots roots = { ev, NULL, NULL, 0, NULL, 0 };
+            gc_poll(&roots);
+        }
+#endif
+        leval_frame *fr = ev->frames + ev->count - 1;
+        lval *v = fr->v;
+
+        // Children are evaluated in order and replaced with their values
+        while(fr->next < v->count && run != steps) {
+            run++;
+
+            // Special forms pick the children to evaluate once their
+            // function is known
+            if(fr->next == 1 && fr->form < 0) fr->form = lform_of(v->cell[0], v->count);
+            if(fr->form > 0 && !leval_form(ev, fr)) goto next;
+
+            lval *x = v->cell[fr->next];
+            if(LVAL_TYPE(x) == LVAL_SYM) {
+                v->cell[fr->next++] = lval_lookup(fr->env, x);
+                lval_del(x);
+                if(LVAL_TYPE(v->cell[fr->next - 1]) == LVAL_ERR) {
+                    leval_return(ev, leval_take(fr, fr->next - 1));
+                    goto next;
+                }
+            } else if(LVAL_TYPE(x) == LVAL_SEXPR && x->count > 0) {
+                // The value goes in the child's place when its frame returns
+                v->cell[fr->next] = LVAL_FIXNUM(0);
+                leval_push(ev, lval_unshare(x), fr->env);
+                goto next;
+            } else {
+                fr->next++;
+            }
         }
+        if(run == steps) break;
+
+        run++;
+        lval *r = leval_apply(ev, ev->count - 1);
+        if(r) leval_return(ev, r);
+    next:;
+    }
+
+    ev->steps += run;
+    leval_current = ev->outer;
+    return ev->count == 0;
+}
+
+// Release an evaluation, finished or not. The result is left to the caller.
+void leval_free(leval *ev){
+    while(ev->count > 0) {
+        leval_frame *fr = ev->frames + --ev->count;
+        if(fr->v) lval_del(fr->v);
+        lenv_unref(fr->env);
     }
+    if(ev->frames != ev->frames_local) free(ev->frames);
+    ev->frames = ev->frames_local;
+}
+
+leval_frame *leval_push(leval *ev, lval *v, lenv *e){
+    if(ev->count == ev->cap) lvm_reserve((void**)&ev->frames, ev->frames_local, &ev->cap, ev->count + 1, sizeof(leval_frame));
+    leval_frame *fr = ev->frames + ev->count++;
+    fr->v = v;
+    fr->next = 0;
+    fr->env = lenv_ref(e);
+    fr->form = -1;
+    return fr;
+}
+
+// Apply the function of frame "i", whose children are all evaluated.
+// Returns the value of the frame, or NULL when it goes on with something
+// else to evaluate: the list passed to "eval" or the body of a lambda.
+lval *leval_apply(leval *ev, int i){
+    leval_frame *fr = ev->frames + i;
+    lval *v = fr->v;
+    fr->v = NULL;
+#ifdef LISPY_GC
+    // Copied if a collection made it old, builtins change their arguments
+    v = lval_unshare(v);
+#endif
+
+    // Empty expression, from "eval" or a lambda body
+    if(v->count == 0) return v;
 
-    // Single expression (ignore "exit" & "printenv" functions, they should have no arguments)
-    if(v->count == 1 && v->cell[0]->builtin != builtin_exit && v->cell[0]->builtin != builtin_printenv) {
-        return lval_take(v, 0);
+    // Error checking
+    for(int j = 0; j < v->count; j++) {
+        if(LVAL_TYPE(v->cell[j]) == LVAL_ERR) return lval_take(v, j);
     }
 
+    // Single expression (ignore functions that should have no arguments)
+    if(v->count == 1 && !builtin_takes_no_args(v->cell[0])) return lval_take(v, 0);
+
     // Ensure first element is a function after evaluation
     lval *f = lval_pop(v, 0);
-    if(f->type != LVAL_FUN) {
+    if(LVAL_TYPE(f) != LVAL_FUN) {
         lval_del(f);
         lval_del(v);
-        return lval_err("S-expression does not start with a function!");
+        return lval_err(LERR_NOT_FUN, "S-expression does not start with a function!");
+    }
+
+    // "eval" of a list, the list is evaluated next in this frame
+    if(f->builtin == builtin_eval && v->count == 1 && lval_is_list(v->cell[0])) {
+        lval *x = lval_take(v, 0);
+        x = x->type == LVAL_VEC ? lval_vec_to_expr(x, LVAL_SEXPR) : lval_unshare(x);
+        x->type = LVAL_SEXPR;
+        fr->v = x;
+        fr->next = 0;
+        fr->form = -1;
+        lval_del(f);
+        return NULL;
     }
 
     // Call function
-    lval *result = f->builtin(e, v);
+    if(f->builtin || f->code) {
+        lval *r = lval_call(fr->env, f, v);
+        lval_del(f);
+        return r;
+    }
+    lenv *env;
+    lval *r = lval_bind(fr->env, f, v, &env);
+    if(r) {
+        lval_del(f);
+        return r;
+    }
+
+    // All formals bound, the body is evaluated next in the new environment.
+    // The call is the last thing this frame does so the body takes its
+    // place, the frame's environment isn't needed any more.
+    lval *body = lval_unshare(lval_copy(f->body));
+    body->type = LVAL_SEXPR;
     lval_del(f);
-    return result;
+    lenv_unref(fr->env);
+    fr->v = body;
+    fr->next = 0;
+    fr->env = env;
+    fr->form = -1;
+    return NULL;
 }
 
-lval *lval_eval(lenv *e, lval *v) {
-    if(v->type == LVAL_SYM) {
-        lval *x = lenv_get(e, v);
-        lval_del(v);
-        return x;
+// Return "r" from the frame on top, to the frame below or as the result.
+// An error is the result right away: every frame below would return it
+// before evaluating anything else.
+void leval_return(leval *ev, lval *r){
+    lenv_unref(ev->frames[--ev->count].env);
+    if(LVAL_TYPE(r) == LVAL_ERR) leval_free(ev);
+    if(ev->count == 0) {
+        ev->result = r;
+        return;
     }
-    if(v->type == LVAL_SEXPR) return lval_eval_sexpr(e, v);
-    return v;
+    leval_frame *fr = ev->frames + ev->count - 1;
+    fr->v->cell[fr->next++] = r;
+}
+
+// Step of the special form run by the frame "fr" on top, whose children
+// before "fr->next" are evaluated. Returns 1 when the child "fr->next" is
+// to be evaluated, 0 when the frame returned or goes on with a branch.
+int leval_form(leval *ev, leval_frame *fr){
+    int i = fr->next;
+    int t;
+
+    switch(fr->form) {
+        case LFORM_FOLD:
+            // The value while the builtins are the same, otherwise the call
+            if(lfold_valid(fr->env, fr->v)) leval_return(ev, leval_take(fr, 1));
+            else leval_branch(ev, fr, 2);
+            return 0;
+
+        case LFORM_IF:
+            if(i == 1) return 1;
+            t = leval_test(ev, fr, 1);
+            if(t >= 0) leval_branch(ev, fr, t ? 2 : 3);
+            return 0;
+
+        case LFORM_AND:
+        case LFORM_OR:
+            // The value before decides whether to go on
+            if(i > 1) {
+                t = leval_test(ev, fr, i - 1);
+                if(t < 0) return 0;
+                if(t == (fr->form == LFORM_OR)) {
+                    leval_return(ev, leval_take(fr, i - 1));
+                    return 0;
+                }
+            }
+            if(i == fr->v->count - 1) {
+                leval_branch(ev, fr, i);
+                return 0;
+            }
+            return 1;
+
+        default:
+            // Tests are at odd positions, the default is alone at the end
+            for(;;) {
+                if(i % 2) {
+                    if(i < fr->v->count - 1) return 1;
+                    leval_branch(ev, fr, i);
+                    return 0;
+                }
+                t = leval_test(ev, fr, i - 1);
+                if(t < 0) return 0;
+                if(t) {
+                    leval_branch(ev, fr, i);
+                    return 0;
+                }
+                // The expression of the clause is skipped
+                fr->next = ++i;
+            }
+    }
+}
+
+// Truth of the evaluated child "i" of the frame "fr" as a condition. When
+// it isn't a number the frame returns an error and -1 is returned.
+int leval_test(leval *ev, leval_frame *fr, int i){
+    int t = lval_truth(fr->v->cell[i]);
+    if(t < 0) leval_return(ev, lval_cond_err(leval_take(fr, i)));
+    return t;
+}
+
+// Go on with the unevaluated child "i" of the frame "fr" on top in place
+// of the frame, or with () if there is no such child
+void leval_branch(leval *ev, leval_frame *fr, int i){
+    if(i >= fr->v->count) {
+        lval_del(fr->v);
+        fr->v = NULL;
+        leval_return(ev, lval_sexpr());
+        return;
+    }
+
+    lval *x = leval_take(fr, i);
+    if(LVAL_TYPE(x) == LVAL_SEXPR && x->count > 0) {
+        fr->v = lval_unshare(x);
+        fr->next = 0;
+        fr->form = -1;
+        return;
+    }
+    if(LVAL_TYPE(x) == LVAL_SYM) {
+        lval *r = lval_lookup(fr->env, x);
+        lval_del(x);
+        x = r;
+    }
+    leval_return(ev, x);
+}
+
+// Child "i" of the frame "fr", the rest of its S-Expression is released
+lval *leval_take(leval_frame *fr, int i){
+    lval *x = lval_take(fr->v, i);
+    fr->v = NULL;
+    return x;
 }
 
 lval *lval_pop(lval *v, int i) {
     // Check if there are enough lvals in the array
-    if(i >= v->count) return lval_err("lval_pop index out of bounds!");
+    if(i >= v->count) return lval_err(LERR_VALUE, "lval_pop index out of bounds!");
     // Copy the item at "i"
     lval *val = v->cell[i];
 
-    // Move back all the pointers after the taken value
-    for(; i < v->count - 1; i++) {
-        v->cell[i] = v->cell[i+1];
+    if(i < v->count / 2) {
+        // Move the pointers before the taken value forward and start the
+        // list one cell later
+        for(; i > 0; i--) {
+            v->cell[i] = v->cell[i-1];
+        }
+        v->cell++;
+        v->off++;
+    } else {
+        // Move back all the pointers after the taken value
+        for(; i < v->count - 1; i++) {
+            v->cell[i] = v->cell[i+1];
+        }
     }
 
-    // Decrement the counter
+    // Decrement the counter, the cell array is kept for later lval_adds
     v->count -= 1;
-    // Reallocate memory for the cell array
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
     // Return the popped value
     return val;
 }
@@ -286,7 +606,7 @@ lval *lval_take(lval *v, int i){
     // Check if there are enough lvals in the array
     if(i >= v->count) {
         lval_del(v);
-        return lval_err("lval_take index out of bounds!");
+        return lval_err(LERR_VALUE, "lval_take index out of bounds!");
     }
 
     // Pop the item at "i"
@@ -296,50 +616,53 @@ lval *lval_take(lval *v, int i){
     return val;
 }
 
-lval *lval_copy(lval *v){
+// External definitions of the inline functions in lispy.h
+lval *lval_copy(lval *v);
+void lval_del(lval *v);
+lval *lval_num(long x);
+long lval_num_value(lval *v);
+int lval_unique(lval *v);
+lenv *lenv_ref(lenv *e);
+void lenv_unref(lenv *e);
+
+// Get a version of "v" that can be modified in place. A value with only
+// one reference is returned as it is. Shared expressions are copied one
+// level deep, the children stay shared with the original, and the
+// reference to the original is released.
+lval *lval_unshare(lval *v){
+    if(LVAL_IS_FIXNUM(v) || lval_unique(v)) return v;
+
     lval *x;
 
     switch(v->type) {
-        case LVAL_FUN:
-            if(v->builtin) {
-                x = lval_fun(v->builtin);
-            } else {
-                x = lval_lambda(lval_copy(v->formals), lval_copy(v->body), lenv_copy(v->env));
-            }
-            break;
-
-        case LVAL_NUM:
-            x = lval_num(v->num);
-            break;
-
-        case LVAL_ERR:
-            x = lval_err(v->err);
-            break;
-
-        case LVAL_SYM:
-            x = lval_sym(v->sym);
-            break;
-
         case LVAL_SEXPR:
         case LVAL_QEXPR:
-            x = malloc(sizeof(lval));
+            x = lval_slice(v, 0, v->count);
             x->type = v->type;
-            x->count = v->count;
-            for(int i = 0; i < x->count; i++) {
-                x->cell[i] = lval_copy(v->cell[i]);
-            }
-            x->err = NULL;
-            x->sym = NULL;
-            x->num = 0;
-            x->builtin = NULL;
             break;
 
         default:
-            x = lval_err("Unknown type found when copying lval!");
-            break;
+            // Numbers, errors, symbols, functions, vectors and arrays are
+            // never modified
+            return v;
+    }
+
+    lval_del(v);
+    return x;
+}
+
+// New Q-Expression sharing the cells from "start" up to "end" of "v"
+lval *lval_slice(lval *v, int start, int end){
+    lval *x = lval_qexpr();
+    x->count = end - start;
+    x->cap = x->count;
+    x->cell = lcell_resize(NULL, 0, x->cap);
+    for(int i = 0; i < x->count; i++) {
+        x->cell[i] = lval_copy(v->cell[start + i]);
     }
     return x;
 }
+
 lval *builtin(lenv *e, lval *v, char *func){
     if (strcmp("list", func) == 0) return builtin_list(e, v);
     if (strcmp("head", func) == 0) return builtin_head(e, v);
@@ -351,7 +674,7 @@ lval *builtin(lenv *e, lval *v, char *func){
     if (strcmp("init", func) == 0) return builtin_init(e, v);
     if (strstr("+-/*%minmax", func)) return builtin_op(e, v, func);
     lval_del(v);
-    return lval_err("Unknown function!");
+    return lval_err(LERR_VALUE, "Unknown function!");
 }
 
 lval* builtin_add(lenv* e, lval* a) { return builtin_op(e, a, "+"); }
@@ -361,427 +684,1822 @@ lval* builtin_div(lenv* e, lval* a) { return builtin_op(e, a, "/"); }
 lval* builtin_rem(lenv* e, lval* a) { return builtin_op(e, a, "%"); }
 lval* builtin_min(lenv* e, lval* a) { return builtin_op(e, a, "min"); }
 lval* builtin_max(lenv* e, lval* a) { return builtin_op(e, a, "max"); }
+lval* builtin_pow(lenv* e, lval* a) { return builtin_op(e, a, "^"); }
+
+lval* builtin_sqrt(lenv* e, lval* a) { return builtin_math(e, a, "sqrt", lmath_sqrt); }
+lval* builtin_exp(lenv* e, lval* a) { return builtin_math(e, a, "exp", lmath_exp); }
+lval* builtin_log(lenv* e, lval* a) { return builtin_math(e, a, "log", lmath_log); }
+lval* builtin_sin(lenv* e, lval* a) { return builtin_math(e, a, "sin", lmath_sin); }
 
 
 lval *builtin_op(lenv *e, lval *v, char *op) {
-    // Check that all inputted values are numbers
+    // Check that all inputted values are numbers or arrays of numbers
     for (int i = 0; i < v->count; i++) {
-        if(v->cell[i]->type != LVAL_NUM) {
-            return lval_err("Not a number!");
+        if(!lval_is_number(v->cell[i]) && LVAL_TYPE(v->cell[i]) != LVAL_ARR) {
+            lval_del(v);
+            return lval_err(LERR_TYPE, "Not a number!");
         }
     }
 
     lval *x = lval_pop(v, 0);
 
     if(strcmp(op, "-") == 0 && v->count == 0) {
-        x->num = -x->num;
+        x = lval_arith(lval_num(0), x, "-");
     }
 
-    while(v->count) {
-        // Pop the next value
-        lval *y = lval_pop(v, 0);
+    while(v->count && LVAL_TYPE(x) != LVAL_ERR) {
+        x = lval_arith(x, lval_pop(v, 0), op);
+    }
+
+    // Delete the old lval and return the result
+    lval_del(v);
+    return x;
+}
+
+// "x op y" for two numbers, both are deleted. Longs are computed directly,
+// only results that overflow go through the big number code. A float
+// operand makes the result a float.
+lval *lval_arith(lval *x, lval *y, char *op){
+    if(LVAL_TYPE(x) == LVAL_ARR || LVAL_TYPE(y) == LVAL_ARR) return lval_arr_arith(x, y, op);
+    if(LVAL_TYPE(x) == LVAL_DBL || LVAL_TYPE(y) == LVAL_DBL) return lval_dbl_arith(x, y, op);
+    if(LVAL_TYPE(x) != LVAL_NUM || LVAL_TYPE(y) != LVAL_NUM) return lval_big_arith(x, y, op);
+
+    long a = lval_num_value(x);
+    long b = lval_num_value(y);
+    long r = 0;
+    int overflow = 0;
+
+    // "min" and "max" are told apart by their second letter
+    switch(op[0] == 'm' ? op[1] : op[0]) {
+        case '+': overflow = __builtin_add_overflow(a, b, &r); break;
+        case '-': overflow = __builtin_sub_overflow(a, b, &r); break;
+        case '*': overflow = __builtin_mul_overflow(a, b, &r); break;
+
+        case '/':
+        case '%':
+            // If the second operator is zero return an error
+            if(b == 0) {
+                lval_del(x);
+                lval_del(y);
+                return lval_err(LERR_DIV_ZERO, "Divide by zero");
+            }
+            // LONG_MIN / -1 is the only quotient that overflows
+            overflow = a == LONG_MIN && b == -1;
+            if(!overflow) r = op[0] == '/' ? a / b : a % b;
+            break;
+
+        case '^':
+            if(b < 0) {
+                lval_del(x);
+                lval_del(y);
+                return lval_err(LERR_VALUE, "Negative exponent %li", b);
+            }
+            // Square and multiply
+            r = 1;
+            for(long base = a; b && !overflow; b >>= 1) {
+                if(b & 1) overflow = __builtin_mul_overflow(r, base, &r);
+                if(b > 1 && !overflow) overflow = __builtin_mul_overflow(base, base, &base);
+            }
+            break;
+
+        case 'i': r = a < b ? a : b; break;
+        case 'a': r = a > b ? a : b; break;
+    }
+
+    if(overflow) return lval_big_arith(x, y, op);
+
+    lval_del(x);
+    lval_del(y);
+    return lval_num(r);
+}
+
+lval *lval_dbl_arith(lval *x, lval *y, char *op){
+    double a = lval_to_double(x);
+    double b = lval_to_double(y);
+    double r = 0;
+    lval_del(x);
+    lval_del(y);
+
+    switch(op[0] == 'm' ? op[1] : op[0]) {
+        case '+': r = a + b; break;
+        case '-': r = a - b; break;
+        case '*': r = a * b; break;
+
+        case '/':
+        case '%':
+            // Same as for integers, instead of an infinity
+            if(b == 0) return lval_err(LERR_DIV_ZERO, "Divide by zero");
+            r = op[0] == '/' ? a / b : fmod(a, b);
+            break;
+
+        case '^': r = pow(a, b); break;
+        case 'i': r = a < b ? a : b; break;
+        case 'a': r = a > b ? a : b; break;
+    }
+    return lval_dbl(r);
+}
+
+int lval_is_number(lval *v){
+    int t = LVAL_TYPE(v);
+    return t == LVAL_NUM || t == LVAL_BIG || t == LVAL_DBL;
+}
+
+// Nearest double of any number
+double lval_to_double(lval *v){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_DBL: return v->dbl;
+        case LVAL_BIG: {
+            double d = 0;
+            for(int i = v->limbs - 1; i >= 0; i--) d = d * 18446744073709551616.0 + LVAL_LIMB(v)[i];
+            return v->sign * d;
+        }
+        default: return lval_num_value(v);
+    }
+}
+
+// Special form run by a call to the function "f" with "count" cells, or
+// LFORM_NONE. Forms with the wrong number of arguments are left to fail
+// as calls.
+int lform_of(lval *f, int count){
+    if(LVAL_TYPE(f) != LVAL_FUN || !f->builtin) return LFORM_NONE;
+    if(f->builtin == builtin_folded) return count == 4 ? LFORM_FOLD : LFORM_NONE;
+    if(f->builtin == builtin_if) return count == 3 || count == 4 ? LFORM_IF : LFORM_NONE;
+    if(count < 2) return LFORM_NONE;
+    if(f->builtin == builtin_and) return LFORM_AND;
+    if(f->builtin == builtin_or) return LFORM_OR;
+    if(f->builtin == builtin_cond) return LFORM_COND;
+    return LFORM_NONE;
+}
+
+// 1 if "v" is true as a condition, 0 if it is false and -1 if it isn't a
+// number
+int lval_truth(lval *v){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_NUM: return lval_num_value(v) != 0;
+        case LVAL_BIG: return 1;
+        case LVAL_DBL: return v->dbl != 0;
+        default: return -1;
+    }
+}
+
+// Error for the condition "v" that isn't a number, which is released.
+// Errors are passed on.
+lval *lval_cond_err(lval *v){
+    if(LVAL_TYPE(v) == LVAL_ERR) return v;
+    lval *err = lval_err(LERR_TYPE, "Condition passed incorrect type. Got %s, expected %s", ltype_name(LVAL_TYPE(v)), ltype_name(LVAL_NUM));
+    lval_del(v);
+    return err;
+}
+
+// The special forms called like functions, with their arguments evaluated
+lval *builtin_if(lenv *e, lval *v){
+    LASSERT(v, v->count == 2 || v->count == 3, LERR_ARITY, "Function 'if' passed incorrect number of arguments. Got %i, Expected %i or %i",
+            v->count, 2, 3);
+    int t = lval_truth(v->cell[0]);
+    if(t < 0) return lval_cond_err(lval_take(v, 0));
+    if(t) return lval_take(v, 1);
+    if(v->count == 3) return lval_take(v, 2);
+    lval_del(v);
+    return lval_sexpr();
+}
+
+lval *builtin_and(lenv *e, lval *v) { return builtin_logic(e, v, 0); }
+lval *builtin_or(lenv *e, lval *v) { return builtin_logic(e, v, 1); }
+
+// "and" stops at the first value that is false, "or" at the first true one
+lval *builtin_logic(lenv *e, lval *v, int or){
+    LASSERT(v, v->count > 0, LERR_ARITY, "Function '%s' passed no arguments", or ? "or" : "and");
+    for(int i = 0; i < v->count - 1; i++) {
+        int t = lval_truth(v->cell[i]);
+        if(t < 0) return lval_cond_err(lval_take(v, i));
+        if(t == or) return lval_take(v, i);
+    }
+    return lval_take(v, v->count - 1);
+}
+
+lval *builtin_cond(lenv *e, lval *v){
+    int i = 0;
+    for(; i + 1 < v->count; i += 2) {
+        int t = lval_truth(v->cell[i]);
+        if(t < 0) return lval_cond_err(lval_take(v, i));
+        if(t) return lval_take(v, i + 1);
+    }
+    if(i < v->count) return lval_take(v, i);
+    lval_del(v);
+    return lval_sexpr();
+}
+
+// Make the Q-Expression "body" a loop body of the symbols "vars", both
+// are consumed. It is run in "e".
+void lloop_init(lloop *l, lenv *e, lval *vars, lval *body){
+    body = lfold_form(e, body, vars);
+    body = lval_resolve(body, vars, e);
+    l->fn = lval_lambda(vars, body, lenv_ref(e));
+    if(lvm_enabled) l->fn->code = lcode_compile(body);
+    l->env = NULL;
+}
+
+// Bind the loop variable to "x", which is consumed, for the next run
+void lloop_set(lloop *l, lval *x){
+    if(l->env && l->env->refs == 1) {
+        lval_del(l->env->vals[0]);
+        l->env->vals[0] = x;
+        return;
+    }
+
+    // The first iteration, or the body kept the environment
+    if(l->env) lenv_unref(l->env);
+    l->env = lenv_new();
+    l->env->par = lenv_ref(l->fn->env);
+    lenv_put(l->env, l->fn->formals->cell[0], x);
+    lval_del(x);
+}
+
+// Run the body once
+lval *lloop_run(lloop *l){
+    if(!l->env) {
+        l->env = lenv_new();
+        l->env->par = lenv_ref(l->fn->env);
+    }
+    if(l->fn->code) return lvm_exec(l->env, l->fn->code, lval_copy(l->fn));
+    return builtin_eval(l->env, lval_add(lval_sexpr(), lval_copy(l->fn->body)));
+}
+
+void lloop_free(lloop *l){
+    if(l->env) lenv_unref(l->env);
+    lval_del(l->fn);
+}
+
+lval *builtin_while(lenv *e, lval *v){
+    LASSERT_NUM("while", v, 2);
+    LASSERT_TYPE("while", v, 0, LVAL_QEXPR);
+    LASSERT_TYPE("while", v, 1, LVAL_QEXPR);
+
+    lloop test, body;
+    lloop_init(&test, e, lval_qexpr(), lval_pop(v, 0));
+    lloop_init(&body, e, lval_qexpr(), lval_pop(v, 0));
+    lval_del(v);
+
+    lval *r = NULL;
+    while(!r) {
+        lval *c = lloop_run(&test);
+        int t = lval_truth(c);
+        if(t < 0) {
+            r = lval_cond_err(c);
+            break;
+        }
+        lval_del(c);
+        if(!t) break;
+
+        lval *x = lloop_run(&body);
+        if(LVAL_TYPE(x) == LVAL_ERR) r = x;
+        else lval_del(x);
+    }
+
+    lloop_free(&test);
+    lloop_free(&body);
+    return r ? r : lval_sexpr();
+}
+
+// Check the loop variable of the loop "func", the first argument of "v"
+#define LASSERT_LOOP_VAR(func, v) \
+    LASSERT_TYPE(func, v, 0, LVAL_QEXPR); \
+    LASSERT(v, v->cell[0]->count == 1, LERR_ARITY, "Function '%s' passed %i loop variables, expected 1", func, v->cell[0]->count); \
+    LASSERT(v, LVAL_TYPE(v->cell[0]->cell[0]) == LVAL_SYM, LERR_TYPE, "Function '%s' cannot bind non-symbol. Got %s, expected %s", \
+        func, ltype_name(LVAL_TYPE(v->cell[0]->cell[0])), ltype_name(LVAL_SYM))
+
+lval *builtin_dotimes(lenv *e, lval *v){
+    LASSERT_NUM("dotimes", v, 3);
+    LASSERT_LOOP_VAR("dotimes", v);
+    LASSERT_TYPE("dotimes", v, 1, LVAL_NUM);
+    LASSERT_TYPE("dotimes", v, 2, LVAL_QEXPR);
+
+    long n = lval_num_value(v->cell[1]);
+    lval *vars = lval_pop(v, 0);
+    lloop body;
+    lloop_init(&body, e, vars, lval_pop(v, 1));
+    lval_del(v);
+
+    lval *r = NULL;
+    for(long i = 0; i < n && !r; i++) {
+        lloop_set(&body, lval_num(i));
+        lval *x = lloop_run(&body);
+        if(LVAL_TYPE(x) == LVAL_ERR) r = x;
+        else lval_del(x);
+    }
+
+    lloop_free(&body);
+    return r ? r : lval_sexpr();
+}
+
+lval *builtin_foreach(lenv *e, lval *v){
+    LASSERT_NUM("foreach", v, 3);
+    LASSERT_LOOP_VAR("foreach", v);
+    LASSERT_SEQ("foreach", v, 1);
+    LASSERT_TYPE("foreach", v, 2, LVAL_QEXPR);
+
+    lval *vars = lval_pop(v, 0);
+    lloop body;
+    lloop_init(&body, e, vars, lval_pop(v, 1));
+    lval *l = lval_take(v, 0);
+
+    lval *r = NULL;
+    int n = lval_len(l);
+    for(int i = 0; i < n && !r; i++) {
+        lloop_set(&body, lhof_item(l, i));
+        lval *x = lloop_run(&body);
+        if(LVAL_TYPE(x) == LVAL_ERR) r = x;
+        else lval_del(x);
+    }
+
+    lval_del(l);
+    lloop_free(&body);
+    return r ? r : lval_sexpr();
+}
+
+// Call "f" with "x", and "y" too unless it is NULL. The arguments are
+// consumed, "f" isn't.
+lval *lval_apply(lenv *e, lval *f, lval *x, lval *y){
+    lval *args[3] = { lval_copy(f), x, y };
+    return lvm_apply(e, args, y ? 3 : 2);
+}
+
+// New reference to the value at index "i" of the list or array "l"
+lval *lhof_item(lval *l, int i){
+    if(l->type == LVAL_ARR) return l->elem == LARR_INT ? lval_num(LVAL_I64(l)[i]) : lval_dbl(LVAL_F64(l)[i]);
+    return lval_copy(l->type == LVAL_VEC ? lvec_get(l->vec, i) : l->cell[i]);
+}
+
+// The Q-Expression "r" that "func" made from "l" as the same kind of
+// sequence as "l". The values made from an array must be numbers.
+lval *lhof_result(lval *l, lval *r, char *func){
+    if(LVAL_TYPE(r) == LVAL_ERR) return r;
+    if(l->type == LVAL_VEC) return lval_vec_from(r);
+    if(l->type != LVAL_ARR) return r;
+
+    int i = larr_non_number(r);
+    if(i >= 0) {
+        lval *err = lval_err(LERR_TYPE, "Function '%s' made a %s from an array, expected %s or %s", func,
+                             ltype_name(LVAL_TYPE(r->cell[i])), ltype_name(LVAL_NUM), ltype_name(LVAL_DBL));
+        lval_del(r);
+        return err;
+    }
+    return larr_from(r, r->count ? LARR_INT : l->elem);
+}
+
+// Empty Q-Expression with room for "n" values
+lval *lhof_out(int n){
+    lval *x = lval_qexpr();
+    x->cell = lcell_resize(NULL, 0, n);
+    x->cap = n;
+    return x;
+}
+
+lval *builtin_map(lenv *e, lval *v){
+    LASSERT_NUM("map", v, 2);
+    LASSERT_TYPE("map", v, 0, LVAL_FUN);
+    LASSERT_SEQ("map", v, 1);
+
+    lval *f = lval_pop(v, 0);
+    lval *l = lval_take(v, 0);
+    int n = lval_len(l);
+
+    // Each value is replaced by the value of "f" for it
+    if(l->type == LVAL_QEXPR && lval_unique(l)) {
+        for(int i = 0; i < n; i++) {
+            l->cell[i] = lval_apply(e, f, l->cell[i], NULL);
+            if(LVAL_TYPE(l->cell[i]) == LVAL_ERR) {
+                lval_del(f);
+                return lval_take(l, i);
+            }
+        }
+        lval_del(f);
+        return l;
+    }
+
+    lval *r = lhof_out(n);
+    for(int i = 0; i < n; i++) {
+        lval *x = lval_apply(e, f, lhof_item(l, i), NULL);
+        if(LVAL_TYPE(x) == LVAL_ERR) {
+            lval_del(r);
+            r = x;
+            break;
+        }
+        r->cell[r->count++] = x;
+    }
+
+    lval_del(f);
+    r = lhof_result(l, r, "map");
+    lval_del(l);
+    return r;
+}
+
+lval *builtin_filter(lenv *e, lval *v){
+    LASSERT_NUM("filter", v, 2);
+    LASSERT_TYPE("filter", v, 0, LVAL_FUN);
+    LASSERT_SEQ("filter", v, 1);
+
+    lval *f = lval_pop(v, 0);
+    lval *l = lval_take(v, 0);
+    int n = lval_len(l);
+
+    // The values kept are moved to the front
+    if(l->type == LVAL_QEXPR && lval_unique(l)) {
+        int j = 0;
+        for(int i = 0; i < n; i++) {
+            lval *x = l->cell[i];
+            lval *c = lval_apply(e, f, lval_copy(x), NULL);
+            int t = lval_truth(c);
+            if(t < 0) {
+                // The rest is released with the list
+                while(i < n) l->cell[j++] = l->cell[i++];
+                l->count = j;
+                lval_del(f);
+                lval_del(l);
+                return lval_cond_err(c);
+            }
+            lval_del(c);
+            if(t) l->cell[j++] = x;
+            else lval_del(x);
+        }
+        l->count = j;
+        lval_del(f);
+        return l;
+    }
+
+    lval *r = lhof_out(n);
+    for(int i = 0; i < n; i++) {
+        lval *x = lhof_item(l, i);
+        lval *c = lval_apply(e, f, lval_copy(x), NULL);
+        int t = lval_truth(c);
+        if(t < 0) {
+            lval_del(x);
+            lval_del(r);
+            r = lval_cond_err(c);
+            break;
+        }
+        lval_del(c);
+        if(t) r->cell[r->count++] = x;
+        else lval_del(x);
+    }
+
+    lval_del(f);
+    r = lhof_result(l, r, "filter");
+    lval_del(l);
+    return r;
+}
+
+lval *builtin_foldl(lenv *e, lval *v) { return builtin_fold(e, v, 0); }
+lval *builtin_foldr(lenv *e, lval *v) { return builtin_fold(e, v, 1); }
+
+lval *builtin_fold(lenv *e, lval *v, int right){
+    char *func = right ? "foldr" : "foldl";
+    LASSERT_NUM(func, v, 3);
+    LASSERT_TYPE(func, v, 0, LVAL_FUN);
+    LASSERT_SEQ(func, v, 2);
+
+    lval *f = lval_pop(v, 0);
+    lval *acc = lval_pop(v, 0);
+    lval *l = lval_take(v, 0);
+    int n = lval_len(l);
+
+    for(int i = 0; i < n && LVAL_TYPE(acc) != LVAL_ERR; i++) {
+        if(right) acc = lval_apply(e, f, lhof_item(l, n - 1 - i), acc);
+        else acc = lval_apply(e, f, acc, lhof_item(l, i));
+    }
+
+    lval_del(f);
+    lval_del(l);
+    return acc;
+}
+
+lval *builtin_reduce(lenv *e, lval *v){
+    LASSERT_NUM("reduce", v, 2);
+    LASSERT_TYPE("reduce", v, 0, LVAL_FUN);
+    LASSERT_SEQ("reduce", v, 1);
+    LASSERT(v, lval_len(v->cell[1]) > 0, LERR_VALUE, "Function 'reduce' passed an empty list");
+
+    lval *f = lval_pop(v, 0);
+    lval *l = lval_take(v, 0);
+    int n = lval_len(l);
+
+    // foldl from the first value
+    lval *acc = lhof_item(l, 0);
+    for(int i = 1; i < n && LVAL_TYPE(acc) != LVAL_ERR; i++) {
+        acc = lval_apply(e, f, acc, lhof_item(l, i));
+    }
+
+    lval_del(f);
+    lval_del(l);
+    return acc;
+}
+
+lval *builtin_head(lenv *e, lval *v){
+    // Check for errors
+    LASSERT(v, (v->count == 1), LERR_ARITY, "Function 'head' passed too many arguments. Got %i, Expected %i", v->count, 1);
+    LASSERT(v, lval_is_list(v->cell[0]), LERR_TYPE, "Function 'head' passed incorrect type. Got %s, expected %s or %s.",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+    LASSERT(v, (lval_len(v->cell[0]) != 0), LERR_VALUE, "Function 'head' passed \"{}\"!");
+
+    // Input OK, take the first argument
+    lval *x = lval_take(v, 0);
+
+    // Vectors are never modified, the head goes in a new one
+    if(x->type == LVAL_VEC) {
+        lval *first = lvec_get(x->vec, 0);
+        lval *h = lval_vec(lvec_leaf(&first, 1));
+        lval_del(x);
+        return h;
+    }
+
+    // Shared list, only the head is copied
+    if(x->refs > 1) {
+        lval *h = lval_slice(x, 0, 1);
+        lval_del(x);
+        return h;
+    }
+
+    // Delete all elements that are not head and return
+    while (x->count > 1) lval_del(lval_pop(x, x->count - 1));
+    return x;
+}
+
+lval *builtin_tail(lenv *e, lval *v){
+    // Check for errors
+    LASSERT(v, (v->count == 1), LERR_ARITY, "Function 'tail' passed too many arguments. Got %i, Expected %i", v->count, 1);
+    LASSERT(v, lval_is_list(v->cell[0]), LERR_TYPE, "Function 'tail' passed incorrect type. Got %s, expected %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+    LASSERT(v, (lval_len(v->cell[0]) != 0), LERR_VALUE, "Function 'tail' passed \"{}\"!");
+
+    // Input OK, take the first argument
+    lval *x = lval_take(v, 0);
+
+    // Vector, split the first value off
+    if(x->type == LVAL_VEC) {
+        lvec *l, *r;
+        lvec_split(lvec_copy(x->vec), 1, &l, &r);
+        lvec_del(l);
+        lval_del(x);
+        return lval_vec(r);
+    }
+
+    // Shared list, copy everything but the first element
+    if(x->refs > 1) {
+        lval *t = lval_slice(x, 1, x->count);
+        lval_del(x);
+        return t;
+    }
+
+    // Delete first element and return
+    lval_del(lval_pop(x, 0));
+    return x;
+}
+
+lval *builtin_list(lenv *e, lval *v) {
+    LASSERT(v, (LVAL_TYPE(v) == LVAL_SEXPR), LERR_TYPE, "Function 'list' passed incorrect type. Got %s, expected %s",
+            ltype_name(LVAL_TYPE(v)), ltype_name(LVAL_SEXPR));
+
+    v->type = LVAL_QEXPR;
+    return v;
+}
+
+lval *builtin_eval(lenv *e, lval *v){
+    LASSERT(v, (v->count == 1), LERR_ARITY, "Function 'eval' passed too many arguments. Got %i, expected 1", v->count);
+    LASSERT(v, lval_is_list(v->cell[0]), LERR_TYPE, "Function 'eval' passed incorrect type. Got %s, expected %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+    lval *x = lval_take(v, 0);
+    if(x->type == LVAL_VEC) return lval_eval(e, lval_vec_to_expr(x, LVAL_SEXPR));
+
+    x = lval_unshare(x);
+    x->type = LVAL_SEXPR;
+    return lval_eval(e, x);
+}
+
+lval *builtin_join(lenv *e, lval *v) {
+    for(int i = 0; i < v->count; i++) {
+        LASSERT(v, lval_is_list(v->cell[i]), LERR_TYPE, "Function 'join' passed incorrect type. Argument %i was a %s , expected a %s or %s", i + 1, ltype_name(LVAL_TYPE(v->cell[i])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+    }
+
+    // Joining anything with a vector gives a vector
+    for(int i = 0; i < v->count; i++) {
+        if(v->cell[i]->type != LVAL_VEC) continue;
+
+        lvec *t = NULL;
+        for(int j = 0; j < v->count; j++) {
+            lval *x = v->cell[j];
+            if(x->type == LVAL_VEC) t = lvec_join(t, lvec_copy(x->vec));
+            else t = lvec_from_cells(t, x->cell, x->count);
+        }
+        lval_del(v);
+        return lval_vec(t);
+    }
+
+    lval *x = lval_pop(v, 0);
+
+    while(v->count) {
+        x = lval_join(x, lval_pop(v, 0));
+    }
+
+    lval_del(v);
+    return x;
+}
+
+lval *builtin_cons(lenv *e, lval *v) {
+    LASSERT(v, (v->count == 2), LERR_ARITY, "Function 'cons' passed incorrect amount of arguments. Got %i, expected 2", v->count);
+    LASSERT(v, lval_is_list(v->cell[1]), LERR_TYPE, "Function 'cons' passed incorrect type. Got %s, expected %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[1])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+    // Pop the first argument
+    lval *x = lval_pop(v, 0);
+
+    // Take the second argument (v deleted)
+    lval *y = lval_take(v, 0);
+
+    // Vector, join a single value leaf in front of it
+    if(y->type == LVAL_VEC) {
+        lvec *t = lvec_join(lvec_leaf(&x, 1), lvec_copy(y->vec));
+        lval_del(x);
+        lval_del(y);
+        return lval_vec(t);
+    }
+
+    // Create a new QExpr
+    lval *z = lval_qexpr();
+    // Add the first argument to it as is
+    z = lval_add(z, x);
+
+    // Then join the z & y lvals (y deleted)
+    z = lval_join(z, y);
+
+    return z;
+}
+
+lval *builtin_len(lenv *e, lval *v) {
+    LASSERT(v, (v->count == 1), LERR_ARITY, "Function 'len' passed too many arguments. Got %i, expected 1", v->count);
+    LASSERT(v, lval_is_list(v->cell[0]) || LVAL_TYPE(v->cell[0]) == LVAL_ARR, LERR_TYPE, "Function 'len' passed incorrect type. Got %s, expected %s, %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC), ltype_name(LVAL_ARR));
+
+    lval *x = lval_num(lval_len(v->cell[0]));
+    lval_del(v);
+    return x;
+}
+
+lval *builtin_init(lenv *e, lval *v) {
+    LASSERT(v, (v->count == 1), LERR_ARITY, "Function 'init' passed too many arguments. Got %i, expected 1", v->count);
+    LASSERT(v, lval_is_list(v->cell[0]), LERR_TYPE, "Function 'init' passed incorrect type. Got %s, expected %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+    LASSERT(v, (lval_len(v->cell[0]) != 0), LERR_VALUE, "Function 'init' passed \"{}\"!");
+
+    // Input OK, take the first argument
+    lval *x = lval_take(v, 0);
+
+    // Vector, split the last value off
+    if(x->type == LVAL_VEC) {
+        lvec *l, *r;
+        lvec_split(lvec_copy(x->vec), lvec_count(x->vec) - 1, &l, &r);
+        lvec_del(r);
+        lval_del(x);
+        return lval_vec(l);
+    }
+
+    // Shared list, copy everything but the last element
+    if(x->refs > 1) {
+        lval *i = lval_slice(x, 0, x->count - 1);
+        lval_del(x);
+        return i;
+    }
+
+    // Delete the last element and return
+    lval_del(lval_pop(x, x->count - 1));
+    return x;
+}
+
+// Vector with the values of a Q-Expression
+lval *builtin_vec(lenv *e, lval *v) {
+    LASSERT(v, (v->count == 1), LERR_ARITY, "Function 'vec' passed too many arguments. Got %i, expected 1", v->count);
+    LASSERT(v, lval_is_list(v->cell[0]), LERR_TYPE, "Function 'vec' passed incorrect type. Got %s, expected %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC));
+
+    lval *x = lval_take(v, 0);
+    if(x->type == LVAL_VEC) return x;
+    return lval_vec_from(x);
+}
+
+// Value at a 0 based index of a list
+lval *builtin_nth(lenv *e, lval *v) {
+    LASSERT(v, (v->count == 2), LERR_ARITY, "Function 'nth' passed incorrect amount of arguments. Got %i, expected 2", v->count);
+    LASSERT(v, lval_is_list(v->cell[0]) || LVAL_TYPE(v->cell[0]) == LVAL_ARR, LERR_TYPE, "Function 'nth' passed incorrect type. Got %s, expected %s, %s or %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR), ltype_name(LVAL_VEC), ltype_name(LVAL_ARR));
+    LASSERT_TYPE("nth", v, 1, LVAL_NUM);
+
+    lval *x = v->cell[0];
+    long i = lval_num_value(v->cell[1]);
+    LASSERT(v, (i >= 0 && i < lval_len(x)), LERR_VALUE, "Function 'nth' index %li out of range for a list of %i", i, lval_len(x));
+
+    lval *y;
+    if(x->type == LVAL_ARR) y = x->elem == LARR_INT ? lval_num(LVAL_I64(x)[i]) : lval_dbl(LVAL_F64(x)[i]);
+    else y = lval_copy(x->type == LVAL_VEC ? lvec_get(x->vec, i) : x->cell[i]);
+    lval_del(v);
+    return y;
+}
+
+// Q-Expressions and vectors are both lists
+int lval_is_list(lval *v){
+    return LVAL_TYPE(v) == LVAL_QEXPR || LVAL_TYPE(v) == LVAL_VEC;
+}
+
+int lval_len(lval *v){
+    if(v->type == LVAL_ARR) return v->len;
+    return v->type == LVAL_VEC ? lvec_count(v->vec) : v->count;
+}
+
+lval *builtin_def(lenv *e, lval *v){
+    LASSERT(v, (LVAL_TYPE(v->cell[0]) == LVAL_QEXPR), LERR_TYPE, "Function 'def' passed incorrect type. Got %s, expected %s",
+            ltype_name(LVAL_TYPE(v->cell[0])), ltype_name(LVAL_QEXPR));
+
+    // Check that the first argument a symbol list
+    lval *syms = v->cell[0];
+    for (int i = 0; i < syms->count; i++) {
+        LASSERT(v, (LVAL_TYPE(syms->cell[i]) == LVAL_SYM), LERR_TYPE, "Function 'def' cannot define non-symbol. Argument %i was a %s, expected %s", i + 1, ltype_name(LVAL_TYPE(syms->cell[i])), ltype_name(LVAL_SYM));
+    }
+
+    LASSERT(v, !lpar_depth, LERR_VALUE, "Function 'def' cannot define in a parallel map");
+
+    // Check that there are the same amount of symbols and values
+    LASSERT(v, (syms->count == v->count-1), LERR_ARITY, "Function 'def' the amount of symbols passed don't match the amount of values. Got %i symbols and %i values", syms->count, v->count-1);
+
+    for (int i = 0; i < syms->count; i++) {
+        lenv_def(e, syms->cell[i], v->cell[i+1]);
+    }
+
+    lval_del(v);
+    // Return empty expression "()"
+    return lval_sexpr();
+}
+
+lval *builtin_exit(lenv *e, lval *v) {
+    // The prompt checks the root environment, lambdas call this from theirs
+    while(e->par) e = e->par;
+    e->run = 0;
+    lval_del(v);
+    return lval_sym("Exiting");
+}
+
+lval *builtin_printenv(lenv *e, lval *v){
+    for(int i = 0; i < e->count; i++) {
+        printf("%s\n", e->syms[i]);
+    }
+    lval_del(v);
+    return lval_sexpr();
+}
+
+// The sections of "stats", NULL terminated
+static lstats_section lstats_sections[] = {
+    { "mem", lstats_mem },
+    { "cache", lstats_cache },
+    { "fold", lstats_fold },
+#ifdef LISPY_JIT
+    { "jit", lstats_jit },
+#endif
+#ifdef LISPY_GC
+    { "gc", lstats_gc },
+#endif
+    { NULL, NULL }
+};
+
+lstats_section *lstats_find(char *name){
+    for(lstats_section *s = lstats_sections; s->name; s++) {
+        if(strcmp(s->name, name) == 0) return s;
+    }
+    return NULL;
+}
+
+lval *builtin_stats(lenv *e, lval *v){
+    LASSERT(v, v->count <= 1, LERR_ARITY, "Function 'stats' passed too many arguments. Got %i, expected 0 or 1", v->count);
+    if(v->count == 0) {
+        for(lstats_section *s = lstats_sections; s->name; s++) {
+            printf("%s\n", s->name);
+            s->print();
+        }
+        lval_del(v);
+        return lval_sexpr();
+    }
+
+    LASSERT_TYPE("stats", v, 0, LVAL_QEXPR);
+    lval *names = v->cell[0];
+    // Nothing is printed unless every name is known
+    for(int i = 0; i < names->count; i++) {
+        LASSERT(v, LVAL_TYPE(names->cell[i]) == LVAL_SYM, LERR_TYPE,
+                "Function 'stats' passed a %s, expected Symbol", ltype_name(LVAL_TYPE(names->cell[i])));
+        LASSERT(v, lstats_find(names->cell[i]->sym), LERR_VALUE,
+                "Function 'stats' has no statistics named '%s'", names->cell[i]->sym);
+    }
+    for(int i = 0; i < names->count; i++) lstats_find(names->cell[i]->sym)->print();
+    lval_del(v);
+    return lval_sexpr();
+}
+
+// The memory pool
+void lstats_mem(void){
+    printf("%6s %8s %12s %12s %12s\n", "size", "slabs", "allocs", "frees", "live");
+    for(int i = 0; i < LPOOL_CLASSES; i++) {
+        lpool_class *c = &lpool[i];
+        printf("%6zu %8li %12li %12li %12li\n", lpool_sizes[i], c->slabs, c->allocs, c->frees, c->allocs - c->frees);
+    }
+    printf("%6s %8s %12li %12li %12li\n", "large", "-", lpool_large_allocs, lpool_large_frees,
+            lpool_large_allocs - lpool_large_frees);
+    printf("envs: %li made, %li reused, %i spare\n", lenv_allocs, lenv_reused, lenv_spare_count);
+}
+
+// How many global lookups used the binding cached in the symbol
+void lstats_cache(void){
+    long total = lenv_cache_hits + lenv_cache_misses;
+    printf("hits:    %li\n", lenv_cache_hits);
+    printf("misses:  %li\n", lenv_cache_misses);
+    printf("hit rate: %.1f%%\n", total ? 100.0 * lenv_cache_hits / total : 0.0);
+}
+
+// How many calls constant folding replaced by their value
+void lstats_fold(void){
+    printf("folded:  %li calls\n", lfold_calls);
+    printf("removed: %li nodes\n", lfold_nodes);
+}
+
+// The S-Expressions the tree walker is evaluating, innermost first. The
+// children that were evaluated are shown as their values, the one being
+// evaluated as "...".
+lval *builtin_frames(lenv *e, lval *v){
+    LASSERT_NUM("frames", v, 0);
+    lval_del(v);
+
+    lval *x = lval_qexpr();
+    for(leval *ev = leval_current; ev; ev = ev->outer) {
+        for(int i = ev->count - 1; i >= 0; i--) {
+            leval_frame *fr = ev->frames + i;
+            if(!fr->v) continue;
+            lval *f = lval_unshare(lval_copy(fr->v));
+            if(i + 1 < ev->count && fr->next < f->count) {
+                f->cell[fr->next] = lval_sym("...");
+            }
+            x = lval_add(x, f);
+        }
+    }
+    return x;
+}
+
+// Builtins that are called even when they appear alone in an S-Expression
+int builtin_takes_no_args(lval *f){
+    if(LVAL_TYPE(f) != LVAL_FUN) return 0;
+    return f->builtin == builtin_exit || f->builtin == builtin_printenv || f->builtin == builtin_stats
+        || f->builtin == builtin_frames;
+}
+
+lval *builtin_lambda(lenv *e, lval *v){
+    // Check two arguments, each of which are Q-Expressions
+    LASSERT_NUM("\\", v, 2);
+    LASSERT_TYPE("\\", v, 0, LVAL_QEXPR);
+    LASSERT_TYPE("\\", v, 1, LVAL_QEXPR);
+
+    // Check that the first Q-Expression contains only symbols
+    for(int i = 0; i < v->cell[0]->count; i++) {
+        LASSERT(v, (LVAL_TYPE(v->cell[0]->cell[i]) == LVAL_SYM), LERR_TYPE, "Cannot define non-symbol. Got %s, expected %s",
+                ltype_name(LVAL_TYPE(v->cell[0]->cell[i])), ltype_name(LVAL_SYM));
+    }
+
+    // Pop first two arguments and pass them to lval_lambda
+    lval *formals = lval_pop(v, 0);
+    lval *body = lval_pop(v, 0);
+    body = lfold_form(e, body, formals);
+    body = lval_resolve(body, formals, e);
+    lval_del(v);
+
+    // The lambda shares the environment it is made in
+    lval *f = lval_lambda(formals, body, lenv_ref(e));
+    if(lvm_enabled) f->code = lcode_compile(body);
+    return f;
+}
+
+// Give the symbols a lambda body uses their lexical address, so calls don't
+// look them up by name. The formals are in the frame of the call, depth 0.
+// Free symbols bound in one of the frames around "e", where the lambda is
+// made, get the depth and slot of the nearest one: those frames are
+// filled when they are made and never change, so the binding a name
+// lookup would find stays the same. Symbols bound nowhere but the global
+// environment keep their name and cache. Only symbols the body evaluates
+// directly are resolved, nested Q-Expressions are data until something
+// evaluates them and keep using names.
+lval *lval_resolve(lval *body, lval *formals, lenv *e){
+    // Duplicated formals don't get one slot each
+    for(int i = 0; i < formals->count; i++) {
+        for(int j = i + 1; j < formals->count; j++) {
+            if(formals->cell[i]->sym == formals->cell[j]->sym) return body;
+        }
+    }
+
+    // The body itself is evaluated as an S-Expression
+    body = lval_unshare(body);
+    for(int i = 0; i < body->count; i++) {
+        body->cell[i] = lval_resolve_expr(body->cell[i], formals, e);
+    }
+    return body;
+}
+
+lval *lval_resolve_expr(lval *v, lval *formals, lenv *e){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_SYM: {
+            int depth = 0;
+            int slot = lval_formal_slot(formals, v->sym);
+            // Then the enclosing frames, the call's parent is "e"
+            for(lenv *f = e; slot < 0 && f->par; f = f->par) {
+                depth++;
+                slot = lenv_find(f, v->sym);
+            }
+            if(slot < 0) depth = -1;
+            if(v->depth == depth && v->slot == slot) return v;
+            // Symbols can be shared, the address goes in a new one
+            lval *x = lval_sym(v->sym);
+            x->depth = depth;
+            x->slot = slot;
+            lval_del(v);
+            return x;
+        }
+
+        case LVAL_SEXPR:
+            v = lval_unshare(v);
+            for(int i = 0; i < v->count; i++) {
+                v->cell[i] = lval_resolve_expr(v->cell[i], formals, e);
+            }
+            return v;
+
+        default:
+            return v;
+    }
+}
+
+// Frame slot lval_call binds "sym" to, or -1 if it isn't a formal
+int lval_formal_slot(lval *formals, char *sym){
+    int slot = 0;
+    for(int i = 0; i < formals->count; i++) {
+        if(formals->cell[i]->sym == lsym_amp) continue;
+        if(formals->cell[i]->sym == sym) return slot;
+        slot++;
+    }
+    return -1;
+}
+
+// Fold the constant call "v" and the ones inside it. "v" is evaluated in
+// "e", by a lambda with the "formals" or at the prompt when they are NULL.
+// Returns the new value, a folded call for "v" when it was folded.
+lval *lval_fold(lenv *e, lval *v, lval *formals){
+    if(LVAL_TYPE(v) != LVAL_SEXPR) return v;
+    v = lval_fold_cells(e, v, formals);
+
+    lbuiltin b = v->count > 1 ? lfold_builtin(e, v->cell[0], formals) : NULL;
+    if(!b) return v;
+    for(int i = 1; i < v->count; i++) {
+        if(!lval_is_literal(lfold_value(v->cell[i]))) return v;
+    }
+
+    lval *args = lval_sexpr();
+    for(int i = 1; i < v->count; i++) args = lval_add(args, lval_copy(lfold_value(v->cell[i])));
+    lval *r = b(e, args);
+    if(LVAL_TYPE(r) == LVAL_ERR) {
+        lval_del(r);
+        return v;
+    }
+
+    lfold_calls++;
+    lfold_nodes += lval_nodes(v) - lval_nodes(r);
+    // The call stays next to its value, for when its builtin is replaced
+    lval *x = lval_add(lval_sexpr(), lval_fun(builtin_folded));
+    x = lval_add(x, r);
+    x = lval_add(x, v);
+    return lval_add(x, lval_fun(b));
+}
+
+// Fold the calls among the cells of "v", like a lambda body that is a
+// Q-Expression evaluated as an S-Expression
+lval *lval_fold_cells(lenv *e, lval *v, lval *formals){
+    v = lval_unshare(v);
+    for(int i = 0; i < v->count; i++) {
+        v->cell[i] = lval_fold(e, v->cell[i], formals);
+    }
+    return v;
+}
+
+// Fold "v" like lval_fold when folding is on and "v" doesn't call "def":
+// the calls after a definition would be folded with the bindings from
+// before it
+lval *lfold_form(lenv *e, lval *v, lval *formals){
+    if(!lfold_enabled || lfold_defines(e, v, formals)) return v;
+    return LVAL_TYPE(v) == LVAL_QEXPR ? lval_fold_cells(e, v, formals) : lval_fold(e, v, formals);
+}
+
+// Whether an S-Expression or Q-Expression in "v" starts with a symbol
+// bound to "def"
+int lfold_defines(lenv *e, lval *v, lval *formals){
+    if(LVAL_TYPE(v) != LVAL_SEXPR && LVAL_TYPE(v) != LVAL_QEXPR) return 0;
+    if(v->count > 0 && LVAL_TYPE(v->cell[0]) == LVAL_SYM
+        && !(formals && lval_formal_slot(formals, v->cell[0]->sym) >= 0)) {
+        lval *f = lval_lookup(e, v->cell[0]);
+        int def = LVAL_TYPE(f) == LVAL_FUN && f->builtin == builtin_def;
+        lval_del(f);
+        if(def) return 1;
+    }
+    for(int i = 0; i < v->count; i++) {
+        if(lfold_defines(e, v->cell[i], formals)) return 1;
+    }
+    return 0;
+}
+
+// Whether "v" is a folded call, see "Constant folding"
+int lval_is_folded(lval *v){
+    return LVAL_TYPE(v) == LVAL_SEXPR && v->count == 4 && LVAL_TYPE(v->cell[0]) == LVAL_FUN
+        && v->cell[0]->builtin == builtin_folded;
+}
+
+// The value "v" has when it is a folded call, otherwise "v" itself
+lval *lfold_value(lval *v){
+    return lval_is_folded(v) ? v->cell[1] : v;
+}
+
+// Whether the folded call "v" still calls the builtin it was folded with
+// in "e", and so do the folded calls among its arguments. The lookups go
+// through the symbols' caches, see "Environments".
+int lfold_valid(lenv *e, lval *v){
+    lval *call = v->cell[2];
+    lval *f = lval_lookup(e, call->cell[0]);
+    int valid = LVAL_TYPE(f) == LVAL_FUN && f->builtin == v->cell[3]->builtin;
+    lval_del(f);
+    for(int i = 1; valid && i < call->count; i++) {
+        if(lval_is_folded(call->cell[i])) valid = lfold_valid(e, call->cell[i]);
+    }
+    return valid;
+}
+
+// A folded call evaluated like any other function, with its value, the
+// value of its call and its builtin as arguments. Evaluators run it as a
+// special form instead, see LFORM_FOLD.
+lval *builtin_folded(lenv *e, lval *v){
+    (void)e;
+    return lval_take(v, 1);
+}
+
+// The builtin "sym" is bound to in "e" if it has no side effects, or NULL
+lbuiltin lfold_builtin(lenv *e, lval *sym, lval *formals){
+    if(LVAL_TYPE(sym) != LVAL_SYM) return NULL;
+    if(formals && lval_formal_slot(formals, sym->sym) >= 0) return NULL;
+
+    lval *f = lval_lookup(e, sym);
+    lbuiltin b = LVAL_TYPE(f) == LVAL_FUN ? f->builtin : NULL;
+    lval_del(f);
+    if(b == builtin_add || b == builtin_sub || b == builtin_mul || b == builtin_div
+        || b == builtin_rem || b == builtin_min || b == builtin_max || b == builtin_head
+        || b == builtin_tail || b == builtin_list || b == builtin_len || b == builtin_lt
+        || b == builtin_gt || b == builtin_le || b == builtin_ge || b == builtin_eq
+        || b == builtin_ne) return b;
+    return NULL;
+}
+
+// Values that evaluate to themselves
+int lval_is_literal(lval *v){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_NUM:
+        case LVAL_BIG:
+        case LVAL_DBL:
+        case LVAL_QEXPR:
+        case LVAL_VEC:
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-        if (strcmp(op, "+") == 0) x->num += y->num;
-        if (strcmp(op, "-") == 0) x->num -= y->num;
-        if (strcmp(op, "*") == 0) x->num *= y->num;
-        if (strcmp(op, "/") == 0) {
-            // If the second operator is zero return an error
-            if(y->num == 0) {
-                lval_del(v);
-                lval_del(x);
-                lval_del(y);
-                return lval_err("Divide by zero");
-            }
-            x->num /= y->num;
-        }
-        if (strcmp(op, "%") == 0) {
-            // If the second operator is zero return an error
-            if(y->num == 0) {
-                lval_del(v);
-                lval_del(x);
-                lval_del(y);
-                return lval_err("Divide by zero");
-            }
-            x->num %= y->num;
-        }
-        if (strcmp(op, "^") == 0) {
-            // If the y value is 0 we set the x value to 1,
-            // because x^0 is always 1
-            if(y->num == 0) x->num = 1;
-            else {
-                long temp = x->num;
-                for(int i = 1; i < y->num; i++) {
-                    x->num *= temp;
-                }
-            }
-        }
-        if (strcmp(op, "min") == 0) {
-            if(x->num > y->num) x->num = y->num;
-        }
-        if (strcmp(op, "max") == 0) {
-            if(x->num < y->num) x->num = y->num;
+// Number of lvals in "v", the values in expressions and vectors included
+long lval_nodes(lval *v){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_SEXPR:
+        case LVAL_QEXPR: {
+            if(lval_is_folded(v)) return lval_nodes(v->cell[1]);
+            long n = 1;
+            for(int i = 0; i < v->count; i++) n += lval_nodes(v->cell[i]);
+            return n;
         }
-        // Delete the temporary lval
-        lval_del(y);
+        case LVAL_VEC:
+            return 1 + lvec_count(v->vec);
+        default:
+            return 1;
     }
-
-    // Delete the old lval and return the result
-    lval_del(v);
-    return x;
 }
 
-lval *builtin_head(lenv *e, lval *v){
-    // Check for errors
-    LASSERT(v, (v->count == 1), "Function 'head' passed too many arguments. Got %i, Expected %i", v->count, 1);
-    LASSERT(v, (v->cell[0]->type == LVAL_QEXPR), "Function 'head' passed incorrect type. Got %s, expected %s.",
-            ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-    LASSERT(v, (v->cell[0]->count != 0), "Function 'head' passed \"{}\"!");
+lval *lval_join(lval *x, lval *y) {
+    x = lval_unshare(x);
 
-    // Input OK, take the first argument
-    lval *x = lval_take(v, 0);
+    // For each cell in 'y' add it to 'x'. The cells of a shared 'y' get
+    // a new reference, otherwise they are moved over.
+    int shared = y->refs > 1;
+    for(int i = 0; i < y->count; i++) {
+        x = lval_add(x, shared ? lval_copy(y->cell[i]) : y->cell[i]);
+    }
+    if(!shared) y->count = 0;
 
-    // Delete all elements that are not head and return
-    while (x->count > 1) lval_del(lval_pop(x, 1));
+    // Delete the 'y' and return 'x'
+    lval_del(y);
     return x;
 }
 
-lval *builtin_tail(lenv *e, lval *v){
-    // Check for errors
-    LASSERT(v, (v->count == 1), "Function 'tail' passed too many arguments. Got %i, Expected %i", v->count, 1);
-    LASSERT(v, (v->cell[0]->type == LVAL_QEXPR), "Function 'tail' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-    LASSERT(v, (v->cell[0]->count != 0), "Function 'tail' passed \"{}\"!");
+// New vector node. Leaves take "count" values, inner nodes two children.
+lvec *lvec_alloc(int height, int count){
+    lvec *t = lpool_alloc(height ? LVEC_NODE_SIZE : LVEC_LEAF_SIZE(count));
+    t->refs = 1;
+    t->height = height;
+    t->gc = 0;
+    t->count = count;
+    t->mark = 0;
+    return t;
+}
 
-    // Input OK, take the first argument
-    lval *x = lval_take(v, 0);
+lvec *lvec_copy(lvec *t){
+    if(t) t->refs++;
+    return t;
+}
 
-    // Delete first element and return
-    lval_del(lval_pop(x, 0));
-    return x;
+void lvec_del(lvec *t){
+    if(!t || --t->refs > 0) return;
+
+    if(t->height == 0) {
+        for(int i = 0; i < t->count; i++) lval_del(t->item[i]);
+        lpool_free(t, LVEC_LEAF_SIZE(t->count));
+    } else {
+        lvec_del(t->child[0]);
+        lvec_del(t->child[1]);
+        lpool_free(t, LVEC_NODE_SIZE);
+    }
 }
 
-lval *builtin_list(lenv *e, lval *v) {
-    LASSERT(v, (v->type == LVAL_SEXPR), "Function 'list' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->type), ltype_name(LVAL_SEXPR));
+int lvec_count(lvec *t){
+    return t ? t->count : 0;
+}
 
-    v->type = LVAL_QEXPR;
-    return v;
+int lvec_height(lvec *t){
+    return t ? t->height : -1;
 }
 
-lval *builtin_eval(lenv *e, lval *v){
-    LASSERT(v, (v->count == 1), "Function 'eval' passed too many arguments. Got %i, expected 1", v->count);
-    LASSERT(v, (v->cell[0]->type == LVAL_QEXPR), "Function 'eval' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+// Leaf with new references to "count" values
+lvec *lvec_leaf(lval **items, int count){
+    lvec *t = lvec_alloc(0, count);
+    for(int i = 0; i < count; i++) t->item[i] = lval_copy(items[i]);
+    return t;
+}
 
-    lval *x = lval_take(v, 0);
-    x->type = LVAL_SEXPR;
-    return lval_eval(e, x);
+// Inner node, takes the references to "l" and "r"
+lvec *lvec_node(lvec *l, lvec *r){
+    lvec *t = lvec_alloc((l->height > r->height ? l->height : r->height) + 1, l->count + r->count);
+    t->child[0] = l;
+    t->child[1] = r;
+    return t;
 }
 
-lval *builtin_join(lenv *e, lval *v) {
-    for(int i = 0; i < v->count; i++) {
-        LASSERT(v, (v->cell[i]->type == LVAL_QEXPR), "Function 'join' passed incorrect type. Argument %i was a %s , expected a %s", i + 1, ltype_name(v->cell[i]->type), ltype_name(LVAL_QEXPR));
+// Node of "l" and "r" whose heights differ by up to two, rotated back
+// into balance if needed. Takes both references.
+lvec *lvec_balance(lvec *l, lvec *r){
+    if(l->height > r->height + 1) {
+        lvec *a = lvec_copy(l->child[0]);
+        lvec *b = lvec_copy(l->child[1]);
+        lvec_del(l);
+        if(a->height >= b->height) return lvec_node(a, lvec_node(b, r));
+
+        lvec *b0 = lvec_copy(b->child[0]);
+        lvec *b1 = lvec_copy(b->child[1]);
+        lvec_del(b);
+        return lvec_node(lvec_node(a, b0), lvec_node(b1, r));
     }
 
-    lval *x = lval_pop(v, 0);
+    if(r->height > l->height + 1) {
+        lvec *a = lvec_copy(r->child[0]);
+        lvec *b = lvec_copy(r->child[1]);
+        lvec_del(r);
+        if(b->height >= a->height) return lvec_node(lvec_node(l, a), b);
 
-    while(v->count) {
-        x = lval_join(x, lval_pop(v, 0));
+        lvec *a0 = lvec_copy(a->child[0]);
+        lvec *a1 = lvec_copy(a->child[1]);
+        lvec_del(a);
+        return lvec_node(lvec_node(l, a0), lvec_node(a1, b));
     }
 
-    lval_del(v);
-    return x;
+    return lvec_node(l, r);
 }
 
-lval *builtin_cons(lenv *e, lval *v) {
-    LASSERT(v, (v->count == 2), "Function 'cons' passed incorrect amount of arguments. Got %i, expected 2", v->count);
-    LASSERT(v, (v->cell[1]->type == LVAL_QEXPR), "Function 'cons' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->cell[1]->type), ltype_name(LVAL_QEXPR));
+// Concatenate two trees, takes both references. Only the nodes along the
+// edge of the taller tree down to the height of the other one are rebuilt,
+// so this is O(log n).
+lvec *lvec_join(lvec *l, lvec *r){
+    if(!l) return r;
+    if(!r) return l;
+
+    // Small leaves are merged, so vectors built one value at a time still
+    // end up with full leaves
+    if(l->height == 0 && r->height == 0 && l->count + r->count <= LVEC_LEAF) {
+        lvec *t = lvec_alloc(0, l->count + r->count);
+        for(int i = 0; i < l->count; i++) t->item[i] = lval_copy(l->item[i]);
+        for(int i = 0; i < r->count; i++) t->item[l->count + i] = lval_copy(r->item[i]);
+        lvec_del(l);
+        lvec_del(r);
+        return t;
+    }
 
-    // Pop the first argument
-    lval *x = lval_pop(v, 0);
+    if(l->height > r->height + 1) {
+        lvec *a = lvec_copy(l->child[0]);
+        lvec *b = lvec_copy(l->child[1]);
+        lvec_del(l);
+        return lvec_balance(a, lvec_join(b, r));
+    }
 
-    // Take the second argument (v deleted)
-    lval *y = lval_take(v, 0);
+    if(r->height > l->height + 1) {
+        lvec *a = lvec_copy(r->child[0]);
+        lvec *b = lvec_copy(r->child[1]);
+        lvec_del(r);
+        return lvec_balance(lvec_join(l, a), b);
+    }
 
-    // Create a new QExpr
-    lval *z = lval_qexpr();
-    // Add the first argument to it as is
-    z = lval_add(z, x);
+    return lvec_node(l, r);
+}
 
-    // Then join the z & y lvals (y deleted)
-    z = lval_join(z, y);
+// Split "t" into its first "i" values and the rest, takes the reference
+// to "t". The pieces on each side of the path to "i" are joined back
+// together, which adds up to O(log n).
+void lvec_split(lvec *t, int i, lvec **l, lvec **r){
+    if(i <= 0) {
+        *l = NULL;
+        *r = t;
+        return;
+    }
+    if(i >= lvec_count(t)) {
+        *l = t;
+        *r = NULL;
+        return;
+    }
 
-    return z;
+    if(t->height == 0) {
+        *l = lvec_leaf(t->item, i);
+        *r = lvec_leaf(t->item + i, t->count - i);
+        lvec_del(t);
+        return;
+    }
+
+    lvec *a = lvec_copy(t->child[0]);
+    lvec *b = lvec_copy(t->child[1]);
+    lvec_del(t);
+
+    lvec *m;
+    if(i <= a->count) {
+        lvec_split(a, i, l, &m);
+        *r = lvec_join(m, b);
+    } else {
+        lvec_split(b, i - a->count, &m, r);
+        *l = lvec_join(a, m);
+    }
 }
 
-lval *builtin_len(lenv *e, lval *v) {
-    LASSERT(v, (v->count == 1), "Function 'len' passed too many arguments. Got %i, expected 1", v->count);
-    LASSERT(v, (v->cell[0]->type == LVAL_QEXPR), "Function 'len' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+// Value at index "i" of a tree, without a new reference
+lval *lvec_get(lvec *t, int i){
+    while(t->height) {
+        if(i < t->child[0]->count) {
+            t = t->child[0];
+        } else {
+            i -= t->child[0]->count;
+            t = t->child[1];
+        }
+    }
+    return t->item[i];
+}
 
-    return lval_num(v->cell[0]->count);
+// Append new references to "count" values to "t"
+lvec *lvec_from_cells(lvec *t, lval **cell, int count){
+    for(int i = 0; i < count; i += LVEC_LEAF) {
+        int n = count - i < LVEC_LEAF ? count - i : LVEC_LEAF;
+        t = lvec_join(t, lvec_leaf(cell + i, n));
+    }
+    return t;
 }
 
-lval *builtin_init(lenv *e, lval *v) {
-    LASSERT(v, (v->count == 1), "Function 'init' passed too many arguments. Got %i, expected 1", v->count);
-    LASSERT(v, (v->cell[0]->type == LVAL_QEXPR), "Function 'init' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
-    LASSERT(v, (v->cell[0]->count != 0), "Function 'init' passed \"{}\"!");
+// Add new references to the values of "t" to the expression "q"
+void lvec_append_to(lvec *t, lval *q){
+    if(!t) return;
+    if(t->height == 0) {
+        for(int i = 0; i < t->count; i++) lval_add(q, lval_copy(t->item[i]));
+    } else {
+        lvec_append_to(t->child[0], q);
+        lvec_append_to(t->child[1], q);
+    }
+}
 
-    // Input OK, take the first argument
-    lval *x = lval_take(v, 0);
+// Vector holding a list of the values of the Q-Expression "q" (deleted)
+lval *lval_vec_from(lval *q){
+    lvec *t = lvec_from_cells(NULL, q->cell, q->count);
+    lval_del(q);
+    return lval_vec(t);
+}
 
-    // Delete the last element and return
-    lval_del(lval_pop(x, x->count - 1));
+// Expression of "type" with the values of the vector "v" (deleted)
+lval *lval_vec_to_expr(lval *v, int type){
+    lval *x = type == LVAL_SEXPR ? lval_sexpr() : lval_qexpr();
+    lvec_append_to(v->vec, x);
+    lval_del(v);
     return x;
 }
 
-lval *builtin_def(lenv *e, lval *v){
-    LASSERT(v, (v->cell[0]->type == LVAL_QEXPR), "Function 'def' passed incorrect type. Got %s, expected %s",
-            ltype_name(v->cell[0]->type), ltype_name(LVAL_QEXPR));
+// Allocate "size" bytes from the pool
+void *lpool_alloc(size_t size){
+    if(size > LPOOL_MAX_SIZE) {
+        lpool_large_allocs++;
+        return malloc(size);
+    }
 
-    // Check that the first argument a symbol list
-    lval *syms = v->cell[0];
-    for (int i = 0; i < syms->count; i++) {
-        LASSERT(v, (syms->cell[i]->type == LVAL_SYM), "Function 'def' cannot define non-symbol. Argument %i was a %s, expected %s", i + 1, ltype_name(syms->cell[i]->type), ltype_name(LVAL_SYM));
+    int i = 0;
+    while(lpool_sizes[i] < size) i++;
+    lpool_class *c = &lpool[i];
+    c->allocs++;
+
+    // Reuse a released block if there is one
+    if(!c->free) lpool_reload(c, i);
+    if(c->free) {
+        lpool_block *b = c->free;
+        c->free = b->next;
+        c->nfree--;
+        return b;
     }
 
-    // Check that there are the same amount of symbols and values
-    LASSERT(v, (syms->count == v->count-1), "Function 'def' the amount of symbols passed don't match the amount of values. Got %i symbols and %i values", syms->count, v->count-1);
+    // Otherwise carve a new one from the slab, getting a new slab if needed
+    if(c->bump == c->end) {
+        size_t count = LPOOL_SLAB_SIZE / lpool_sizes[i];
+        c->bump = malloc(count * lpool_sizes[i]);
+        c->end = c->bump + count * lpool_sizes[i];
+        c->slabs++;
+    }
+    void *p = c->bump;
+    c->bump += lpool_sizes[i];
+    return p;
+}
 
-    for (int i = 0; i < syms->count; i++) {
-        lenv_put(e, syms->cell[i], v->cell[i+1]);
+// Give back "size" bytes allocated with lpool_alloc
+void lpool_free(void *p, size_t size){
+    if(size > LPOOL_MAX_SIZE) {
+        lpool_large_frees++;
+        free(p);
+        return;
     }
 
-    lval_del(v);
-    // Return empty expression "()"
-    return lval_sexpr();
-}
+    int i = 0;
+    while(lpool_sizes[i] < size) i++;
+    lpool_class *c = &lpool[i];
+    c->frees++;
 
-lval *builtin_exit(lenv *e, lval *v) {
-    e->run = 0;
-    lval_del(v);
-    return lval_sym("Exiting");
+    if(c->nfree == LPOOL_MAGAZINE) lpool_unload(c, i);
+    lpool_block *b = p;
+    b->next = c->free;
+    c->free = b;
+    c->nfree++;
 }
 
-lval *builtin_printenv(lenv *e, lval *v){
-    for(int i = 0; i < e->count; i++) {
-        printf("%s\n", e->syms[i]);
+// Refill the empty free list of "c", of the class "i", with its spare
+// magazine or one from the depot
+void lpool_reload(lpool_class *c, int i){
+    if(!c->spare) {
+        // The lock is only taken when there is something to take
+        if(!__atomic_load_n(&lpool_depot[i], __ATOMIC_RELAXED)) return;
+        pthread_mutex_lock(&lpool_depot_lock);
+        c->spare = lpool_depot[i];
+        if(c->spare) __atomic_store_n(&lpool_depot[i], c->spare->next_magazine, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&lpool_depot_lock);
+        if(!c->spare) return;
     }
-    return lval_sexpr();
+    c->free = c->spare;
+    c->nfree = LPOOL_MAGAZINE;
+    c->spare = NULL;
 }
 
-lval *builtin_lambda(lenv *e, lval *v){
-    // Check two arguments, each of which are Q-Expressions
-    LASSERT_NUM(
+// Make room in the full free list of "c", of the class "i". It becomes the
+// spare magazine, the one before goes to the depot.
+void lpool_unload(lpool_class *c, int i){
+    if(c->spare) {
+        pthread_mutex_lock(&lpool_depot_lock);
+        c->spare->next_magazine = lpool_depot[i];
+        __atomic_store_n(&lpool_depot[i], c->spare, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&lpool_depot_lock);
+    }
+    c->spare = c->free;
+    c->free = NULL;
+    c->nfree = 0;
 }
 
-lval *lval_join(lval *x, lval *y) {
-    // For each cell in 'y' add it to 'x'
-    while(y->count) {
-        x = lval_add(x, lval_pop(y, 0));
+// Move a cell array to a new capacity, keeping the first cells
+lval **lcell_resize(lval **cell, int old_cap, int new_cap){
+    size_t old_size = sizeof(lval*) * old_cap;
+    size_t new_size = sizeof(lval*) * new_cap;
+
+    // Big arrays are left to realloc
+    if(old_size > LPOOL_MAX_SIZE && new_size > LPOOL_MAX_SIZE) return realloc(cell, new_size);
+
+    lval **n = new_cap ? LVAL_MALLOC(new_size) : NULL;
+    if(cell) {
+        if(n) memcpy(n, cell, (old_cap < new_cap ? old_size : new_size));
+        LVAL_FREE(cell, old_size);
     }
+    return n;
+}
 
-    // Delete the empty 'y' and return 'x'
-    lval_del(y);
-    return x;
+// FNV-1a
+unsigned long lsym_hash(const char *s){
+    unsigned long h = 14695981039346656037UL;
+    for(; *s; s++) {
+        h ^= (unsigned char)*s;
+        h *= 1099511628211UL;
+    }
+    return h;
 }
 
-lval *lval_num(long x){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_NUM;
-    v->num = x;
-    v->err = NULL;
-    v->sym = NULL;
-    v->count = 0;
-    v->cell = NULL;
-    v->builtin = NULL;
-    v->formals = NULL;
-    v->body = NULL;
-    v->env = NULL;
-    return v;
+// Look for "s" in "t" without locking, NULL if it's not there
+char *lsym_find(lsym_table *t, const char *s, unsigned long hash){
+    for(unsigned long i = hash & t->mask; ; i = (i + 1) & t->mask) {
+        char *slot = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+        if(!slot) return NULL;
+        if(LSYM_HASH(slot) == hash && strcmp(slot, s) == 0) return slot;
+    }
 }
 
-lval *lval_err(char *s, ...){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_ERR;
-    v->sym = NULL;
-    v->num = 0;
-    v->count = 0;
-    v->cell = NULL;
-    v->builtin = NULL;
-    v->formals = NULL;
-    v->body = NULL;
-    v->env = NULL;
+// Get the unique copy of the symbol name "s"
+char *lsym_intern(const char *s){
+    unsigned long hash = lsym_hash(s);
 
-    // Create a va list and initialize it
-    va_list va;
-    va_start(va, s);
+    lsym_table *t = __atomic_load_n(&lsym_current, __ATOMIC_ACQUIRE);
+    char *found = t ? lsym_find(t, s, hash) : NULL;
+    if(found) return found;
+
+    pthread_mutex_lock(&lsym_lock);
+
+    // Someone else could have added it or replaced the table meanwhile
+    t = lsym_current;
+    found = t ? lsym_find(t, s, hash) : NULL;
+    if(found) {
+        pthread_mutex_unlock(&lsym_lock);
+        return found;
+    }
+
+    // Keep the table at most half full
+    if(!t || (t->count + 1) * 2 > t->mask + 1) {
+        lsym_table *n = malloc(sizeof(lsym_table));
+        n->mask = t ? t->mask * 2 + 1 : 255;
+        n->count = t ? t->count : 0;
+        n->slots = calloc(n->mask + 1, sizeof(char*));
+        n->prev = t;
+        for(unsigned long i = 0; t && i <= t->mask; i++) {
+            char *slot = t->slots[i];
+            if(!slot) continue;
+            unsigned long j = LSYM_HASH(slot) & n->mask;
+            while(n->slots[j]) j = (j + 1) & n->mask;
+            n->slots[j] = slot;
+        }
+        __atomic_store_n(&lsym_current, n, __ATOMIC_RELEASE);
+        t = n;
+    }
+
+    lsym *a = malloc(sizeof(lsym) + strlen(s) + 1);
+    a->hash = hash;
+    strcpy(a->name, s);
+
+    unsigned long i = hash & t->mask;
+    while(t->slots[i]) i = (i + 1) & t->mask;
+    __atomic_store_n(&t->slots[i], a->name, __ATOMIC_RELEASE);
+    t->count++;
 
-    // Allocate 512 bytes for the error string
-    v->err = malloc(512);
+    pthread_mutex_unlock(&lsym_lock);
+    return a->name;
+}
+
+// Allocate a heap lval of "size" bytes, see LVAL_SIZEOF
+lval *lval_alloc(int type, size_t size){
+    lval *v = LVAL_MALLOC(size);
+    v->type = type;
+#ifdef LISPY_GC
+    v->gc = GC_YOUNG;
+#endif
+    v->refs = 1;
+    return v;
+}
+
+// Allocation size of a heap lval
+size_t lval_size(lval *v){
+    switch(v->type) {
+        case LVAL_NUM: return LVAL_SIZEOF(num);
+        case LVAL_ERR: return LVAL_SIZEOF(args);
+        case LVAL_SYM: return LVAL_SIZEOF(ver);
+        case LVAL_FUN: return v->builtin ? LVAL_SIZEOF(builtin) : LVAL_SIZEOF(code);
+        case LVAL_VEC: return LVAL_SIZEOF(vec);
+        case LVAL_BIG: return LVAL_SIZEOF(limbs) + sizeof(uint64_t) * v->limbs;
+        case LVAL_DBL: return LVAL_SIZEOF(dbl);
+        case LVAL_ARR: return LVAL_SIZEOF(len) + sizeof(int64_t) * v->len;
+        default: return LVAL_SIZEOF(cell);
+    }
+}
 
-    // Create the error string from the arguments passed
-    vsnprintf(v->err, 511, s, va);
+lval *lval_dbl(double x){
+    lval *v = lval_alloc(LVAL_DBL, LVAL_SIZEOF(dbl));
+    v->dbl = x;
+    return v;
+}
 
-    // Reallocate the string to the actual size
-    v->err = realloc(v->err, strlen(v->err)+1);
+// Error "code" with the message "fmt" formats, see "Errors"
+lval *lval_err(int code, char *fmt, ...){
+    lval *v = lval_alloc(LVAL_ERR, LVAL_SIZEOF(args));
+    v->fmt = fmt;
+    v->errcode = code;
 
-    // Cleanup the va list
+    // The arguments are read by their conversions, like printf does
+    va_list va;
+    va_start(va, fmt);
+    int n = 0;
+    for(char *p = fmt; *p && n < LERR_ARGS; p++) {
+        if(*p != '%') continue;
+        p += strspn(p + 1, "-+ #0123456789.") + 1;
+        int l = *p == 'l';
+        p += l;
+        switch(*p) {
+            case '%': break;
+            case 's': v->args[n++].s = va_arg(va, char*); break;
+            case 'f': case 'g': case 'e': v->args[n++].d = va_arg(va, double); break;
+            default: v->args[n++].i = l ? va_arg(va, long) : va_arg(va, int); break;
+        }
+    }
     va_end(va);
 
     return v;
 }
 
+// Write the message of the error "v" to "buf", which holds "size" bytes
+char *lerr_format(lval *v, char *buf, int size){
+    int len = 0;
+    int n = 0;
+    char *p = v->fmt;
+    while(*p && len < size - 1) {
+        if(*p != '%') {
+            buf[len++] = *p++;
+            continue;
+        }
+
+        // One conversion at a time
+        char spec[16];
+        char *start = p;
+        p += strspn(p + 1, "-+ #0123456789.") + 1;
+        int l = *p == 'l';
+        p += l;
+        char c = *p++;
+        int m = p - start < (int)sizeof(spec) ? p - start : (int)sizeof(spec) - 1;
+        memcpy(spec, start, m);
+        spec[m] = '\0';
+
+        lerr_arg a = { 0 };
+        if(c != '%' && n < LERR_ARGS) a = v->args[n++];
+        switch(c) {
+            case '%': len += snprintf(buf + len, size - len, "%%"); break;
+            case 's': len += snprintf(buf + len, size - len, spec, a.s); break;
+            case 'f': case 'g': case 'e': len += snprintf(buf + len, size - len, spec, a.d); break;
+            default:
+                if(l) len += snprintf(buf + len, size - len, spec, a.i);
+                else len += snprintf(buf + len, size - len, spec, (int)a.i);
+                break;
+        }
+    }
+    if(len > size - 1) len = size - 1;
+    buf[len] = '\0';
+    return buf;
+}
+
 lval *lval_sym(char *s){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SYM;
-    v->sym = malloc(strlen(s) + 1);
-    strcpy(v->sym, s);
-    v->err = NULL;
-    v->num = 0;
-    v->count = 0;
-    v->cell = NULL;
-    v->builtin = NULL;
-    v->formals = NULL;
-    v->body = NULL;
-    v->env = NULL;
+    lval *v = lval_alloc(LVAL_SYM, LVAL_SIZEOF(ver));
+    v->sym = lsym_intern(s);
+    v->depth = -1;
+    v->slot = -1;
+    v->ref = NULL;
+    v->ver = 0;
     return v;
 }
 
 lval *lval_sexpr(void){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_SEXPR;
-    v->err = NULL;
-    v->sym = NULL;
-    v->num = 0;
+    lval *v = lval_alloc(LVAL_SEXPR, LVAL_SIZEOF(cell));
     v->count = 0;
+    v->off = 0;
+    v->cap = 0;
     v->cell = NULL;
-    v->builtin = NULL;
-    v->formals = NULL;
-    v->body = NULL;
-    v->env = NULL;
     return v;
 }
 
 lval *lval_qexpr(void){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_QEXPR;
-    v->err = NULL;
-    v->sym = NULL;
-    v->num = 0;
+    lval *v = lval_alloc(LVAL_QEXPR, LVAL_SIZEOF(cell));
     v->count = 0;
+    v->off = 0;
+    v->cap = 0;
     v->cell = NULL;
-    v->builtin = NULL;
-    v->formals = NULL;
-    v->body = NULL;
-    v->env = NULL;
     return v;
 }
 
-lval *lval_fun(lbuiltin func){
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    v->builtin = func;
-    v->formals = NULL;
-    v->body = NULL;
-    v->env = NULL;
-    v->err = NULL;
-    v->sym = NULL;
-    v->num = 0;
-    v->count = 0;
-    v->cell = NULL;
+// Vector of the tree "t", takes the reference to it
+lval *lval_vec(lvec *t){
+    lval *v = lval_alloc(LVAL_VEC, LVAL_SIZEOF(vec));
+    v->vec = t;
     return v;
 }
 
-lval *lval_lambda(lval *formals, lval *body) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
-    // builtin is set to null for user created functions
-    v->builtin = NULL;
-    // build new environment
-    v->env = lenv_new();
-    // set formals and body
-    v->formals = formals;
-    v->body = body;
-
-    v->err = NULL;
-    v->sym = NULL;
-    v->num = 0;
-    v->count = 0;
-    v->cell = NULL;
+lval *lval_fun(lbuiltin func){
+    // Builtins don't need the lambda fields
+    lval *v = lval_alloc(LVAL_FUN, LVAL_SIZEOF(builtin));
+    v->builtin = func;
     return v;
 }
 
-// This is used in lval_copy
-lval *lval_lambda(lval *formals, lval *body, lenv* env) {
-    lval *v = malloc(sizeof(lval));
-    v->type = LVAL_FUN;
+// Lambda with the scope "env", takes the reference to it
+lval *lval_lambda(lval *formals, lval *body, lenv *env) {
+    lval *v = lval_alloc(LVAL_FUN, LVAL_SIZEOF(code));
     // builtin is set to null for user created functions
     v->builtin = NULL;
-    // set formals, body and env
+    v->env = env;
+    // set formals and body
     v->formals = formals;
     v->body = body;
-    v->env = env;
-
-    v->err = NULL;
-    v->sym = NULL;
-    v->num = 0;
-    v->count = 0;
-    v->cell = NULL;
+    v->code = NULL;
     return v;
 }
 
 lenv *lenv_new(void){
-    lenv *e = malloc(sizeof(lenv));
+    // Symbols compared directly in the evaluator
+    if(!lsym_amp) lsym_amp = lsym_intern("&");
+
+    lenv_allocs++;
+    lenv *e = lenv_spare;
+    if(e) {
+        // Its arrays are reused
+        lenv_spare = e->par;
+        lenv_spare_count--;
+        lenv_reused++;
+    } else {
+        e = malloc(sizeof(lenv));
+        e->cap = 0;
+        e->syms = NULL;
+        e->vals = NULL;
+        e->hashes = NULL;
+    }
     e->run = 1;
+    e->refs = 1;
+    e->par = NULL;
+    e->ver = lenv_versions += LPAR_THREADS_MAX;
+    e->shared = NULL;
     e->count = 0;
-    e->syms = NULL;
-    e->vals = NULL;
+    e->index = NULL;
+    e->mask = 0;
+    e->old_index = NULL;
+    e->old_mask = 0;
+    e->migrated = 0;
+    e->migrating = 0;
     return e;
 }
 
+// Delete "e" with its values, and drop its reference to the parent
 void lenv_del(lenv *e){
     for(int i = 0; i < e->count; i++) {
-        free(e->syms[i]);
         lval_del(e->vals[i]);
     }
+    if(e->par) lenv_unref(e->par);
+    lenv_free(e);
+}
+
+// Free the environment without touching the values
+void lenv_free(lenv *e){
+    if(e->cap <= LENV_SPARE_CAP && !e->index && !e->old_index && lenv_spare_count < LENV_SPARE_MAX) {
+        e->par = lenv_spare;
+        lenv_spare = e;
+        lenv_spare_count++;
+        return;
+    }
     free(e->syms);
     free(e->vals);
+    free(e->hashes);
+    free(e->index);
+    free(e->old_index);
     free(e);
 }
 
-lval *lenv_get(lenv *e, lval *k) {
-    // Iterate over all the symbols in the environment and check if any
-    // of them matches to the given lval
-    for(int i = 0; i < e->count; i++) {
-        // Return a copy of the matching lval
-        if(strcmp(e->syms[i], k->sym) == 0) return lval_copy(e->vals[i]);
+// Position of the binding for "sym", or -1 if there is none
+int lenv_find(lenv *e, char *sym){
+    // Small environments are simply scanned
+    if(!e->index) {
+        for(int i = 0; i < e->count; i++) {
+            if(e->syms[i] == sym) return i;
+        }
+        return -1;
+    }
+
+    unsigned long hash = LSYM_HASH(sym);
+    int i = lenv_probe(e->index, e->mask, e->syms, sym, hash);
+    if(i < 0 && e->old_index) i = lenv_probe(e->old_index, e->old_mask, e->syms, sym, hash);
+    return i;
+}
+
+int lenv_probe(int *index, int mask, char **syms, char *sym, unsigned long hash){
+    for(unsigned long i = hash & mask; ; i = (i + 1) & mask) {
+        int pos = index[i];
+        if(pos < 0) return -1;
+        if(syms[pos] == sym) return pos;
+    }
+}
+
+void lenv_index_add(int *index, int mask, unsigned long hash, int pos){
+    unsigned long i = hash & mask;
+    while(index[i] >= 0) i = (i + 1) & mask;
+    index[i] = pos;
+}
+
+// Start moving the bindings to an index twice as big
+void lenv_index_grow(lenv *e){
+    // Finish the previous move first
+    if(e->old_index) lenv_migrate(e, e->migrating);
+
+    e->old_index = e->index;
+    e->old_mask = e->mask;
+    e->migrated = 0;
+    e->migrating = e->index ? e->count : 0;
+
+    e->mask = e->index ? e->mask * 2 + 1 : 2 * LENV_INDEX_MIN - 1;
+    e->index = malloc(sizeof(int) * (e->mask + 1));
+    memset(e->index, -1, sizeof(int) * (e->mask + 1));
+
+    // The first index is built right away
+    if(!e->old_index) {
+        for(int i = 0; i < e->count; i++) lenv_index_add(e->index, e->mask, e->hashes[i], i);
+    }
+}
+
+// Move up to "steps" bindings from the old index to the new one
+void lenv_migrate(lenv *e, int steps){
+    while(steps-- > 0 && e->migrated < e->migrating) {
+        int i = e->migrated++;
+        lenv_index_add(e->index, e->mask, e->hashes[i], i);
     }
+    if(e->old_index && e->migrated == e->migrating) {
+        free(e->old_index);
+        e->old_index = NULL;
+    }
+}
+
+lval *lenv_get(lenv *e, lval *k) {
+    // Return a copy of the matching lval
+    int i = lenv_find(e, k->sym);
+    if(i >= 0) return lval_copy(e->vals[i]);
+    // No match, check the parent environment
+    if(e->par) return lenv_get(e->par, k);
     // No match, return error
-    return lval_err("Unbound symbol '%s'", k->sym);
+    return lval_err(LERR_UNBOUND, "Unbound symbol '%s'", k->sym);
 }
 
 void lenv_put(lenv *e, lval *k, lval *v){
-    // Iterate over all the symbols in the environment and check if any
-    // of them matches to the given lval
-    for(int i = 0; i < e->count; i++) {
-        if(strcmp(e->syms[i], k->sym) == 0) {
-            // Replace the the value with the new one and return
-            lval_del(e->vals[i]);
-            e->vals[i] = lval_copy(v);
-            return;
-        }
+    if(e->old_index) lenv_migrate(e, LENV_MIGRATE_STEP);
+
+    int i = lenv_find(e, k->sym);
+    if(i >= 0) {
+        // Replace the the value with the new one and return
+        lval_del(e->vals[i]);
+        e->vals[i] = lval_copy(v);
+        return;
     }
 
     // Value not found, add the new value to the environment
-    e->count++;
-    e->vals = realloc(e->vals, sizeof(lval*) * e->count);
-    e->syms = realloc(e->syms, sizeof(char*) * e->count);
-    e->vals[e->count-1] = lval_copy(v);
-    e->syms[e->count-1] = malloc(strlen(k->sym)+1);
-    strcpy(e->syms[e->count-1], k->sym);
+    lenv_append(e, k->sym, v);
+}
+
+// Add a binding of "sym", which "e" doesn't have, to "v"
+void lenv_append(lenv *e, char *sym, lval *v){
+    // Keep the index at most half full
+    if(e->count + 1 > LENV_INDEX_MIN && (e->count + 1) * 2 > e->mask + 1) lenv_index_grow(e);
+
+    if(e->count == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 4;
+        e->vals = realloc(e->vals, sizeof(lval*) * e->cap);
+        // The bindings moved, caches of the old place are stale
+        e->ver = lenv_versions += LPAR_THREADS_MAX;
+        e->syms = realloc(e->syms, sizeof(char*) * e->cap);
+        e->hashes = realloc(e->hashes, sizeof(unsigned long) * e->cap);
+    }
+    int pos = e->count++;
+    e->vals[pos] = lval_copy(v);
+    e->syms[pos] = sym;
+    e->hashes[pos] = LSYM_HASH(sym);
+    if(e->index) lenv_index_add(e->index, e->mask, e->hashes[pos], pos);
+}
+
+// Define the value in the global environment
+void lenv_def(lenv *e, lval *k, lval *v){
+    while(e->par) e = e->par;
+    lenv_put(e, k, v);
 }
 
 void lenv_add_builtin(lenv *e, char *name, lbuiltin func){
@@ -801,9 +2519,12 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "cons", builtin_cons);
     lenv_add_builtin(e, "init", builtin_init);
     lenv_add_builtin(e, "len",  builtin_len);
+    lenv_add_builtin(e, "vec",  builtin_vec);
+    lenv_add_builtin(e, "nth",  builtin_nth);
 
     // Variable functions
     lenv_add_builtin(e, "def",  builtin_def);
+    lenv_add_builtin(e, "\\",  builtin_lambda);
 
     // Math functions
     lenv_add_builtin(e, "+",  builtin_add);
@@ -813,30 +2534,96 @@ void lenv_add_builtins(lenv *e) {
     lenv_add_builtin(e, "%",  builtin_rem);
     lenv_add_builtin(e, "max",  builtin_max);
     lenv_add_builtin(e, "min",  builtin_min);
+    lenv_add_builtin(e, "^",  builtin_pow);
+    lenv_add_builtin(e, "sqrt",  builtin_sqrt);
+    lenv_add_builtin(e, "exp",  builtin_exp);
+    lenv_add_builtin(e, "log",  builtin_log);
+    lenv_add_builtin(e, "sin",  builtin_sin);
+
+    // Array functions
+    lsimd_init();
+    lenv_add_builtin(e, "array",  builtin_array);
+    lenv_add_builtin(e, "range",  builtin_range);
+    lenv_add_builtin(e, "sum",  builtin_sum);
+    lenv_add_builtin(e, "amin",  builtin_amin);
+    lenv_add_builtin(e, "amax",  builtin_amax);
+    lenv_add_builtin(e, "dot",  builtin_dot);
+    lenv_add_builtin(e, "<",  builtin_lt);
+    lenv_add_builtin(e, ">",  builtin_gt);
+    lenv_add_builtin(e, "<=",  builtin_le);
+    lenv_add_builtin(e, ">=",  builtin_ge);
+    lenv_add_builtin(e, "==",  builtin_eq);
+    lenv_add_builtin(e, "!=",  builtin_ne);
+
+    // Conditionals, see "Special forms"
+    lenv_add_builtin(e, "if",  builtin_if);
+    lenv_add_builtin(e, "and",  builtin_and);
+    lenv_add_builtin(e, "or",  builtin_or);
+    lenv_add_builtin(e, "cond",  builtin_cond);
+
+    // Loops, see "Loops"
+    lenv_add_builtin(e, "while",  builtin_while);
+    lenv_add_builtin(e, "dotimes",  builtin_dotimes);
+    lenv_add_builtin(e, "foreach",  builtin_foreach);
+
+    // Higher-order functions
+    lenv_add_builtin(e, "map",  builtin_map);
+    lenv_add_builtin(e, "filter",  builtin_filter);
+    lenv_add_builtin(e, "foldl",  builtin_foldl);
+    lenv_add_builtin(e, "foldr",  builtin_foldr);
+    lenv_add_builtin(e, "reduce",  builtin_reduce);
+    lenv_add_builtin(e, "pmap",  builtin_pmap);
+    lenv_add_builtin(e, "preduce",  builtin_preduce);
 
     // Other
     lenv_add_builtin(e, "exit", builtin_exit);
     lenv_add_builtin(e, "printenv", builtin_printenv);
+    lenv_add_builtin(e, "stats", builtin_stats);
+    lenv_add_builtin(e, "frames", builtin_frames);
+#ifdef LISPY_GC
+    lenv_add_builtin(e, "gc", builtin_gc);
+#endif
 }
 
 lval *lval_read_num(mpc_ast_t *t){
     errno = 0;
+    if(strpbrk(t->contents, ".eE")) {
+        double d = strtod(t->contents, NULL);
+        if(errno != ERANGE) return lval_dbl(d);
+        return lval_err(LERR_VALUE, "Invalid number");
+    }
+
     long x = strtol(t->contents, NULL, 10);
     if(errno != ERANGE) {
         return lval_num(x);
     }
-    else return lval_err("Invalid number");
+    // Too big for a long
+    return lval_read_big(t->contents);
 }
 
 // Print the lval "value"
 void lval_print(lenv *e, lval *v) {
-    switch(v->type) {
-        case LVAL_ERR:
-            printf("Error: %s", v->err);
+    switch(LVAL_TYPE(v)) {
+        case LVAL_ERR: {
+            char msg[LERR_MSG_MAX];
+            printf("Error: %s", lerr_format(v, msg, sizeof(msg)));
             break;
+        }
 
         case LVAL_NUM:
-            printf("%li", v->num);
+            printf("%li", lval_num_value(v));
+            break;
+
+        case LVAL_BIG:
+            lval_big_print(v);
+            break;
+
+        case LVAL_DBL:
+            lval_dbl_print(v->dbl);
+            break;
+
+        case LVAL_ARR:
+            lval_arr_print(v);
             break;
 
         case LVAL_SYM:
@@ -844,26 +2631,35 @@ void lval_print(lenv *e, lval *v) {
             break;
 
         case LVAL_SEXPR:
-            lval_expr_print(e, v, '(', ')');
+            // A folded call prints as the call
+            lval_expr_print(e, lval_is_folded(v) ? v->cell[2] : v, '(', ')');
             break;
 
         case LVAL_QEXPR:
             lval_expr_print(e, v, '{', '}');
             break;
 
+        case LVAL_VEC: {
+            int first = 1;
+            putchar('[');
+            lvec_print(e, v->vec, &first);
+            putchar(']');
+            break;
+        }
+
         case LVAL_FUN:
             if(v->builtin) {
                 for(int i = 0; i < e->count; i++) {
-                    if(v->builtin == e->vals[i]->builtin) {
+                    if(LVAL_TYPE(e->vals[i]) == LVAL_FUN && v->builtin == e->vals[i]->builtin) {
                         printf("Function name: %s", e->syms[i]);
                         break;
                     }
                 }
             } else {
                 printf("(\\ ");
-                lval_print(v->formals);
+                lval_print(e, v->formals);
                 putchar(' ');
-                lval_print(v->body);
+                lval_print(e, v->body);
                 putchar(')');
             }
             break;
@@ -884,13 +2680,56 @@ void lval_expr_print(lenv *e, lval *v, char open, char close) {
     putchar(close);
 }
 
+// Print the shortest form of "x" that reads back as the same double, always
+// with a '.' or an exponent so it doesn't look like an integer
+void lval_dbl_print(double x) {
+    char buf[32];
+    for(int p = 15; p <= 17; p++) {
+        snprintf(buf, sizeof(buf), "%.*g", p, x);
+        if(strtod(buf, NULL) == x) break;
+    }
+    fputs(buf, stdout);
+    if(isfinite(x) && !strpbrk(buf, ".e")) fputs(".0", stdout);
+}
+
+// Print the values of a vector tree, separated by spaces
+void lvec_print(lenv *e, lvec *t, int *first) {
+    if(!t) return;
+    if(t->height) {
+        lvec_print(e, t->child[0], first);
+        lvec_print(e, t->child[1], first);
+        return;
+    }
+    for(int i = 0; i < t->count; i++) {
+        if(!*first) putchar(' ');
+        *first = 0;
+        lval_print(e, t->item[i]);
+    }
+}
+
 // Print the lval "value" plus a newline char
 void lval_println(lenv *e, lval *v) { lval_print(e, v); putchar('\n'); }
 
 lval *lval_add(lval *v, lval *x){
+    if(v->off + v->count == v->cap) {
+        lval **base = LVAL_CELL_BASE(v);
+        if(v->off && v->off >= v->cap / 2) {
+            // At least half of the array was popped from the front, move
+            // the list back to the start instead of growing
+            memmove(base, v->cell, sizeof(lval*) * v->count);
+            v->cell = base;
+        } else {
+            // Grow the cell array by doubling it, the list starts at the
+            // beginning of the new one
+            int cap = v->cap ? v->cap * 2 : 2;
+            if(v->off) memmove(base, v->cell, sizeof(lval*) * v->count);
+            v->cell = lcell_resize(base, v->cap, cap);
+            v->cap = cap;
+        }
+        v->off = 0;
+    }
+    v->cell[v->count] = x;
     v->count += 1;
-    v->cell = realloc(v->cell, sizeof(lval*) * v->count);
-    v->cell[v->count - 1] = x;
     return v;
 }
 
@@ -904,6 +2743,7 @@ lval *lval_read(mpc_ast_t *t) {
     if (strcmp(t->tag, ">") == 0) x = lval_sexpr();
     if (strstr(t->tag, "sexpr"))  x = lval_sexpr();
     if (strstr(t->tag, "qexpr"))  x = lval_qexpr();
+    if (strstr(t->tag, "vector")) x = lval_qexpr();
 
     // Fill this list with any valid expression contained within
     for (int i = 0; i < t->children_num; i++) {
@@ -911,27 +2751,32 @@ lval *lval_read(mpc_ast_t *t) {
         if(strcmp(t->children[i]->contents, ")") == 0) continue;
         if(strcmp(t->children[i]->contents, "}") == 0) continue;
         if(strcmp(t->children[i]->contents, "{") == 0) continue;
+        if(strcmp(t->children[i]->contents, "[") == 0) continue;
+        if(strcmp(t->children[i]->contents, "]") == 0) continue;
         if(strcmp(t->children[i]->tag,  "regex") == 0) continue;
         x = lval_add(x, lval_read(t->children[i]));
     }
 
+    // Vectors are read like Q-Expressions and then converted
+    if (strstr(t->tag, "vector")) return lval_vec_from(x);
     return x;
 }
 
-void lval_del(lval *v) {
+// Free "v" and what it references, once its last reference is gone. Kept
+// out of lval_del so the common case of dropping a shared reference stays a
+// few instructions without a stack frame.
+void lval_free(lval *v) {
     switch(v->type) {
         case LVAL_NUM:
             // Nothing extra to free with the number type
             break;
 
         case LVAL_ERR:
-            // Free the error string
-            free(v->err);
+            // The message is made when it's printed, there is no string
             break;
 
         case LVAL_SYM:
-            // Free the symbol string
-            free(v->sym);
+            // Symbol names are interned and never freed
             break;
 
         case LVAL_SEXPR:
@@ -941,18 +2786,33 @@ void lval_del(lval *v) {
                 lval_del(v->cell[i]);
             }
             // Free the pointer array as well
-            free(v->cell);
+            lcell_resize(LVAL_CELL_BASE(v), v->cap, 0);
             break;
 
         case LVAL_FUN:
             if(!v->builtin){
-                lenv_del(v->env);
+                lenv_unref(v->env);
                 lval_del(v->formals);
                 lval_del(v->body);
+                if(v->code) lcode_del(v->code);
             }
             break;
+
+        case LVAL_VEC:
+            // Nodes shared with other vectors are kept
+            lvec_del(v->vec);
+            break;
+    }
+
+#ifdef LISPY_GC
+    // Old lvals are only freed by a major collection
+    if(v->gc == GC_OLD) {
+        v->gc = GC_DEAD;
+        lgc.dead_bytes += gc_size(v);
+        return;
     }
+#endif
 
-    // Finally free the lval struct itself
-    free(v);
+    // Finally give the lval struct itself back to the pool
+    LVAL_FREE(v, lval_size(v));
 }
@@ -0,0 +1,38 @@
+#!/bin/sh
+# Run every tests/*.lspy and compare what it prints with tests/*.out
+#
+#   tests/check.sh ./parsing        through the REPL
+#   tests/check.sh -c ./lispyc      as a program compiled by lispyc
+#
+# The REPL's banner and prompts are left out, so both print the same
+# thing. Variables like LISPY_EVAL are passed on from the environment.
+
+compile=0
+if [ "$1" = "-c" ]; then
+    compile=1
+    shift
+fi
+lispy=$1
+dir=$(dirname "$0")
+tmp=$(mktemp -d)
+trap 'rm -rf "$tmp"' EXIT
+
+failed=0
+for t in "$dir"/*.lspy; do
+    name=$(basename "$t" .lspy)
+    if [ $compile = 1 ]; then
+        "$lispy" -o "$tmp/$name" "$t" && "$tmp/$name" > "$tmp/$name.got" 2>&1
+    else
+        # GNU readline echoes the prompt and the line read, editline
+        # doesn't when the input isn't a terminal
+        "$lispy" < "$t" 2>&1 | sed -e '1,3d' -e '/^lispy> /d' > "$tmp/$name.got"
+    fi
+    if ! diff -u "$dir/$name.out" "$tmp/$name.got" > "$tmp/$name.diff"; then
+        echo "FAIL $name ($lispy)"
+        head -n 20 "$tmp/$name.diff"
+        failed=1
+    fi
+done
+
+[ $failed = 0 ] && echo "ok $lispy"
+exit $failed
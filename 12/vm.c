@@ -0,0 +1,690 @@
+// Bytecode compiler and lvm, see "Bytecode" in lispy.h
+#include "lispy.h"
+
+int lvm_enabled = 1;
+
+// Compile "v" as if it was an S-Expression, whatever its type. Returns
+// NULL when it is too big for 16 bit operands or nested deeper than
+// LCOMP_NESTING_MAX, it is left to the tree walker then.
+lcode *lcode_compile(lval *v){
+    lcomp c = { NULL, 0, 0, lval_qexpr(), 0, 0, 0, 0 };
+    lcomp_sexpr(&c, v, 1);
+    lcomp_emit(&c, LOP_RETURN, 0, 0, 0);
+
+    if(c.failed) {
+        free(c.code);
+        lval_del(c.consts);
+        return NULL;
+    }
+
+    lcode *code = malloc(sizeof(lcode) + sizeof(uint16_t) * c.count);
+    code->refs = 1;
+    code->count = c.count;
+    code->stack = c.stack;
+    code->consts = c.consts;
+#ifdef LISPY_JIT
+    code->calls = 0;
+    code->native = NULL;
+    code->native_size = 0;
+#endif
+    memcpy(code->code, c.code, sizeof(uint16_t) * c.count);
+    free(c.code);
+    return code;
+}
+
+// Append the instruction "op" with its "n" operands "a" and "b"
+void lcomp_emit(lcomp *c, int op, int n, int a, int b){
+    if(a > LCODE_MAX || b > LCODE_MAX) c->failed = 1;
+    if(c->count + 3 > c->cap) {
+        c->cap = c->cap ? c->cap * 2 : 32;
+        c->code = realloc(c->code, sizeof(uint16_t) * c->cap);
+    }
+    c->code[c->count++] = op;
+    if(n > 0) c->code[c->count++] = a;
+    if(n > 1) c->code[c->count++] = b;
+}
+
+// Add "x" to the constants and return its index
+int lcomp_const(lcomp *c, lval *x){
+    lval_add(c->consts, x);
+    return c->consts->count - 1;
+}
+
+// Code that pushes the value of "v"
+void lcomp_expr(lcomp *c, lval *v){
+    switch(LVAL_TYPE(v)) {
+        case LVAL_SEXPR:
+            lcomp_sexpr(c, v, 0);
+            return;
+
+        case LVAL_SYM:
+            // Formals of the lambda being compiled are read from the frame
+            if(v->depth == 0) lcomp_emit(c, LOP_LOCAL, 2, v->slot, lcomp_const(c, lval_copy(v)));
+            else lcomp_emit(c, LOP_SYM, 1, lcomp_const(c, lval_copy(v)), 0);
+            break;
+
+        default:
+            // Everything else, Q-Expressions included, evaluates to itself
+            lcomp_emit(c, LOP_CONST, 1, lcomp_const(c, lval_copy(v)), 0);
+            break;
+    }
+    lcomp_push(c);
+}
+
+// One more stack slot in use
+void lcomp_push(lcomp *c){
+    c->depth++;
+    if(c->depth > c->stack) c->stack = c->depth;
+}
+
+// Code that pushes the value of the S-Expression "v", whose value is
+// returned right away if it is in "tail" position
+void lcomp_sexpr(lcomp *c, lval *v, int tail){
+    // The empty expression is its own value
+    if(v->count == 0) {
+        lcomp_emit(c, LOP_CONST, 1, lcomp_const(c, lval_sexpr()), 0);
+        lcomp_push(c);
+        return;
+    }
+
+    if(++c->nesting > LCOMP_NESTING_MAX) {
+        c->failed = 1;
+        return;
+    }
+    int form = lcomp_form_of(v);
+    if(form != LFORM_NONE) {
+        lcomp_form(c, v, form, tail);
+        c->nesting--;
+        return;
+    }
+    for(int i = 0; i < v->count && !c->failed; i++) lcomp_expr(c, v->cell[i]);
+    c->nesting--;
+
+    // Calls that are likely to be integer arithmetic
+    int op = LOP_CALL;
+    if(v->count == 3 && LVAL_TYPE(v->cell[0]) == LVAL_SYM) {
+        char *sym = v->cell[0]->sym;
+        if(strcmp(sym, "+") == 0) op = LOP_ADD;
+        if(strcmp(sym, "-") == 0) op = LOP_SUB;
+        if(strcmp(sym, "*") == 0) op = LOP_MUL;
+    }
+
+    if(op == LOP_CALL) lcomp_emit(c, tail ? LOP_TAIL : LOP_CALL, 1, v->count, 0);
+    else lcomp_emit(c, op, 0, 0, 0);
+    c->depth -= v->count - 1;
+}
+
+// The special form "v" calls by the name of its builtin, or LFORM_NONE.
+// The arguments are checked like lform_of does. A folded call has its
+// builtin itself.
+int lcomp_form_of(lval *v){
+    if(lval_is_folded(v)) return LFORM_FOLD;
+    if(LVAL_TYPE(v->cell[0]) != LVAL_SYM) return LFORM_NONE;
+    char *sym = v->cell[0]->sym;
+    if(strcmp(sym, "if") == 0) return v->count == 3 || v->count == 4 ? LFORM_IF : LFORM_NONE;
+    if(v->count < 2) return LFORM_NONE;
+    if(strcmp(sym, "and") == 0) return LFORM_AND;
+    if(strcmp(sym, "or") == 0) return LFORM_OR;
+    if(strcmp(sym, "cond") == 0) return LFORM_COND;
+    return LFORM_NONE;
+}
+
+// Code for the special form "form" called by "v", see LOP_LAZY. The
+// S-Expression itself is the fallback for when its name is bound to
+// something else. A folded call is LOP_FOLD and the code of its call.
+void lcomp_form(lcomp *c, lval *v, int form, int tail){
+    if(form == LFORM_FOLD) {
+        lcomp_emit(c, LOP_FOLD, 2, lcomp_const(c, lval_copy(v)), 0);
+        int end = c->count - 1;
+        lcomp_branch(c, v->cell[2], tail);
+        lcomp_patch(c, end);
+        return;
+    }
+
+    int *ends = malloc(sizeof(int) * (v->count + 1));
+    int n = 0;
+
+    // A lambda body or a list passed to "eval" is still a Q-Expression
+    lval *expr = lval_unshare(lval_copy(v));
+    expr->type = LVAL_SEXPR;
+    lcomp_expr(c, v->cell[0]);
+    lcomp_emit(c, LOP_LAZY, 2, form, lcomp_const(c, expr));
+    ends[n++] = lcomp_jump(c, LOP_JUMP, 1);
+    int base = --c->depth;
+
+    if(form == LFORM_AND || form == LFORM_OR) {
+        for(int i = 1; i < v->count; i++) {
+            int last = i == v->count - 1;
+            lcomp_branch(c, v->cell[i], tail && last);
+            if(last) break;
+            ends[n++] = lcomp_jump(c, form == LFORM_AND ? LOP_AND : LOP_OR, 1);
+            c->depth--;
+        }
+    } else {
+        // "if" is a "cond" of one clause
+        int i = 1;
+        for(; i + 1 < v->count && (form == LFORM_COND || i == 1); i += 2) {
+            lcomp_expr(c, v->cell[i]);
+            int next = lcomp_jump(c, LOP_TEST, 1);
+            c->depth--;
+            lcomp_branch(c, v->cell[i + 1], tail);
+            ends[n++] = lcomp_jump(c, LOP_JUMP, 1);
+            c->depth = base;
+            lcomp_patch(c, next);
+        }
+        if(i < v->count) {
+            lcomp_branch(c, v->cell[i], tail);
+        } else {
+            lcomp_emit(c, LOP_CONST, 1, lcomp_const(c, lval_sexpr()), 0);
+            lcomp_push(c);
+        }
+    }
+
+    for(int i = 0; i < n; i++) lcomp_patch(c, ends[i]);
+    free(ends);
+    c->depth = base + 1;
+}
+
+// Code that pushes the value of the argument "x" of a special form
+void lcomp_branch(lcomp *c, lval *x, int tail){
+    if(LVAL_TYPE(x) == LVAL_SEXPR) lcomp_sexpr(c, x, tail);
+    else lcomp_expr(c, x);
+}
+
+// Append the jump "op" with "n" operands to patch, returns where the
+// first one is
+int lcomp_jump(lcomp *c, int op, int n){
+    lcomp_emit(c, op, n, 0, 0);
+    return c->count - n;
+}
+
+// Make the operand at "at" jump to the end of the code so far
+void lcomp_patch(lcomp *c, int at){
+    if(c->count > LCODE_MAX) c->failed = 1;
+    else c->code[at] = c->count;
+}
+
+void lcode_del(lcode *c){
+    if(--c->refs > 0) return;
+    lval_del(c->consts);
+#ifdef LISPY_JIT
+    if(c->native) munmap(c->native, c->native_size);
+#endif
+    free(c);
+}
+
+// Evaluate the S-Expression "v" by compiling and running it
+lval *lvm_eval(lenv *e, lval *v){
+    lcode *c = lcode_compile(v);
+    if(!c) return lval_eval_sexpr(e, v);
+    lval_del(v);
+
+    lval *r = lvm_run(e, c);
+    lcode_del(c);
+    return r;
+}
+
+// Make room for "need" elements of "size" bytes in "*buf", which is the
+// local array "local" until it first grows
+void lvm_reserve(void **buf, void *local, int *cap, int need, size_t size){
+    if(need <= *cap) return;
+    int n = *cap;
+    while(n < need) n *= 2;
+    if(*buf == local) {
+        *buf = malloc(size * n);
+        memcpy(*buf, local, size * *cap);
+    } else {
+        *buf = realloc(*buf, size * n);
+    }
+    *cap = n;
+}
+
+// Inline arithmetic of the builtin "b", for the three values on top of
+// the stack
+#define LVM_FIXNUM_CALL(b) (LVM_IS_BUILTIN(sp[-3], b) && LVAL_IS_FIXNUM(sp[-2]) && LVAL_IS_FIXNUM(sp[-1]))
+#define LVM_IS_ERR(v) (!LVAL_IS_FIXNUM(v) && (v)->type == LVAL_ERR)
+#define LVM_FIXNUM_RESULT(x) do { long r = (x); lval_del(sp[-3]); sp -= 2; sp[-1] = lval_num(r); } while(0)
+
+// Run "c" in the environment "e"
+lval *lvm_run(lenv *e, lcode *c){
+    return lvm_exec(e, c, NULL);
+}
+
+// Run "c" in the environment "e". "fn" is the lambda whose body "c" is,
+// and is consumed, or NULL.
+lval *lvm_exec(lenv *e, lcode *c, lval *fn){
+    lval *stack_local[LVM_STACK_MIN];
+    lvm_frame frames_local[LVM_FRAMES_MIN];
+    lval **stack = stack_local;
+    lvm_frame *frames = frames_local;
+    int stack_cap = LVM_STACK_MIN;
+    int frames_cap = LVM_FRAMES_MIN;
+    lvm_reserve((void**)&stack, stack_local, &stack_cap, c->stack, sizeof(lval*));
+
+    lvm_frame *fr = frames;
+    fr->code = c;
+    fr->env = lenv_ref(e);
+    fr->fn = fn;
+    fr->own_code = 0;
+
+    // Registers of the current frame
+    uint16_t *pc = c->code;
+    lval **k = c->consts->cell;
+    lenv *env = e;
+    lval **sp = stack;
+    int n;
+    int tail = 0;
+#ifdef LISPY_GC
+    // Only the evaluation main started collects, see gc_poll. The
+    // constants may move.
+    int top = lgc.top;
+    lgc.top = 0;
+#define LVM_POLL() do { \
+        if(!top) break; \
+        lgc_roots roots = { NULL, c, frames, fr + 1 - frames, stack, sp - stack }; \
+        if(gc_poll(&roots)) k = fr->code->consts->cell; \
+    } while(0)
+#else
+#define LVM_POLL()
+#endif
+
+#ifdef LVM_COMPUTED_GOTO
+    static void *labels[] = {
+        &&LOP_CONST, &&LOP_SYM, &&LOP_LOCAL, &&LOP_CALL, &&LOP_TAIL, &&LOP_ADD, &&LOP_SUB, &&LOP_MUL, &&LOP_RETURN,
+        &&LOP_LAZY, &&LOP_JUMP, &&LOP_TEST, &&LOP_AND, &&LOP_OR, &&LOP_FOLD
+    };
+#define LVM_CASE(op) op
+#define LVM_NEXT goto *labels[*pc++]
+#ifdef LISPY_JIT
+    if(fn && ljit_ready(fn)) goto native;
+#endif
+    LVM_NEXT;
+#else
+#define LVM_CASE(op) case op
+#define LVM_NEXT continue
+#ifdef LISPY_JIT
+    if(fn && ljit_ready(fn)) goto native;
+#endif
+    for(;;) switch(*pc++) {
+#endif
+
+    LVM_CASE(LOP_CONST):
+        *sp++ = lval_copy(k[*pc++]);
+        LVM_NEXT;
+
+    LVM_CASE(LOP_SYM):
+        *sp++ = lval_lookup(env, k[*pc++]);
+        if(LVM_IS_ERR(sp[-1])) goto unwind;
+        LVM_NEXT;
+
+    LVM_CASE(LOP_LOCAL): {
+        int slot = pc[0];
+        lval *sym = k[pc[1]];
+        pc += 2;
+        // The slot is checked like in lval_lookup
+        if(slot < env->count && env->syms[slot] == sym->sym) {
+            *sp++ = lval_copy(env->vals[slot]);
+        } else {
+            *sp++ = lval_lookup(env, sym);
+            if(LVM_IS_ERR(sp[-1])) goto unwind;
+        }
+        LVM_NEXT;
+    }
+
+    LVM_CASE(LOP_ADD):
+        if(LVM_FIXNUM_CALL(builtin_add)) {
+            LVM_FIXNUM_RESULT(LVAL_FIXNUM_VALUE(sp[-2]) + LVAL_FIXNUM_VALUE(sp[-1]));
+            LVM_NEXT;
+        }
+        n = 3;
+        goto call;
+
+    LVM_CASE(LOP_SUB):
+        if(LVM_FIXNUM_CALL(builtin_sub)) {
+            LVM_FIXNUM_RESULT(LVAL_FIXNUM_VALUE(sp[-2]) - LVAL_FIXNUM_VALUE(sp[-1]));
+            LVM_NEXT;
+        }
+        n = 3;
+        goto call;
+
+    LVM_CASE(LOP_MUL): {
+        long m;
+        if(LVM_FIXNUM_CALL(builtin_mul) && !__builtin_mul_overflow(LVAL_FIXNUM_VALUE(sp[-2]), LVAL_FIXNUM_VALUE(sp[-1]), &m)) {
+            LVM_FIXNUM_RESULT(m);
+            LVM_NEXT;
+        }
+        n = 3;
+        goto call;
+    }
+
+    LVM_CASE(LOP_LAZY):
+        pc += 2;
+        if(lvm_lazy(sp - 1, pc[-2], k[pc[-1]], env)) {
+            sp--;
+            pc += 2;
+        } else if(LVM_IS_ERR(sp[-1])) {
+            goto unwind;
+        }
+        LVM_NEXT;
+
+    LVM_CASE(LOP_JUMP):
+        pc = fr->code->code + *pc;
+        LVM_NEXT;
+
+    LVM_CASE(LOP_TEST):
+        n = lvm_test(sp - 1);
+        if(n < 0) goto unwind;
+        sp--;
+        pc = n ? pc + 1 : fr->code->code + *pc;
+        LVM_NEXT;
+
+    LVM_CASE(LOP_AND):
+    LVM_CASE(LOP_OR):
+        n = lvm_and(sp - 1, pc[-1] == LOP_OR);
+        if(n < 0) goto unwind;
+        if(n) {
+            sp--;
+            pc++;
+        } else {
+            pc = fr->code->code + *pc;
+        }
+        LVM_NEXT;
+
+    LVM_CASE(LOP_FOLD): {
+        lval *x = lvm_fold(k[pc[0]], env);
+        if(x) {
+            *sp++ = x;
+            pc = fr->code->code + pc[1];
+        } else {
+            pc += 2;
+        }
+        LVM_NEXT;
+    }
+
+    LVM_CASE(LOP_TAIL):
+        n = *pc++;
+        tail = 1;
+        goto call;
+
+    LVM_CASE(LOP_CALL):
+        n = *pc++;
+    call: {
+        int t = tail;
+        tail = 0;
+        sp -= n;
+
+        // "eval" of a list in tail position runs the list in this frame
+        if(t && n == 2 && LVM_IS_BUILTIN(sp[0], builtin_eval) && lval_is_list(sp[1])) {
+            lval *x = sp[1]->type == LVAL_VEC ? lval_vec_to_expr(lval_copy(sp[1]), LVAL_QEXPR) : lval_copy(sp[1]);
+            lcode *code = lcode_compile(x);
+            lval_del(x);
+            if(code) {
+                lval_del(sp[0]);
+                lval_del(sp[1]);
+                if(fr->own_code) lcode_del(fr->code);
+                fr->code = code;
+                fr->own_code = 1;
+
+                int depth = sp - stack;
+                lvm_reserve((void**)&stack, stack_local, &stack_cap, depth + code->stack, sizeof(lval*));
+                sp = stack + depth;
+                pc = code->code;
+                k = code->consts->cell;
+                LVM_NEXT;
+            }
+        }
+
+        lval *f = NULL;
+        lenv *fenv = NULL;
+        lval *r = lvm_call(env, sp, n, &f, &fenv);
+        if(r) {
+            *sp++ = r;
+            if(LVM_IS_ERR(r)) goto unwind;
+            LVM_NEXT;
+        }
+
+        // A lambda to run. In tail position it takes the place of this
+        // frame, nothing the callee looks up goes through this frame's
+        // environment.
+        int depth = sp - stack;
+        int frame = fr - frames;
+        lvm_reserve((void**)&stack, stack_local, &stack_cap, depth + f->code->stack, sizeof(lval*));
+        sp = stack + depth;
+
+        if(t) {
+            lenv_unref(fr->env);
+            if(fr->fn) lval_del(fr->fn);
+            if(fr->own_code) lcode_del(fr->code);
+        } else {
+            lvm_reserve((void**)&frames, frames_local, &frames_cap, frame + 2, sizeof(lvm_frame));
+            fr = frames + frame;
+            fr->pc = pc;
+            fr++;
+        }
+
+        fr->code = f->code;
+        fr->env = fenv;
+        fr->fn = f;
+        fr->own_code = 0;
+        pc = f->code->code;
+        k = f->code->consts->cell;
+        env = fenv;
+        LVM_POLL();
+#ifdef LISPY_JIT
+        if(ljit_ready(fr->fn)) goto native;
+#endif
+        LVM_NEXT;
+    }
+
+#ifdef LISPY_JIT
+    native: {
+        // The frame's lambda runs as native code. It returns its value or
+        // what it calls in tail position, which then takes the place of
+        // the frame.
+        LVM_POLL();
+        ljit_exit x = { NULL, NULL, NULL };
+        lval *r = ljit_run(fr->code, env, &x);
+        if(r) {
+            *sp++ = r;
+            if(LVM_IS_ERR(r)) goto unwind;
+            goto lvm_return;
+        }
+
+        if(x.code) {
+            if(fr->own_code) lcode_del(fr->code);
+            fr->code = x.code;
+            fr->own_code = 1;
+        } else {
+            lenv_unref(fr->env);
+            lval_del(fr->fn);
+            if(fr->own_code) lcode_del(fr->code);
+            fr->code = x.fn->code;
+            fr->env = x.env;
+            fr->fn = x.fn;
+            fr->own_code = 0;
+            env = x.env;
+        }
+
+        int depth = sp - stack;
+        lvm_reserve((void**)&stack, stack_local, &stack_cap, depth + fr->code->stack, sizeof(lval*));
+        sp = stack + depth;
+        pc = fr->code->code;
+        k = fr->code->consts->cell;
+        if(!x.code && ljit_ready(fr->fn)) goto native;
+        LVM_NEXT;
+    }
+#endif
+
+    LVM_CASE(LOP_RETURN):
+#ifdef LISPY_JIT
+    lvm_return:
+#endif
+    {
+        lval *r = *--sp;
+
+        // Release what the frame holds
+        lenv_unref(fr->env);
+        if(fr->fn) lval_del(fr->fn);
+        if(fr->own_code) lcode_del(fr->code);
+
+        if(fr == frames) {
+            if(stack != stack_local) free(stack);
+            if(frames != frames_local) free(frames);
+            return r;
+        }
+
+        // Back to the caller, the result replaces the call
+        fr--;
+        pc = fr->pc;
+        k = fr->code->consts->cell;
+        env = fr->env;
+        *sp++ = r;
+        LVM_NEXT;
+    }
+
+    unwind: {
+        // An error on top is the value of everything this lvm_exec runs,
+        // each frame would return it before evaluating anything else
+        lval *err = *--sp;
+        while(sp > stack) lval_del(*--sp);
+        for(;; fr--) {
+            lenv_unref(fr->env);
+            if(fr->fn) lval_del(fr->fn);
+            if(fr->own_code) lcode_del(fr->code);
+            if(fr == frames) break;
+        }
+        if(stack != stack_local) free(stack);
+        if(frames != frames_local) free(frames);
+        return err;
+    }
+
+#ifndef LVM_COMPUTED_GOTO
+    }
+#endif
+#undef LVM_CASE
+#undef LVM_NEXT
+#undef LVM_POLL
+}
+
+// Evaluate an S-Expression of the "n" values at "args", which are all
+// consumed, like lval_eval_sexpr does once it evaluated the children.
+// Compiled lambdas are only bound, the lambda to run is returned in
+// "*enter" and the environment to run it in in "*env" instead of a
+// result.
+lval *lvm_call(lenv *e, lval **args, int n, lval **enter, lenv **env){
+    // Error checking
+    for(int i = 0; i < n; i++) {
+        if(LVAL_TYPE(args[i]) == LVAL_ERR) {
+            lval *err = args[i];
+            for(int j = 0; j < n; j++) {
+                if(j != i) lval_del(args[j]);
+            }
+            return err;
+        }
+    }
+
+    // Single expression (ignore functions that should have no arguments)
+    if(n == 1 && !builtin_takes_no_args(args[0])) return args[0];
+
+    lval *f = args[0];
+    if(LVAL_TYPE(f) != LVAL_FUN) {
+        for(int i = 0; i < n; i++) lval_del(args[i]);
+        return lval_err(LERR_NOT_FUN, "S-expression does not start with a function!");
+    }
+
+    // Lambdas called with all their arguments are bound straight from the
+    // stack
+    if(!f->builtin && f->code && f->formals->count == n - 1) {
+        lval **formals = f->formals->cell;
+        int i = 0;
+        while(i < n - 1 && formals[i]->sym != lsym_amp) i++;
+        if(i == n - 1) {
+            *env = lenv_new();
+            (*env)->par = lenv_ref(f->env);
+            for(i = 0; i < n - 1; i++) {
+                lenv_put(*env, formals[i], args[i + 1]);
+                lval_del(args[i + 1]);
+            }
+            *enter = f;
+            return NULL;
+        }
+    }
+
+    // The arguments go in an S-Expression like for the tree walker
+    lval *v = lval_sexpr();
+    if(n > 1) {
+        v->cell = lcell_resize(NULL, 0, n - 1);
+        memcpy(v->cell, args + 1, sizeof(lval*) * (n - 1));
+        v->count = n - 1;
+        v->cap = n - 1;
+    }
+
+    if(f->builtin || !f->code) {
+        lval *r = lval_call(e, f, v);
+        lval_del(f);
+        return r;
+    }
+
+    lval *r = lval_bind(e, f, v, env);
+    if(r) {
+        lval_del(f);
+        return r;
+    }
+    *enter = f;
+    return NULL;
+}
+
+// Evaluate an S-Expression of the "n" values at "args", which are all
+// consumed
+lval *lvm_apply(lenv *e, lval **args, int n){
+    lval *f;
+    lenv *env;
+    lval *r = lvm_call(e, args, n, &f, &env);
+    if(r) return r;
+    r = lvm_exec(env, f->code, f);
+    lenv_unref(env);
+    return r;
+}
+
+// The builtins of the special forms, by LFORM_*
+static lbuiltin lvm_forms[] = { NULL, builtin_if, builtin_and, builtin_or, builtin_cond };
+
+// LAZY: whether the function at "top" is the builtin of the special form
+// "form", which the S-Expression "expr" calls. It is released then,
+// otherwise it is replaced by the value of "expr" in "e".
+int lvm_lazy(lval **top, int form, lval *expr, lenv *e){
+    lval *f = *top;
+    int lazy = !LVAL_IS_FIXNUM(f) && f->type == LVAL_FUN && f->builtin == lvm_forms[form];
+    lval_del(f);
+    if(!lazy) *top = lval_eval(e, lval_copy(expr));
+    return lazy;
+}
+
+// FOLD: a new reference to the value of the folded call "v" if its
+// builtins are still bound in "e", otherwise NULL
+lval *lvm_fold(lval *v, lenv *e){
+    return lfold_valid(e, v) ? lval_copy(v->cell[1]) : NULL;
+}
+
+// TEST: truth of the condition at "top", which is released, or -1 when it
+// is replaced by an error
+int lvm_test(lval **top){
+    int t = lval_truth(*top);
+    if(t < 0) *top = lval_cond_err(*top);
+    else lval_del(*top);
+    return t;
+}
+
+// AND and OR: 1 to go on with the next argument, the value at "top" is
+// released then. 0 when it is the value of the form, -1 when it was
+// replaced by an error.
+int lvm_and(lval **top, int or){
+    int t = lval_truth(*top);
+    if(t < 0) {
+        *top = lval_cond_err(*top);
+        return -1;
+    }
+    if(t == or) return 0;
+    lval_del(*top);
+    return 1;
+}